@@ -8,13 +8,53 @@
 
 #include <stdint.h>
 
+/*
+ * Define ADC_10BIT to carry the full 10-bit ADC results through calibration,
+ * joy, clamp and into the DACs. Config values stay 8-bit and are scaled with
+ * ADC_SCALE() where they meet sampled coordinates.
+ */
+#if defined(ADC_10BIT)
+typedef uint16_t adc_t;
+typedef uint32_t adc_wide_t;  /* Holds the product of two adc_t */
+#   define ADC_BITS 10
+#else
+typedef uint8_t adc_t;
+typedef uint16_t adc_wide_t;
+#   define ADC_BITS 8
+#endif
+
+#define ADC_CENTER   ((adc_t)(1u << (ADC_BITS - 1)))
+#define ADC_MAX      ((adc_t)((1u << ADC_BITS) - 1))
+#define ADC_SCALE(v) ((adc_t)((adc_t)(v) << (ADC_BITS - 8)))
+#define ADC_TO_U8(v) ((uint8_t)((v) >> (ADC_BITS - 8)))
+
+/* The ADC has no automatic acquisition time, so a conversion must not start
+ * until the hold capacitor has followed the newly selected channel. About
+ * 4.9 us for a 10k source at 50 C, see the datasheet's example */
+#define ADC_TACQ_US 5
+
 void adc_init(void);
 
-void adc_set_fast_sampling_mode(void);
+/*!
+ * @brief Triggers conversions from TMR2 on the HFINTOSC at ADC_HIGH_RATE_HZ
+ * for tracking the stick closely while the output is overridden. Undone by
+ * adc_set_slow_sampling_mode().
+ */
+void adc_set_high_rate_mode(void);
+#define ADC_HIGH_RATE_HZ 5000u
+#define ADC_HIGH_RATE_PAIR_HZ ADC_HIGH_RATE_HZ  /* X and Y are converted per trigger */
 void adc_set_slow_sampling_mode(void);
 uint8_t adc_has_new_data_get_and_clear(void);
 
-const uint8_t* adc_joy_xy(void);
+/*!
+ * @brief Joystick position with the calibration applied.
+ */
+const adc_t* adc_joy_xy(void);
+
+/*!
+ * @brief Joystick position as measured.
+ */
+const adc_t* adc_joy_raw_xy(void);
 
 void adc_isr(void);
 
@@ -0,0 +1,84 @@
+/*!
+ * @file bin.h
+ * @author TheComet
+ */
+
+#ifndef BIN_H
+#define	BIN_H
+
+#include <stdint.h>
+
+/*
+ * Binary protocol for reading and writing config images without going
+ * through the CLI. A request starts with BIN_STX, which the CLI never sees
+ * otherwise, and is answered with exactly one response. The CLI resumes
+ * afterwards.
+ *
+ *   Request:  STX, op | (profile << 4), offset, len, data[len], crc
+ *   Response: STX, status, len, data[len], crc
+ *
+ * A request whose bytes are more than BIN_TIMEOUT_US apart is dropped
+ * without a response, so a stray STX only holds up the CLI that long.
+ *
+ * Only write requests carry data, read requests use len to request
+ * that many bytes. len is at most BIN_MAX_LEN. The CRC is CRC-8 (poly 0x07,
+ * init 0) over every byte after STX. Offsets are into struct config of the
+ * given profile, see config.h. Nothing is written unless the CRC matches.
+ *
+ * The PATTERN ops access the pattern area instead (see seq.h) and ignore the
+ * profile. Pattern writes go to flash right away, at offsets that are a
+ * multiple of BIN_MAX_LEN. A write at the start of a row erases the row, so
+ * the area is written in order. The write at offset 0 stops the table in
+ * use and leaves the magic erased, whatever it carries. Other writes are
+ * refused while a table is in use. PATTERN_COMMIT then programs the magic if
+ * the table is complete (see seq_commit()).
+ */
+#define BIN_STX     0x02
+#define BIN_MAX_LEN 16
+#define BIN_TIMEOUT_US 20000u  /* Below the 65 ms TMR1 wraps after */
+
+#define BIN_OP_LIST \
+    X(INFO)   /* Response: sizeof(struct config), profile count, BIN_MAX_LEN, active profile */ \
+    X(READ)   \
+    X(WRITE)  \
+    X(SAVE)   /* Response status is BIN_OK or BIN_SAVE_ERROR + enum config_save_result */ \
+    X(PATTERN_READ)  \
+    X(PATTERN_WRITE) /* Response status on a flash error like SAVE */ \
+    X(PATTERN_COMMIT) /* Response: number of states in use, 0 for the built-in sequences */
+
+enum bin_op
+{
+#define X(name) BIN_OP_##name,
+    BIN_OP_LIST
+#undef X
+    BIN_OP_COUNT
+};
+
+enum bin_status
+{
+    BIN_OK,
+    BIN_BAD_CRC,
+    BIN_BAD_OP,
+    BIN_OUT_OF_RANGE,
+    BIN_SAVE_ERROR
+};
+
+uint8_t bin_crc8(uint8_t crc, uint8_t byte);
+
+/*!
+ * @brief Starts a new request after BIN_STX was received.
+ */
+void bin_start(void);
+
+/*!
+ * @brief Returns 1 if the next byte of the request is overdue.
+ */
+uint8_t bin_timed_out(void);
+
+/*!
+ * @brief Feeds a received byte following BIN_STX into the request parser.
+ * Returns 1 once the request was answered and the CLI should take over again.
+ */
+uint8_t bin_putc(char c);
+
+#endif	/* BIN_H */
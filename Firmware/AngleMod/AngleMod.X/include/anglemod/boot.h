@@ -0,0 +1,46 @@
+/*!
+ * @file boot.h
+ * @author TheComet
+ */
+
+#ifndef BOOT_H
+#define	BOOT_H
+
+#include <xc.h>
+#include <stdint.h>
+
+/*
+ * Milestones on the way from reset to being fully up, timestamped in us with
+ * TMR1. btn_init() starts TMR1 early in init() from its reset value of 0, so
+ * the times only miss the C startup code before main(). Everything is reached
+ * long before TMR1 wraps after 65 ms.
+ */
+#define BOOT_MARK_LIST \
+    X(CONTROL, "Control") /* Config loaded, ADC, button and DACs set up, interrupts on */ \
+    X(SAMPLE,  "Sample")  /* First X/Y pair converted */ \
+    X(CLI,     "CLI")     /* UART receiving */
+
+enum boot_mark
+{
+#define X(name, str) BOOT_##name,
+    BOOT_MARK_LIST
+#undef X
+
+    BOOT_MARK_COUNT
+};
+
+/* 0 while the mark hasn't been reached yet */
+extern uint16_t _boot_times[BOOT_MARK_COUNT];
+
+/*!
+ * @brief Records the time of a mark the first time it is reached. Later calls
+ * only cost a compare, so this can sit on the sampling path.
+ */
+#define boot_mark(m) do { \
+        if (!_boot_times[m]) \
+            _boot_times[m] = (uint16_t)TMR1 | 1u; \
+    } while (0)
+
+#define boot_time_us(m) (_boot_times[m])
+
+#endif	/* BOOT_H */
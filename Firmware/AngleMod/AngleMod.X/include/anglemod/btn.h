@@ -14,15 +14,16 @@ extern uint8_t _btn_state;
 void btn_init(void);
 
 /*!
- * @brief Gets the current state of the button on the port and stores it for
+ * @brief Takes the debounced state of the button and stores it for
  * processing. This should be called once by the main thread after being woken 
  * up from sleep before using btn_pressed(), btn_released(), etc.
  * 
- * @note Only works if btn is not mapped to the 8th bit on the port. If this
- * is ever the case just shift everything right instead of left
+ * The first edge is acted on immediately by btn_ioc_isr(), after which the
+ * pin is ignored for the lockout time in the config. Once the lockout expires
+ * the state is synced with the pin again, in case it settled at the other
+ * level.
  */
-#define btn_poll() \
-    _btn_state = (uint8_t)(_btn_state << 1u) | (PORTx(BTN_PORT) & BTN_BIT)
+void btn_poll(void);
     
 #define btn_pressed() \
     (!(_btn_state & BTN_BIT) && (_btn_state & (BTN_BIT << 1)))
@@ -33,6 +34,14 @@ void btn_init(void);
 #define btn_is_active() \
     (!(_btn_state & BTN_BIT))
 
+/*!
+ * @brief Time in us from the last edge to btn_poll() picking it up, and the
+ * largest seen since the last reset. Saturates at 255.
+ */
+uint8_t btn_latency_last(void);
+uint8_t btn_latency_max(void);
+void btn_latency_reset(void);
+
 void btn_ioc_isr(void);
 
 #endif	/* BTN_H */
@@ -0,0 +1,74 @@
+/*!
+ * @file calib.h
+ * @author TheComet
+ */
+
+#ifndef CALIB_H
+#define	CALIB_H
+
+#include "anglemod/adc.h"
+#include "anglemod/host.h"
+#include <stdint.h>
+
+/*
+ * Each axis is mapped with two linear segments that meet at the center. The
+ * slopes are fixed-point with ADC_BITS fractional bits, so applying them takes
+ * a multiply and a shift instead of a division or a table.
+ */
+struct calib_map
+{
+    adc_t min, center, max;  /* Raw readings */
+    adc_wide_t scale[2];     /* Output per raw step, below and above center */
+    adc_t clamp[2];          /* Active profile's dac_clamp bounds, unapplied */
+};
+
+extern HOST_LOCAL struct calib_map _calib_map[2];
+
+/*!
+ * @brief Recomputes the mapping from the calibration values and the DAC clamp
+ * bounds of the active profile. Needs to be called whenever they change.
+ */
+void calib_build_lut(void);
+
+/*!
+ * @brief Maps a raw ADC reading of an axis (0=X, 1=Y) to a value where the
+ * stick's center is at ADC_CENTER and its extremes are at 0 and ADC_MAX.
+ * Without a usable calibration, readings pass through. raw is evaluated more
+ * than once.
+ */
+#define calib_apply(axis, raw) \
+    ((raw) <= _calib_map[axis].min ? (adc_t)0 : \
+     (raw) >= _calib_map[axis].max ? ADC_MAX : \
+     (raw) <= _calib_map[axis].center ? \
+        (adc_t)(ADC_CENTER - (((adc_wide_t)(_calib_map[axis].center - (raw)) * _calib_map[axis].scale[0]) >> ADC_BITS)) : \
+        (adc_t)(ADC_CENTER + (((adc_wide_t)((raw) - _calib_map[axis].center) * _calib_map[axis].scale[1]) >> ADC_BITS)))
+
+/*!
+ * @brief The inverse of calib_apply(). Converts a value where the center is at
+ * ADC_CENTER back into what the stick would output, which is what the console
+ * expects from the DACs.
+ */
+adc_t calib_unapply(uint8_t axis, adc_t value);
+
+/*!
+ * @brief calib_unapply() of the lower (0) or upper (1) bound that
+ * dac_override_clamp() clamps an axis to.
+ */
+#define calib_clamp_bound(axis, upper) \
+    _calib_map[axis].clamp[upper]
+
+/*!
+ * @brief Makes the current raw reading the stick's center, in all profiles,
+ * and rebuilds the mapping.
+ */
+void calib_set_center(const adc_t raw_xy[2]);
+
+/*!
+ * @brief While capturing, every raw sample passed to calib_capture() widens
+ * the min/max range of the active profile's calibration values.
+ */
+void calib_capture_start(const adc_t raw_xy[2]);
+void calib_capture(const adc_t raw_xy[2]);
+uint8_t calib_capture_stop(void);
+
+#endif	/* CALIB_H */
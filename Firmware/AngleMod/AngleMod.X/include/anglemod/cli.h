@@ -7,10 +7,16 @@
 #define	CLI_H
 
 #define CLI_LINE_LEN 16
-#define CLI_HISTORY_LEN 8
+#define CLI_HISTORY_BUF_SIZE 64  /* Must be a power of 2 */
 #define CLI_USE_COLOR
 #define CLI_USE_UNICODE
 
 extern void (*cli_putc)(char c);
 
+/*!
+ * Returns to the CLI if a binary request stopped halfway, see
+ * BIN_TIMEOUT_US. Called by the main loop.
+ */
+void cli_poll(void);
+
 #endif	/* CLI_H */
@@ -0,0 +1,101 @@
+/*!
+ * @file clk.h
+ * @author TheComet
+ */
+
+#ifndef CLK_H
+#define	CLK_H
+
+#include <stdint.h>
+
+/*
+ * HFINTOSC runs at 32 MHz only while something needs the speed, and at 4 MHz
+ * otherwise. Everything clocked from Fosc is adjusted on every switch:
+ *
+ *   - UART: BRG16=1 and BRGH=1 give Fosc / (4 * (SP1BRG + 1)), which is
+ *     38462 baud at both frequencies, so only SP1BRG changes.
+ *   - TMR1: The prescaler keeps Fosc/4 at 1 MHz, so btn.c and boot.h still
+ *     count in us.
+ *   - SPI runs at Fosc/4 and TMR2 from HFINTOSC. Both are only used while
+ *     the output is overridden, which boosts the clock right away, so they
+ *     always run at the speeds dac.c and adc.c were written for.
+ *   - Busy waits that run in both modes use clk_delay_us().
+ *
+ * The clock doesn't switch while the UART is shifting a byte out, and
+ * interrupts are off while it switches so the TX ISR can't start one.
+ * Bytes being received would be garbled too. The next byte can start right
+ * after a stop bit, so other than for CLK_OVERRIDE the clock only switches
+ * once uart_quiet() says the line has been quiet for a byte time. Until then
+ * the switch is pending, and clk_poll() retries it. Bytes that arrive back
+ * to back are all received at the same clock, unless the button is pressed
+ * while they arrive.
+ */
+/* For __delay_us(), which is sized for the boosted clock */
+#define _XTAL_FREQ 32000000ul
+
+#define CLK_LIST \
+    X(IDLE,  4000000ul,  0x02, 0x03) /* HFFRQ=010, CKPS=00 (1:1) */ \
+    X(BOOST, 32000000ul, 0x05, 0x33) /* HFFRQ=101, CKPS=11 (1:8) */
+
+enum clk_mode
+{
+#define X(name, hz, oscfrq, t1con) CLK_##name,
+    CLK_LIST
+#undef X
+
+    CLK_MODE_COUNT
+};
+
+/* Reasons to boost. The clock is boosted while any of them is set */
+#define CLK_OVERRIDE 0x01  /* Button held, the DACs and TMR2 are in use */
+#define CLK_UART     0x02  /* Sending or receiving, see uart_idle() */
+
+extern uint8_t _clk_busy;
+extern enum clk_mode _clk_mode;
+
+/*!
+ * @brief __delay_us() at the current clock, which is also safe in an ISR. At
+ * 4 MHz an instruction takes 1 us.
+ */
+#define clk_delay_us(us) do { \
+        if (_clk_mode == CLK_BOOST) \
+            __delay_us(us); \
+        else \
+            _delay(us); \
+    } while (0)
+
+/*!
+ * @brief Drops to idle after reset, which starts at 32 MHz. Call after
+ * uart_init() and btn_init(), whose registers it adjusts.
+ */
+void clk_init(void);
+
+void clk_set_busy(uint8_t busy);
+
+/*!
+ * @brief Switches if the reasons changed while the line wasn't quiet. Call
+ * from the main loop.
+ */
+void clk_poll(void);
+enum clk_mode clk_active_mode(void);
+
+/*!
+ * @brief SP1BRG for 38400 baud at the current clock.
+ */
+uint8_t clk_sp1brg(void);
+
+/* Only call into clk.c when the mode might change, so these are cheap enough
+ * to be used on every character that is sent */
+#define clk_boost(reason) do { \
+        if (!(_clk_busy & (reason))) \
+            clk_set_busy(_clk_busy | (reason)); \
+    } while (0)
+
+#define clk_release(reason) do { \
+        if (_clk_busy & (reason)) \
+            clk_set_busy(_clk_busy & (uint8_t)~(reason)); \
+    } while (0)
+
+#define clk_is_busy(reason) (_clk_busy & (reason))
+
+#endif	/* CLK_H */
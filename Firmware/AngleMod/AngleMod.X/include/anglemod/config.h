@@ -6,8 +6,13 @@
 #ifndef CONFIG_H
 #define	CONFIG_H
 
+#include "anglemod/host.h"
 #include <stdint.h>
 
+#define CONFIG_PROFILE_COUNT    3
+#define CONFIG_PROFILE_NAME_LEN 4
+#define CONFIG_NVM_SIZE         64  /* Bytes of SAF holding struct config */
+
 enum normal_mode
 {
     NORMAL_MODE_OFF,
@@ -24,7 +29,7 @@ enum quantize_mode
     QUANTIZE_12,
 };
 
-struct config
+struct HOST_PACKED config
 {
     uint8_t magic;
 
@@ -34,7 +39,7 @@ struct config
             unsigned diagonal_angles : 8;
             unsigned special_angles  : 8;
             unsigned normal_mode     : 2;  /* 00 = OFF, 01 = clamp, 10 = quantize */
-            unsigned _padding        : 6;
+            unsigned btn_lockout     : 6;  /* ms to ignore the button after an edge */
         };
         uint8_t bytes[4];
     } enable;
@@ -84,13 +89,75 @@ struct config
         uint8_t xy[2];
     } angles[24];
 
-    uint8_t _padding[6];
+    /*!
+     * @brief Raw ADC readings of the stick at rest and at its extremes. The
+     * stick belongs to the unit and not to a profile, so all profiles carry
+     * the same values. Invalid if min < center < max doesn't hold, in which
+     * case no correction is applied.
+     */
+    struct {
+        uint8_t center[2];
+        uint8_t min[2];
+        uint8_t max[2];
+    } calib;
+};
+
+enum config_save_result
+{
+    CONFIG_SAVE_OK,
+    CONFIG_SAVE_WRITE_ERROR,
+    CONFIG_SAVE_TOO_MANY_CHANGES  /* Profiles differ too much from profile 0 */
 };
 
 void config_load_from_nvm(void);
 void config_set_defaults(void);
-uint8_t config_save_to_nvm(void);
+enum config_save_result config_save_to_nvm(void);
 
+/*!
+ * @brief Returns the active profile.
+ */
 struct config* config_get(void);
 
+/*!
+ * @brief Returns any profile, active or not.
+ */
+struct config* config_get_profile(uint8_t idx);
+
+/*!
+ * @brief Makes a different profile the active one. All profiles are kept in
+ * RAM, so this only swaps a pointer and takes effect immediately.
+ */
+void config_select_profile(uint8_t idx);
+uint8_t config_active_profile(void);
+
+/*!
+ * @brief The pattern area holds the user patterns compiled by provision (see
+ * seq.h). It is the 4 rows of flash below SAF, 0x1F00-0x1F7F, which the
+ * linker keeps free of code. Writes go to flash right away and don't belong
+ * to any profile.
+ */
+#define CONFIG_PATTERN_AREA_SIZE 128
+
+uint8_t config_read_pattern_area(uint8_t offset);
+
+/*!
+ * @brief Writes len bytes, which must not cross a row (32 bytes). Writing at
+ * the start of a row erases the row first, even if len is 0.
+ * @return Returns 0 on a write error.
+ */
+uint8_t config_write_pattern_area(uint8_t offset, const uint8_t* data, uint8_t len);
+
+/*!
+ * @brief Programs a single byte without erasing its row. Flash can only clear
+ * bits, so the byte should still be erased (0xFF).
+ * @return Returns 0 on a write error.
+ */
+uint8_t config_program_pattern_byte(uint8_t offset, uint8_t byte);
+
+/*!
+ * @brief Null-terminated name of a profile, at most CONFIG_PROFILE_NAME_LEN
+ * characters long. Can be written to.
+ */
+char* config_profile_name(uint8_t idx);
+
 #endif	/* CONFIG_H */
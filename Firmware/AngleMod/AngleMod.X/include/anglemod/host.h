@@ -0,0 +1,70 @@
+/*!
+ * @file host.h
+ * @author TheComet
+ * @brief Helpers for compiling the firmware sources into host-side tools.
+ */
+
+#ifndef HOST_H
+#define	HOST_H
+
+/*
+ * Host tools that run several firmware instances in parallel (e.g. the
+ * parameter sweep) define HOST_THREAD_LOCAL so every thread gets its own copy
+ * of the state marked with HOST_LOCAL. On the PIC this expands to nothing.
+ */
+#if defined(HOST_THREAD_LOCAL)
+#   define HOST_LOCAL thread_local
+#else
+#   define HOST_LOCAL
+#endif
+
+/*
+ * XC8 packs bitfields into bytes and never pads, GCC aligns a bitfield of
+ * type unsigned to 4 bytes. Structures laid out byte by byte in NVM are
+ * marked HOST_PACKED so host builds see the same layout as the PIC.
+ */
+#if defined(__XC8)
+#   define HOST_PACKED
+#else
+#   define HOST_PACKED __attribute__((packed))
+#endif
+
+/*
+ * Variadic arguments are promoted to int. XC8 is happy to read them back as
+ * uint8_t, which makes for smaller code, but on the host that's undefined and
+ * GCC makes the program abort when it's reached.
+ */
+#if defined(__XC8)
+#   define va_arg_u8(ap) va_arg(ap, uint8_t)
+#else
+#   define va_arg_u8(ap) ((uint8_t)va_arg(ap, int))
+#endif
+
+/*
+ * Unit tests count calls into the functions on the hot paths, so the cost
+ * budgets in main.c notice when a path starts doing more work. Elsewhere
+ * HOST_COUNT_CALL() expands to nothing.
+ */
+#if defined(GTEST_TESTING)
+#   define HOST_CALL_LIST \
+        X(calib_unapply) \
+        X(dac_buf_transfer) \
+        X(dac_override) \
+        X(dac_override_clamp) \
+        X(joy_push_state) \
+        X(seq_find) \
+        X(uart_printf) \
+        X(uart_putc)
+struct host_calls
+{
+#define X(fn) unsigned fn;
+    HOST_CALL_LIST
+#undef X
+};
+extern struct host_calls host_calls;
+#   define HOST_COUNT_CALL(fn) host_calls.fn++
+#else
+#   define HOST_COUNT_CALL(fn)
+#endif
+
+#endif	/* HOST_H */
@@ -6,6 +6,7 @@
 #ifndef JOY_H
 #define	JOY_H
 
+#include "anglemod/adc.h"
 #include <stdint.h>
 
 /* Needs to be in this order, see joy.c:41 */
@@ -29,11 +30,16 @@ enum joy_state
     JOY_STATE_COUNT
 };
 
+/*!
+ * Resets the queue of states back to neutral.
+ */
+void joy_init(void);
+
 /*!
  * Converts the joystick angle into a joystick state and pushes it into the
  * queue of states, if it is different from the last.
  */
-void joy_push_state(const uint8_t xy[2]);
+void joy_push_state(const adc_t xy[2]);
 
 const enum joy_state* joy_state_history(void);
 
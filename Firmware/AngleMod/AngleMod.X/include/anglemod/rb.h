@@ -15,12 +15,30 @@
  * full when rb->write is one slot behind rb->read. This is necessary because
  * otherwise there would be no way to tell the difference between an empty and
  * a full ring buffer.
+ *
+ * peek_contiguous() and reserve_contiguous() return the readable or writable
+ * span up to the end of the buffer in place. Once done with it, the consumer
+ * calls commit_take() and the producer commit_put() with the number of
+ * elements used. The other end only sees them after the commit.
  */
 #ifndef RB_H
 #define	RB_H
 
 #include <string.h>
 
+/*
+ * On the PIC, volatile indices are enough: S is a single byte and the ISR
+ * can't be interrupted by the main loop. Host builds that run the ISRs on
+ * another thread define RB_ATOMIC to get the same layout with std::atomic
+ * indices, which gives the ordering the hardware provides for free.
+ */
+#if defined(RB_ATOMIC)
+#   include <atomic>
+#   define RB_INDEX(S) std::atomic<S>
+#else
+#   define RB_INDEX(S) volatile S
+#endif
+
 #define RB_DECLARE_API(name, T, S)                                            \
     void rb_##name##_init(void);                                              \
     S rb_##name##_put_single(const T* data);                                  \
@@ -28,13 +46,17 @@
     S rb_##name##_put(const T* data, S len);                                  \
     S rb_##name##_take(T* data, S maxlen);                                    \
     S rb_##name##_take_single(T* data);                                       \
-    S rb_##name##_count(void);
+    S rb_##name##_count(void);                                                \
+    S rb_##name##_peek_contiguous(const T** data);                            \
+    void rb_##name##_commit_take(S count);                                    \
+    S rb_##name##_reserve_contiguous(T** data);                               \
+    void rb_##name##_commit_put(S count);
 
 #define RB_DEFINE_API(name, T, N, S)                                          \
     static struct                                                             \
     {                                                                         \
-        volatile S read;                                                      \
-        volatile S write;                                                     \
+        RB_INDEX(S) read;                                                     \
+        RB_INDEX(S) write;                                                    \
         T buffer[N];                                                          \
     } rb_##name;                                                              \
                                                                               \
@@ -64,14 +86,27 @@
     }                                                                         \
                                                                               \
     /* -------------------------------------------------------------------- */\
-    static S rb_##name##_put_contiguous(const T* data, S len)                 \
+    S rb_##name##_reserve_contiguous(T** data)                                \
     {                                                                         \
         S count;                                                              \
         RB_SPACE_TO_END(count, &rb_##name, N, S);                             \
+        *data = rb_##name.buffer + rb_##name.write;                           \
+        return count;                                                         \
+    }                                                                         \
+    void rb_##name##_commit_put(S count)                                      \
+    {                                                                         \
+        rb_##name.write = (S)(rb_##name.write + count) & ((N)-1u);            \
+    }                                                                         \
+                                                                              \
+    /* -------------------------------------------------------------------- */\
+    static S rb_##name##_put_contiguous(const T* data, S len)                 \
+    {                                                                         \
+        T* dst;                                                               \
+        S count = rb_##name##_reserve_contiguous(&dst);                       \
         if (count > len)                                                      \
             count = len;                                                      \
-        memcpy(rb_##name.buffer + rb_##name.write, data, count * sizeof(T));  \
-        rb_##name.write = (S)(rb_##name.write + count) & ((N)-1u);            \
+        memcpy(dst, data, count * sizeof(T));                                 \
+        rb_##name##_commit_put(count);                                        \
         return count;                                                         \
     }                                                                         \
     S rb_##name##_put(const T* data, S len)                                   \
@@ -84,14 +119,27 @@
     }                                                                         \
                                                                               \
     /* -------------------------------------------------------------------- */\
-    static S rb_##name##_take_contiguous(T* data, S maxlen)                   \
+    S rb_##name##_peek_contiguous(const T** data)                             \
     {                                                                         \
         S count;                                                              \
         RB_COUNT_TO_END(count, &rb_##name, N, S);                             \
+        *data = rb_##name.buffer + rb_##name.read;                            \
+        return count;                                                         \
+    }                                                                         \
+    void rb_##name##_commit_take(S count)                                     \
+    {                                                                         \
+        rb_##name.read = (S)(rb_##name.read + count) & ((N)-1u);              \
+    }                                                                         \
+                                                                              \
+    /* -------------------------------------------------------------------- */\
+    static S rb_##name##_take_contiguous(T* data, S maxlen)                   \
+    {                                                                         \
+        const T* src;                                                         \
+        S count = rb_##name##_peek_contiguous(&src);                          \
         if (count > maxlen)                                                   \
             count = maxlen;                                                   \
-        memcpy(data, rb_##name.buffer + rb_##name.read, count * sizeof(T));   \
-        rb_##name.read = (S)(rb_##name.read + count) & ((N)-1u);              \
+        memcpy(data, src, count * sizeof(T));                                 \
+        rb_##name##_commit_take(count);                                       \
         return count;                                                         \
     }                                                                         \
     S rb_##name##_take(T* data, S maxlen)                                     \
@@ -7,16 +7,19 @@
 #define	CMD_SEQ_H
 
 #include "anglemod/cli.h"
+#include "anglemod/joy.h"
+#include "anglemod/uart.h"
 
 #if defined (CLI_USE_UNICODE)
-#   define ARROW_W  "\xE2\x86\x90"
-#   define ARROW_N  "\xE2\x86\x91"
-#   define ARROW_E  "\xE2\x86\x92"
-#   define ARROW_S  "\xE2\x86\x93"
-#   define ARROW_NW "\xE2\x86\x96"
-#   define ARROW_NE "\xE2\x86\x97"
-#   define ARROW_SE "\xE2\x86\x98"
-#   define ARROW_SW "\xE2\x86\x99"
+    /* Single byte tokens, expanded by uart_printf() */
+#   define ARROW_W  UART_TOK_STR(UART_TOK_ARROW_W_HEX)
+#   define ARROW_N  UART_TOK_STR(UART_TOK_ARROW_N_HEX)
+#   define ARROW_E  UART_TOK_STR(UART_TOK_ARROW_E_HEX)
+#   define ARROW_S  UART_TOK_STR(UART_TOK_ARROW_S_HEX)
+#   define ARROW_NW UART_TOK_STR(UART_TOK_ARROW_NW_HEX)
+#   define ARROW_NE UART_TOK_STR(UART_TOK_ARROW_NE_HEX)
+#   define ARROW_SE UART_TOK_STR(UART_TOK_ARROW_SE_HEX)
+#   define ARROW_SW UART_TOK_STR(UART_TOK_ARROW_SW_HEX)
 #else
 #   define ARROW_W  " W"
 #   define ARROW_N  " N"
@@ -68,12 +71,72 @@ enum seq
     SEQ_NONE = 255,
 };
 
+/*
+ * User patterns replace the built-in sequences with patterns of any length,
+ * with wildcards. provision compiles them into a DFA on the host and writes
+ * it to the pattern area in flash (see config.h), laid out as:
+ *
+ *   0     SEQ_DFA_MAGIC
+ *   1     Number of states, 1 to SEQ_DFA_MAX_STATES
+ *   2     CRC-8 over the states, see bin_crc8()
+ *   3...  SEQ_DFA_ROW bytes per state: The next state for each joy_state as
+ *         nibbles, low nibble first, then the sequences that match in this
+ *         state as a mask laid out like config.enable.bytes[0..2]
+ *
+ * State 0 is the one after the NEUTRAL joy_init() starts in. Every state
+ * change costs one flash read, no matter how many patterns there are. If the
+ * area doesn't hold a valid table, the built-in sequences are used.
+ *
+ * Tables are uploaded with the magic erased and only get it from
+ * seq_commit(), so a partly written table never goes live, even if its CRC
+ * happens to match.
+ */
+#define SEQ_DFA_MAGIC      0xD5
+#define SEQ_DFA_HEADER     3
+#define SEQ_DFA_ROW        8
+#define SEQ_DFA_MAX_STATES 15
+
+/*!
+ * Uses the table in the pattern area from now on if it is valid. Call
+ * joy_init() afterwards so matching starts over.
+ */
+void seq_init(void);
+
+/*!
+ * Makes a table that was uploaded with its magic left erased the one in use,
+ * by programming the magic, then calls seq_init(). Does nothing to an
+ * incomplete table. Call joy_init() afterwards.
+ * @return Returns 0 on a write error.
+ */
+uint8_t seq_commit(void);
+
+/*!
+ * Number of states of the table in use, 0 if the built-in sequences are used.
+ */
+uint8_t seq_dfa_states(void);
+
+/*!
+ * Returns to the first state of the table. Called by joy_init().
+ */
+void seq_reset(void);
+
+/*!
+ * Advances the table by one state change. Called by joy_push_state().
+ */
+void seq_push_state(enum joy_state state);
+
 /*!
  * Analyzes the queue of joystick states to find a valid command sequence. If
- * no valid command sequence was found, this will return SEQ_NONE.
+ * no valid command sequence was found, this will return SEQ_NONE. With user
+ * patterns, the state of the table is used instead of the queue.
  */
-enum joy_state;
 enum seq seq_find(const enum joy_state* state_history);
 
+/*!
+ * Returns state idx (0 is the oldest) of the built-in sequence seq.
+ * JOY_NEUTRAL matches any state.
+ */
+enum joy_state seq_state(enum seq seq, uint8_t idx);
+
 
 #endif	/* CMD_SEQ_H */
@@ -11,15 +11,15 @@
 #include <stdint.h>
 
 #define TX_BUF_SIZE 64u
-#define RX_BUF_SIZE 8u
+#define RX_BUF_SIZE 16u
 #define TX_RWTYPE uint8_t
 #define RX_RWTYPE uint8_t
 
 /* 
- * When simulating, the write "thread" isn't actually a thread,
- * so we have to make sure the buffer is large enough to contain
- * the largest possible message, or otherwise the program
- * deadlocks
+ * When simulating, the write "thread" isn't actually a thread, so we have to
+ * make sure the buffer is large enough to contain the largest possible
+ * message, or otherwise the program deadlocks. Unit tests use the real size,
+ * see uart_putc()
  */
 #if defined(CLI_SIM)
 #   undef TX_BUF_SIZE
@@ -29,11 +29,112 @@
 #   define TX_RWTYPE uint16_t
 #endif
 
+/*
+ * Control bytes that never appear in CLI output as-is. uart_printf() expands
+ * them into ANSI escape sequences and UTF-8 characters when sending, so each
+ * string literal stores a single byte instead of the whole sequence.
+ * 0x08-0x0D and 0x1B are left alone. The tokens are written as two hex
+ * digits, UART_TOK() makes the byte out of them and UART_TOK_STR() a string
+ * literal to put into format strings.
+ */
+#define UART_TOK(hex)           UART_TOK_(hex)
+#define UART_TOK_(hex)          0x##hex
+#define UART_TOK_STR(hex)       UART_TOK_STR_(hex)
+#define UART_TOK_STR_(hex)      UART_TOK_STR__(\x##hex)
+#define UART_TOK_STR__(esc)     #esc
+
+#define UART_TOK_RED_HEX        01  /* "\x1b[1;31m" */
+#define UART_TOK_GREEN_HEX      02
+#define UART_TOK_YELLOW_HEX     03
+#define UART_TOK_BLUE_HEX       04
+#define UART_TOK_MAGENTA_HEX    05
+#define UART_TOK_CYAN_HEX       06
+#define UART_TOK_WHITE_HEX      07  /* "\x1b[1;37m" */
+#define UART_TOK_RESET_HEX      0E  /* "\x1b[0m" */
+#define UART_TOK_CLEAR_EOL_HEX  0F  /* "\x1b[K" */
+#define UART_TOK_CURSOR_UP_HEX  10  /* "\x1b[A" */
+#define UART_TOK_ARROW_W_HEX    11  /* Unicode arrows */
+#define UART_TOK_ARROW_N_HEX    12
+#define UART_TOK_ARROW_E_HEX    13
+#define UART_TOK_ARROW_S_HEX    14
+#define UART_TOK_ARROW_NW_HEX   15
+#define UART_TOK_ARROW_NE_HEX   16
+#define UART_TOK_ARROW_SE_HEX   17
+#define UART_TOK_ARROW_SW_HEX   18
+#define UART_TOK_DEGREES_HEX    19  /* Unicode degree sign */
+
+#define UART_TOK_COLOR      UART_TOK(UART_TOK_RED_HEX)  /* Red to white */
+#define UART_TOK_RESET      UART_TOK(UART_TOK_RESET_HEX)
+#define UART_TOK_CLEAR_EOL  UART_TOK(UART_TOK_CLEAR_EOL_HEX)
+#define UART_TOK_CURSOR_UP  UART_TOK(UART_TOK_CURSOR_UP_HEX)
+#define UART_TOK_ARROW      UART_TOK(UART_TOK_ARROW_W_HEX)  /* W N E S NW NE SE SW */
+#define UART_TOK_DEGREES    UART_TOK(UART_TOK_DEGREES_HEX)
+
+/*
+ * With flow control enabled, XOFF is sent once the RX buffer holds
+ * UART_RX_XOFF_LEVEL bytes, which leaves room for the bytes the host sends
+ * before it reacts. XON is sent once it has drained to UART_RX_XON_LEVEL.
+ * They are the same bytes as UART_TOK_ARROW_W and UART_TOK_ARROW_E, which is
+ * fine because tokens are expanded before they reach the wire.
+ */
+#define UART_XON            0x11
+#define UART_XOFF           0x13
+#define UART_RX_XOFF_LEVEL  (RX_BUF_SIZE / 2u)
+#define UART_RX_XON_LEVEL   2u
+
 void uart_init(void);
 
 void uart_putc(char c);
+
+/*!
+ * @brief Returns 1 while the receiver is idle, the RX buffer is empty, and
+ * uart_getc() last returned a byte more than a byte time ago. A byte that
+ * follows another one right away has started by then.
+ */
+uint8_t uart_quiet(void);
+
+/*!
+ * @brief Returns 1 once everything queued was sent, the last byte has left
+ * the shift register, and the line is quiet.
+ */
+uint8_t uart_idle(void);
+
+/*!
+ * @brief In plain mode, uart_printf() drops the color and cursor tokens and
+ * sends arrows and degrees as ASCII. uart_putc() is never affected.
+ */
+void uart_set_plain(uint8_t enable);
+
+/*!
+ * @brief Understands %s, %c, %% and %u for uint8_t. %U takes a uint16_t, which
+ * is rarely needed and kept apart because it's slower.
+ */
 void uart_printf(const char* fmt, ...);
 
+/*!
+ * @brief Takes the next received byte. Use this instead of
+ * rb_rx_take_single() so XON gets sent when the buffer drains.
+ */
+uint8_t uart_getc(char* c);
+
+void uart_set_flow_control(uint8_t enable);
+uint8_t uart_flow_control(void);
+
+/*!
+ * @brief Binary frames aren't escaped, so no XON/XOFF may be sent while one
+ * goes out. Suspending sends XON if the host was stopped. Resuming takes
+ * effect once everything queued has been sent.
+ */
+void uart_suspend_flow_control(uint8_t suspend);
+
+/*!
+ * @brief Bytes lost because the RX buffer was full, and hardware overruns
+ * since the last reset. Both saturate at 255.
+ */
+uint8_t uart_rx_dropped(void);
+uint8_t uart_rx_overruns(void);
+void uart_rx_stats_reset(void);
+
 void uart_tx_isr(void);
 void uart_rx_isr(void);
 
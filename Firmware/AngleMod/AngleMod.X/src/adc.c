@@ -1,8 +1,12 @@
 #include "anglemod/adc.h"
 #include "anglemod/log.h"
+#include "anglemod/calib.h"
+#include "anglemod/boot.h"
+#include "anglemod/clk.h"
 #include <xc.h>
 
-static uint8_t adc_xy[2];
+static adc_t adc_xy[2];
+static adc_t adc_raw_xy[2];
 static volatile uint8_t has_new_data = 0;
 static uint8_t log_counter = 0;
 
@@ -14,22 +18,39 @@ void adc_init(void)
     T0CON1 = 0x95;  /* LFINTOSC as clock source (31 kHz), ASYNC=1 (Timer can
                      * only continue to count during sleep in asynchronous mode),
                      * CKPS=5 (prescale with 1:32) */
+#if defined(ADC_10BIT)
+    ADCON1 = 0xF0;  /* FM=1 (right-justified), CS=111 (ADCRC clock source),
+                     * PREF=00 (VREF is connected to VDD) */
+#else
     ADCON1 = 0x70;  /* FM=0 (left-justified), CS=111 (ADCRC clock source),
                      * PREF=00 (VREF is connected to VDD) */
-    ADACT = 0x02;   /* Use TMR0_overflow as conversion trigger */
+#endif
     ADCON0 = 0x35;  /* CHS=001101 (RB5), ON=1 */
     
     adc_set_slow_sampling_mode();
     
     PIE1bits.ADIE = 1;   /* Enable ADC interrupt */
     T0CON0bits.EN = 1;   /* Start timer */
+
+    /* Convert the first pair right away instead of waiting up to 5 ms for
+     * TMR0. The ADC has to be on and have acquired RB5 before GO is set, and
+     * the ISR runs once interrupts are enabled */
+    __delay_us(ADC_TACQ_US);
+    ADCON0 = 0x37;  /* CHS=001101 (RB5), GO=1, ON=1 */
 }
 
 /* -------------------------------------------------------------------------- */
-void adc_set_fast_sampling_mode(void)
+void adc_set_high_rate_mode(void)
 {
-    /* Roughly 500 Hz */
-    TMR0H = 1;
+    /* 
+     * TMR0 on the LFINTOSC can't go much faster than 500 Hz. TMR2 runs from
+     * HFINTOSC (32 MHz) with a 1:128 prescaler -> 250 kHz, and a period of 50
+     * counts -> 5 kHz. TMR0 keeps running but no longer triggers anything.
+     */
+    T2CLKCON = 0x03;  /* CS=0011 (HFINTOSC) */
+    T2PR = 49;
+    T2CON = 0xF0;     /* ON=1, CKPS=111 (1:128), OUTPS=0000 (1:1) */
+    ADACT = 0x04;     /* Use TMR2 postscaled output as conversion trigger */
 }
 
 /* -------------------------------------------------------------------------- */
@@ -37,8 +58,11 @@ void adc_set_slow_sampling_mode(void)
 {
     /* 200 Hz should be fast enough to detect joystick command inputs
      * LFOSC frequency is 31 kHz, prescaler is 32:
-     *   31 kHz / 32 / 5 = ~200 Hz */
+     *   31 kHz / 32 / 5 = ~200 Hz
+     * Each trigger converts both X and Y */
     TMR0H = 5;
+    ADACT = 0x02;   /* Use TMR0_overflow as conversion trigger */
+    T2CON = 0x00;   /* Stop TMR2 */
 }
 
 /* -------------------------------------------------------------------------- */
@@ -58,31 +82,140 @@ uint8_t adc_has_new_data_get_and_clear(void)
 }
 
 /* -------------------------------------------------------------------------- */
-const uint8_t* adc_joy_xy(void)
+const adc_t* adc_joy_xy(void)
 {
     return adc_xy;
 }
 
+/* -------------------------------------------------------------------------- */
+const adc_t* adc_joy_raw_xy(void)
+{
+    return adc_raw_xy;
+}
+
 /* -------------------------------------------------------------------------- */
 void adc_isr(void)
 {
+#if defined(ADC_10BIT)
+    adc_t raw = (adc_t)(ADRESH << 8) | ADRESL;
+#else
+    adc_t raw = ADRESH;
+#endif
+
     PIR1bits.ADIF = 0;
     
     /* 
-     * Toggle between measuring the JOYX and JOYY signals, and set the global
-     * "has new data" flag whenever we finish measuring both so the results can
-     * be picked up in the main thread
+     * Each trigger converts JOYX, then the Y conversion is started from here
+     * immediately instead of waiting for the next trigger, so both samples
+     * are only one acquisition and conversion time apart. The global "has new
+     * data" flag is set whenever we finish measuring both so the results can
+     * be picked up in the main thread. The hardware clears GO when a
+     * conversion completes
      */
     
     if (ADCON0 == 0x35)
     {
-        adc_xy[0] = ADRESH;
+        adc_raw_xy[0] = raw;
+        adc_xy[0] = calib_apply(0, raw);
         ADCON0 = 0x39;  /* CHS=001110 (RB6), ON=1 */
+        clk_delay_us(ADC_TACQ_US);
+        ADCON0 = 0x3B;  /* GO=1 */
     }
     else
     {
-        adc_xy[1] = ADRESH;
+        adc_raw_xy[1] = raw;
+        adc_xy[1] = calib_apply(1, raw);
         ADCON0 = 0x35;  /* CHS=001101 (RB5), ON=1 */
         has_new_data = 1;
+        boot_mark(BOOT_SAMPLE);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <sim.h>
+
+using namespace testing;
+
+TEST(adc, isr_reads_both_channels)
+{
+    calib_build_lut();  /* No calibration, values pass through */
+    ADCON0 = 0x35;
+
+#if defined(ADC_10BIT)
+    ADRESH = 0x03; ADRESL = 0xFE;
+    adc_isr();
+    EXPECT_THAT(ADCON0, Eq(0x3B));
+    ADCON0 &= ~0x02;  /* Conversion done */
+    ADRESH = 0x01; ADRESL = 0x23;
+    adc_isr();
+    EXPECT_THAT(adc_joy_raw_xy()[0], Eq(0x3FE));
+    EXPECT_THAT(adc_joy_raw_xy()[1], Eq(0x123));
+    EXPECT_THAT(adc_joy_xy()[0], Eq(0x3FE));
+    EXPECT_THAT(adc_joy_xy()[1], Eq(0x123));
+#else
+    ADRESH = 0xFE;
+    adc_isr();
+    EXPECT_THAT(ADCON0, Eq(0x3B));
+    ADCON0 &= ~0x02;  /* Conversion done */
+    ADRESH = 0x12;
+    adc_isr();
+    EXPECT_THAT(adc_joy_raw_xy()[0], Eq(0xFE));
+    EXPECT_THAT(adc_joy_raw_xy()[1], Eq(0x12));
+    EXPECT_THAT(adc_joy_xy()[0], Eq(0xFE));
+    EXPECT_THAT(adc_joy_xy()[1], Eq(0x12));
+#endif
+    EXPECT_THAT(ADCON0, Eq(0x35));
+    EXPECT_THAT(adc_has_new_data_get_and_clear(), Eq(1));
+}
+
+TEST(adc, y_is_acquired_before_converting)
+{
+    ADCON0 = 0x35;
+    sim_trace_start();
+    adc_isr();
+    sim_trace_stop();
+
+    size_t count;
+    const struct sim_event* e = sim_trace_events(&count);
+    std::vector<struct sim_event> writes;
+    for (size_t i = 0; i != count; ++i)
+        if (e[i].reg == SFR_ADCON0)
+            writes.push_back(e[i]);
+
+    ASSERT_THAT(writes.size(), Eq(2u));
+    EXPECT_THAT(writes[0].value, Eq(0x39));  /* RB6 selected, not converting */
+    EXPECT_THAT(writes[1].value, Eq(0x3B));
+    EXPECT_THAT(writes[1].time - writes[0].time, Ge(ADC_TACQ_US * 1000u));
+}
+
+TEST(adc, acquisition_takes_as_long_in_every_mode)
+{
+    for (uint8_t busy : {0, CLK_OVERRIDE})
+    {
+        clk_set_busy(busy);
+        ADCON0 = 0x35;
+        sim_trace_start();
+        adc_isr();
+        sim_trace_stop();
+
+        size_t count;
+        const struct sim_event* e = sim_trace_events(&count);
+        std::vector<uint64_t> times;
+        for (size_t i = 0; i != count; ++i)
+            if (e[i].reg == SFR_ADCON0)
+                times.push_back(e[i].time);
+
+        ASSERT_THAT(times.size(), Eq(2u));
+        EXPECT_THAT(times[1] - times[0], AllOf(Ge(ADC_TACQ_US * 1000u), Le((ADC_TACQ_US + 2) * 1000u)))
+            << "mode " << (int)clk_active_mode();
     }
+    clk_set_busy(0);
 }
+
+#endif
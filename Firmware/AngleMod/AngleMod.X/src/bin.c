@@ -0,0 +1,413 @@
+#include "anglemod/bin.h"
+#include "anglemod/config.h"
+#include "anglemod/calib.h"
+#include "anglemod/joy.h"
+#include "anglemod/seq.h"
+#include "anglemod/uart.h"
+#include <xc.h>
+#include <string.h>
+
+/* Request header: op, offset, len */
+static uint8_t header[3];
+static uint8_t data[BIN_MAX_LEN];
+static uint16_t received = 0;
+static uint8_t crc = 0;
+static uint16_t byte_time;  /* TMR1 when the last byte arrived */
+
+/* -------------------------------------------------------------------------- */
+uint8_t bin_crc8(uint8_t crc, uint8_t byte)
+{
+    uint8_t i;
+    crc ^= byte;
+    for (i = 0; i != 8; ++i)
+        crc = (uint8_t)(crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+    return crc;
+}
+
+/* -------------------------------------------------------------------------- */
+static void send(uint8_t byte)
+{
+    crc = bin_crc8(crc, byte);
+    uart_putc((char)byte);
+}
+static void respond(uint8_t status, const uint8_t* payload, uint8_t len)
+{
+    uart_putc(BIN_STX);
+    crc = 0;
+    send(status);
+    send(len);
+    while (len--)
+        send(*payload++);
+    uart_putc((char)crc);
+}
+
+/* -------------------------------------------------------------------------- */
+static void execute_pattern(uint8_t op, uint8_t offset, uint8_t len)
+{
+    uint8_t i, written;
+
+    if ((uint16_t)(offset + len) > CONFIG_PATTERN_AREA_SIZE ||
+        (op == BIN_OP_PATTERN_WRITE && (offset & (BIN_MAX_LEN - 1))))
+    {
+        respond(BIN_OUT_OF_RANGE, data, 0);
+        return;
+    }
+
+    if (op == BIN_OP_PATTERN_READ)
+    {
+        for (i = 0; i != len; ++i)
+            data[i] = config_read_pattern_area(offset + i);
+        respond(BIN_OK, data, len);
+        return;
+    }
+
+    if (op == BIN_OP_PATTERN_COMMIT)
+    {
+        written = seq_commit();
+        data[0] = seq_dfa_states();
+    }
+    else
+    {
+        /* Only a table that isn't in use can be changed, and writing the
+         * first part stops it. The magic comes with PATTERN_COMMIT */
+        if (offset && config_read_pattern_area(0) != 0xFF)
+        {
+            respond(BIN_OUT_OF_RANGE, data, 0);
+            return;
+        }
+        if (offset)
+            written = config_write_pattern_area(offset, data, len);
+        else
+        {
+            /* Erases the row, but skips the magic so it stays erased */
+            written = config_write_pattern_area(0, data, 0);
+            if (len > 1)
+                written &= config_write_pattern_area(1, data + 1, len - 1);
+            seq_init();
+        }
+    }
+
+    joy_init();
+    if (!written)
+    {
+        respond(BIN_SAVE_ERROR + CONFIG_SAVE_WRITE_ERROR, data, 0);
+        return;
+    }
+
+    respond(BIN_OK, data, op == BIN_OP_PATTERN_COMMIT);
+}
+
+/* -------------------------------------------------------------------------- */
+static void execute(void)
+{
+    uint8_t op = header[0] & 0x0F;
+    uint8_t profile = header[0] >> 4;
+    uint8_t offset = header[1];
+    uint8_t len = header[2];
+    uint8_t* image;
+
+    switch (op)
+    {
+    case BIN_OP_INFO:
+        data[0] = sizeof(struct config);
+        data[1] = CONFIG_PROFILE_COUNT;
+        data[2] = BIN_MAX_LEN;
+        data[3] = config_active_profile();
+        respond(BIN_OK, data, 4);
+        return;
+
+    case BIN_OP_SAVE: {
+        enum config_save_result result = config_save_to_nvm();
+        respond(result == CONFIG_SAVE_OK ? (uint8_t)BIN_OK : (uint8_t)(BIN_SAVE_ERROR + result), data, 0);
+        return;
+    }
+
+    case BIN_OP_PATTERN_READ:
+    case BIN_OP_PATTERN_WRITE:
+    case BIN_OP_PATTERN_COMMIT:
+        execute_pattern(op, offset, len);
+        return;
+
+    case BIN_OP_READ:
+    case BIN_OP_WRITE:
+        break;
+
+    default:
+        respond(BIN_BAD_OP, data, 0);
+        return;
+    }
+
+    if (profile >= CONFIG_PROFILE_COUNT || (uint16_t)(offset + len) > sizeof(struct config))
+    {
+        respond(BIN_OUT_OF_RANGE, data, 0);
+        return;
+    }
+
+    image = (uint8_t*)config_get_profile(profile);
+    if (op == BIN_OP_READ)
+        respond(BIN_OK, image + offset, len);
+    else
+    {
+        memcpy(image + offset, data, len);
+        if (profile == config_active_profile())
+            calib_build_lut();
+        respond(BIN_OK, data, 0);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+void bin_start(void)
+{
+    received = 0;
+    byte_time = TMR1;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t bin_timed_out(void)
+{
+    return (uint16_t)(TMR1 - byte_time) >= BIN_TIMEOUT_US;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t bin_putc(char c)
+{
+    uint8_t b = (uint8_t)c;
+    uint8_t op, data_len;
+
+    byte_time = TMR1;
+    if (received == 0)
+        crc = 0;
+
+    /* Header */
+    if (received < 3)
+    {
+        header[received++] = b;
+        crc = bin_crc8(crc, b);
+        return 0;
+    }
+
+    /* Payload, only write requests have one. Oversized payloads are consumed
+     * so they don't end up in the CLI, but not stored */
+    op = header[0] & 0x0F;
+    data_len = op == BIN_OP_WRITE || op == BIN_OP_PATTERN_WRITE ? header[2] : 0;
+    if (received - 3 < data_len)
+    {
+        if (received - 3 < BIN_MAX_LEN)
+            data[received - 3] = b;
+        received++;
+        crc = bin_crc8(crc, b);
+        return 0;
+    }
+
+    /* CRC */
+    received = 0;
+    if (b != crc)
+        respond(BIN_BAD_CRC, data, 0);
+    else if (header[2] > BIN_MAX_LEN)
+        respond(BIN_OUT_OF_RANGE, data, 0);
+    else
+        execute();
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <nvm.h>
+#include <terminal.h>
+#include <cstddef>
+
+using namespace testing;
+
+class bin_protocol : public Test
+{
+public:
+    void SetUp() override
+    {
+        config_set_defaults();
+        sent();
+    }
+
+    void TearDown() override
+    {
+        config_set_defaults();
+    }
+
+    std::vector<uint8_t> sent()
+    {
+        while (PIE1bits.TX1IE)  /* Like drain_tx() in main.c */
+            uart_tx_isr();
+        std::string s = term.take();
+        return std::vector<uint8_t>(s.begin(), s.end());
+    }
+
+    /* Sends a request without the STX, returns the response without STX and CRC */
+    std::vector<uint8_t> request(std::vector<uint8_t> req)
+    {
+        uint8_t c = 0, done = 0;
+        for (uint8_t b : req)
+            c = bin_crc8(c, b);
+        req.push_back(c);
+        for (uint8_t b : req)
+            done = bin_putc((char)b);
+        EXPECT_TRUE(done);
+
+        std::vector<uint8_t> resp = sent();
+        EXPECT_THAT(resp.size(), Ge(4u));
+        EXPECT_THAT(resp[0], Eq(BIN_STX));
+        c = 0;
+        for (size_t i = 1; i + 1 < resp.size(); ++i)
+            c = bin_crc8(c, resp[i]);
+        EXPECT_THAT(resp.back(), Eq(c));
+        return std::vector<uint8_t>(resp.begin() + 1, resp.end() - 1);
+    }
+
+    terminal term;
+};
+
+TEST_F(bin_protocol, crc8_check_value)
+{
+    uint8_t c = 0;
+    for (const char* s = "123456789"; *s; ++s)
+        c = bin_crc8(c, (uint8_t)*s);
+    EXPECT_THAT(c, Eq(0xF4));
+}
+
+TEST_F(bin_protocol, info)
+{
+    EXPECT_THAT(request({BIN_OP_INFO, 0, 0}), ElementsAre(
+        BIN_OK, 4, sizeof(struct config), CONFIG_PROFILE_COUNT, BIN_MAX_LEN, 0));
+}
+
+TEST_F(bin_protocol, write_then_read_back)
+{
+    const uint8_t offset = offsetof(struct config, angles);
+    EXPECT_THAT(request({BIN_OP_WRITE | 0x10, offset, 3, 11, 22, 33}), ElementsAre(BIN_OK, 0));
+    EXPECT_THAT(config_get_profile(1)->angles[0].xy[0], Eq(11));
+    EXPECT_THAT(config_get_profile(1)->angles[1].xy[0], Eq(33));
+    EXPECT_THAT(config_get()->angles[0].xy[0], Ne(11));
+    EXPECT_THAT(request({BIN_OP_READ | 0x10, offset, 3}), ElementsAre(BIN_OK, 3, 11, 22, 33));
+}
+
+TEST_F(bin_protocol, bad_crc_writes_nothing)
+{
+    const uint8_t req[] = {BIN_OP_WRITE, offsetof(struct config, angles), 1, 99, 0x00};
+    uint8_t before = config_get()->angles[0].xy[0];
+    for (uint8_t b : req)
+        bin_putc((char)b);
+    std::vector<uint8_t> resp = sent();
+    ASSERT_THAT(resp.size(), Eq(4u));
+    EXPECT_THAT(resp[1], Eq(BIN_BAD_CRC));
+    EXPECT_THAT(config_get()->angles[0].xy[0], Eq(before));
+}
+
+TEST_F(bin_protocol, rejects_out_of_range)
+{
+    EXPECT_THAT(request({BIN_OP_READ, sizeof(struct config) - 2, 3}), ElementsAre(BIN_OUT_OF_RANGE, 0));
+    EXPECT_THAT(request({BIN_OP_READ | (CONFIG_PROFILE_COUNT << 4), 0, 1}), ElementsAre(BIN_OUT_OF_RANGE, 0));
+    EXPECT_THAT(request({0x0F, 0, 0}), ElementsAre(BIN_BAD_OP, 0));
+}
+
+TEST_F(bin_protocol, oversized_writes_are_consumed)
+{
+    std::vector<uint8_t> req = {BIN_OP_WRITE, 0, 200};
+    req.resize(3 + 200, 0x55);
+    EXPECT_THAT(request(req), ElementsAre(BIN_OUT_OF_RANGE, 0));
+}
+
+class bin_pattern : public bin_protocol
+{
+public:
+    void SetUp() override
+    {
+        bin_protocol::SetUp();
+        INTCON = 0xC0;
+    }
+
+    void TearDown() override
+    {
+        flash.set_word(0x1F00, NVM_ERASED);
+        seq_init();
+        bin_protocol::TearDown();
+    }
+
+    /* One state that matches CARD_N_NE whatever the input */
+    static std::vector<uint8_t> table()
+    {
+        std::vector<uint8_t> t = {SEQ_DFA_MAGIC, 1, 0, 0, 0, 0, 0, 0, 0x01, 0, 0};
+        for (size_t i = SEQ_DFA_HEADER; i != t.size(); ++i)
+            t[2] = bin_crc8(t[2], t[i]);
+        return t;
+    }
+
+    static std::vector<uint8_t> write(const std::vector<uint8_t>& t)
+    {
+        std::vector<uint8_t> req = {BIN_OP_PATTERN_WRITE, 0, (uint8_t)t.size()};
+        req.insert(req.end(), t.begin(), t.end());
+        return req;
+    }
+
+    nvm flash;
+};
+
+TEST_F(bin_pattern, write_then_read_back)
+{
+    EXPECT_THAT(request({BIN_OP_PATTERN_WRITE, 32, 3, 11, 22, 33}), ElementsAre(BIN_OK, 0));
+    EXPECT_THAT(flash.word(0x1F20), Eq(11));
+    EXPECT_THAT(flash.erases(0xF9), Eq(1u));
+    EXPECT_THAT(request({BIN_OP_PATTERN_READ, 32, 4}), ElementsAre(BIN_OK, 4, 11, 22, 33, 0xFF));
+}
+
+TEST_F(bin_pattern, rejects_unaligned_and_out_of_range)
+{
+    EXPECT_THAT(request({BIN_OP_PATTERN_WRITE, 8, 1, 0}), ElementsAre(BIN_OUT_OF_RANGE, 0));
+    EXPECT_THAT(request({BIN_OP_PATTERN_READ, CONFIG_PATTERN_AREA_SIZE - 2, 3}), ElementsAre(BIN_OUT_OF_RANGE, 0));
+    EXPECT_THAT(flash.max_erases(), Eq(0u));
+}
+
+TEST_F(bin_pattern, table_is_used_once_committed)
+{
+    config_get()->enable.bytes[0] = 0x01;
+    EXPECT_THAT(request(write(table())), ElementsAre(BIN_OK, 0));
+    EXPECT_THAT(flash.word(0x1F00), Eq(NVM_ERASED));
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+
+    EXPECT_THAT(request({BIN_OP_PATTERN_COMMIT, 0, 0}), ElementsAre(BIN_OK, 1, 1));
+    EXPECT_THAT(seq_dfa_states(), Eq(1));
+    EXPECT_THAT(seq_find(joy_state_history()), Eq(SEQ_CARD_N_NE));
+}
+
+TEST_F(bin_pattern, new_upload_stops_the_table_in_use)
+{
+    ASSERT_THAT(request(write(table())), ElementsAre(BIN_OK, 0));
+    ASSERT_THAT(request({BIN_OP_PATTERN_COMMIT, 0, 0}), ElementsAre(BIN_OK, 1, 1));
+
+    /* The first part alone is a complete table again */
+    EXPECT_THAT(request(write(table())), ElementsAre(BIN_OK, 0));
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+}
+
+TEST_F(bin_pattern, table_in_use_cant_be_changed)
+{
+    ASSERT_THAT(request(write(table())), ElementsAre(BIN_OK, 0));
+    ASSERT_THAT(request({BIN_OP_PATTERN_COMMIT, 0, 0}), ElementsAre(BIN_OK, 1, 1));
+
+    EXPECT_THAT(request({BIN_OP_PATTERN_WRITE, 16, 1, 0x00}), ElementsAre(BIN_OUT_OF_RANGE, 0));
+    EXPECT_THAT(flash.word(0x1F10), Eq(NVM_ERASED));
+    EXPECT_THAT(seq_dfa_states(), Eq(1));
+}
+
+TEST_F(bin_pattern, commit_of_an_incomplete_table_uses_the_built_in_sequences)
+{
+    std::vector<uint8_t> t = table();
+    t.back() ^= 0x01;
+    ASSERT_THAT(request(write(t)), ElementsAre(BIN_OK, 0));
+    EXPECT_THAT(request({BIN_OP_PATTERN_COMMIT, 0, 0}), ElementsAre(BIN_OK, 1, 0));
+    EXPECT_THAT(flash.word(0x1F00), Eq(NVM_ERASED));
+}
+
+#endif
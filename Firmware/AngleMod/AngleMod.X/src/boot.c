@@ -0,0 +1,3 @@
+#include "anglemod/boot.h"
+
+uint16_t _boot_times[BOOT_MARK_COUNT];
@@ -1,19 +1,30 @@
 #include "anglemod/btn.h"
+#include "anglemod/config.h"
 #include <xc.h>
 
 uint8_t _btn_state = 0xFF;
 
+/* Written by the ISR. While locked, only the main thread touches these */
+static volatile uint8_t level = BTN_BIT;
+static volatile uint8_t locked = 0;
+static volatile uint16_t edge_time;
+
+static uint8_t latency_last = 0;
+static uint8_t latency_max = 0;
+
 /* -------------------------------------------------------------------------- */
 void btn_init(void)
 {
-    /* 
-     * We don't actually do anything in the interrupt service routine. The only
-     * purpose of enabling these is so the device wakes up from sleep and then
-     * polls the state of the button
-     */
-    
+    /* TMR1 timestamps edges with 1 us resolution and wraps after 65 ms, which
+     * is longer than the largest lockout of 63 ms */
+    T1CLK = 0x01;  /* CS=0001 (Fosc/4 = 8 MHz) */
+    T1CON = 0x33;  /* CKPS=11 (1:8), RD16=1, ON=1 */
+
+    level = PORTx(BTN_PORT) & BTN_BIT;
+    locked = 0;
+
     /* Enable interrupt-on-change on BTN pin (RA4) for both rising and falling
-     * edges */
+     * edges. This also wakes the device from sleep */
     IOCxP(BTN_PORT) = BTN_BIT;
     IOCxN(BTN_PORT) = BTN_BIT;
     
@@ -21,9 +32,203 @@ void btn_init(void)
     PIE0bits.IOCIE = 1;
 }
 
+/* -------------------------------------------------------------------------- */
+void btn_poll(void)
+{
+    uint8_t new_level;
+
+    if (locked)
+    {
+        uint16_t elapsed = (uint16_t)(TMR1 - edge_time);
+        uint16_t lockout = (uint16_t)(config_get()->enable.btn_lockout * 1000u);
+        if (elapsed >= lockout)
+        {
+            /* 
+             * Sync with the pin in case the last edge happened during the
+             * lockout. The ISR would drop an edge while still locked, so
+             * interrupts are off until we unlock. An edge while sampling
+             * sets the flag, in which case we sample again. Edges after
+             * that are left to the ISR once interrupts are back on
+             */
+            INTCONbits.GIE = 0;
+            do {
+                IOCxF(BTN_PORT) &= ~BTN_BIT;
+                level = PORTx(BTN_PORT) & BTN_BIT;
+            } while (IOCxF(BTN_PORT) & BTN_BIT);
+            locked = 0;
+            INTCONbits.GIE = 1;
+        }
+    }
+
+    new_level = level;
+    if (new_level != (_btn_state & BTN_BIT) && locked)
+    {
+        uint16_t elapsed = (uint16_t)(TMR1 - edge_time);
+        latency_last = elapsed > 255 ? 255 : (uint8_t)elapsed;
+        if (latency_max < latency_last)
+            latency_max = latency_last;
+    }
+
+    _btn_state = (uint8_t)(_btn_state << 1u) | new_level;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t btn_latency_last(void)
+{
+    return latency_last;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t btn_latency_max(void)
+{
+    return latency_max;
+}
+
+/* -------------------------------------------------------------------------- */
+void btn_latency_reset(void)
+{
+    latency_last = 0;
+    latency_max = 0;
+}
+
 /* -------------------------------------------------------------------------- */
 void btn_ioc_isr(void)
 {
     /* Still need to clear the flag so we don't get stuck in an endless interrupt loop */
     IOCxF(BTN_PORT) &= ~BTN_BIT;
+
+    /* Contacts bouncing */
+    if (locked)
+        return;
+
+    /* The button was stable before this edge, so it went to the other level */
+    edge_time = TMR1;
+    level ^= BTN_BIT;
+    locked = 1;
 }
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <sim.h>
+
+using namespace testing;
+
+class btn_debounce : public Test
+{
+public:
+    void SetUp() override
+    {
+        config_get()->enable.btn_lockout = 10;
+        PORTx(BTN_PORT) = BTN_BIT;
+        INTCON = 0xC0;
+        TMR1 = 0;
+        btn_init();
+        btn_latency_reset();
+        for (int i = 0; i != 8; ++i)  /* Flush the initial 0xFF out of the history */
+            btn_poll();
+    }
+
+    void TearDown() override
+    {
+        config_set_defaults();
+    }
+
+    void edge(uint8_t pin)
+    {
+        PORTx(BTN_PORT) = pin;
+        btn_ioc_isr();
+    }
+};
+
+TEST_F(btn_debounce, first_edge_is_acted_on_immediately)
+{
+    TMR1 = 1000;
+    edge(0);
+    TMR1 = 1012;
+    btn_poll();
+    EXPECT_TRUE(btn_pressed());
+    EXPECT_THAT(btn_latency_last(), Eq(12));
+}
+
+TEST_F(btn_debounce, bounces_during_lockout_are_ignored)
+{
+    TMR1 = 1000;
+    edge(0);
+    btn_poll();
+    EXPECT_TRUE(btn_pressed());
+
+    TMR1 = 1500;
+    edge(BTN_BIT);
+    btn_poll();
+    TMR1 = 2000;
+    edge(0);
+    btn_poll();
+    EXPECT_FALSE(btn_released());
+    EXPECT_FALSE(btn_pressed());
+    EXPECT_TRUE(btn_is_active());
+}
+
+TEST_F(btn_debounce, syncs_with_pin_when_lockout_expires)
+{
+    TMR1 = 65000;
+    edge(0);
+    btn_poll();
+    TMR1 = 65200;
+    edge(BTN_BIT);  /* Released again within the lockout */
+    btn_poll();
+    EXPECT_TRUE(btn_is_active());
+
+    TMR1 = (uint16_t)(65000 + 10000);  /* Wraps */
+    btn_poll();
+    EXPECT_TRUE(btn_released());
+}
+
+/* The pin changes right after btn_poll() sampled it and raises the interrupt,
+ * which runs straight away if interrupts are on */
+class late_edge : public sim_device
+{
+public:
+    void sfr_written(enum sfr_id, uint8_t, uint8_t) override {}
+
+    void sfr_read(enum sfr_id reg) override
+    {
+        if (reg != PORTx(BTN_PORT).id() || pin < 0)
+            return;
+        PORTx(BTN_PORT).set((uint8_t)pin);
+        IOCxF(BTN_PORT).set(IOCxF(BTN_PORT).value() | BTN_BIT);
+        pin = -1;
+        if (INTCONbits.GIE)
+            btn_ioc_isr();
+    }
+
+    int pin = -1;
+};
+
+TEST_F(btn_debounce, edge_while_unlocking_is_not_lost)
+{
+    TMR1 = 1000;
+    edge(0);
+    btn_poll();
+    EXPECT_TRUE(btn_pressed());
+
+    late_edge released;
+    released.pin = BTN_BIT;
+    sim_attach(&released);
+    TMR1 = 12000;
+    btn_poll();
+    sim_detach(&released);
+    if ((IOCxF(BTN_PORT) & BTN_BIT) && INTCONbits.GIE)
+        btn_ioc_isr();  /* Pending from the late edge */
+    btn_poll();
+
+    EXPECT_THAT(released.pin, Eq(-1));
+    EXPECT_THAT(INTCONbits.GIE, Eq(1u));
+    EXPECT_FALSE(btn_is_active());
+}
+
+#endif
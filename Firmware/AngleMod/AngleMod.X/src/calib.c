@@ -0,0 +1,289 @@
+#include "anglemod/calib.h"
+#include "anglemod/config.h"
+#include "anglemod/host.h"
+
+HOST_LOCAL struct calib_map _calib_map[2];
+
+static uint8_t capturing = 0;
+
+/* -------------------------------------------------------------------------- */
+/* Fixed-point a / b, rounded up so the segments reach their ends */
+static adc_wide_t slope(adc_wide_t a, adc_t b)
+{
+    return (adc_wide_t)(((a << ADC_BITS) + b - 1) / b);
+}
+
+/* -------------------------------------------------------------------------- */
+static void build_axis(struct calib_map* m, uint8_t center, uint8_t min, uint8_t max)
+{
+    /* No usable calibration, pass through */
+    if (!(min < center && center < max))
+    {
+        m->min = 0;
+        m->center = ADC_CENTER;
+        m->max = ADC_MAX;
+    }
+    else
+    {
+        m->min = ADC_SCALE(min);
+        m->center = ADC_SCALE(center);
+        m->max = ADC_SCALE(max);
+    }
+
+    /* Division is slow on the PIC, but this only runs when loading */
+    m->scale[0] = slope(ADC_CENTER, m->center - m->min);
+    m->scale[1] = slope(ADC_MAX - ADC_CENTER, m->max - m->center);
+}
+
+/* -------------------------------------------------------------------------- */
+void calib_build_lut(void)
+{
+    const struct config* c = config_get();
+    for (uint8_t i = 0; i != 2; ++i)
+    {
+        struct calib_map* m = &_calib_map[i];
+        build_axis(m, c->calib.center[i], c->calib.min[i], c->calib.max[i]);
+        m->clamp[0] = calib_unapply(i, ADC_SCALE((uint8_t)(128 - c->dac_clamp.xy[i])));
+        m->clamp[1] = calib_unapply(i, ADC_SCALE((uint8_t)(128 + c->dac_clamp.xy[i])));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+adc_t calib_unapply(uint8_t axis, adc_t value)
+{
+    HOST_COUNT_CALL(calib_unapply);
+    const struct calib_map* m = &_calib_map[axis];
+
+    /* Divides, but only runs for angles and when building the clamp bounds */
+    if (value <= ADC_CENTER)
+        return (adc_t)(m->center - (adc_wide_t)(ADC_CENTER - value) * (m->center - m->min) / ADC_CENTER);
+    return (adc_t)(m->center + (adc_wide_t)(value - ADC_CENTER) * (m->max - m->center) / (ADC_MAX - ADC_CENTER));
+}
+
+/* -------------------------------------------------------------------------- */
+void calib_capture_start(const adc_t raw_xy[2])
+{
+    struct config* c = config_get();
+    for (uint8_t i = 0; i != 2; ++i)
+        c->calib.min[i] = c->calib.max[i] = ADC_TO_U8(raw_xy[i]);
+    capturing = 1;
+}
+
+/* -------------------------------------------------------------------------- */
+void calib_capture(const adc_t raw_xy[2])
+{
+    struct config* c = config_get();
+    if (!capturing)
+        return;
+
+    for (uint8_t i = 0; i != 2; ++i)
+    {
+        uint8_t raw = ADC_TO_U8(raw_xy[i]);
+        if (c->calib.min[i] > raw)
+            c->calib.min[i] = raw;
+        if (c->calib.max[i] < raw)
+            c->calib.max[i] = raw;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+static void use_calibration(void)
+{
+    const struct config* c = config_get();
+    uint8_t p;
+
+    /* Calibration belongs to the stick, copy it to all profiles */
+    for (p = 0; p != CONFIG_PROFILE_COUNT; ++p)
+        config_get_profile(p)->calib = c->calib;
+    calib_build_lut();
+}
+
+/* -------------------------------------------------------------------------- */
+void calib_set_center(const adc_t raw_xy[2])
+{
+    struct config* c = config_get();
+    for (uint8_t i = 0; i != 2; ++i)
+        c->calib.center[i] = ADC_TO_U8(raw_xy[i]);
+    use_calibration();
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t calib_capture_stop(void)
+{
+    const struct config* c = config_get();
+
+    capturing = 0;
+    use_calibration();
+
+    return c->calib.min[0] < c->calib.center[0] && c->calib.center[0] < c->calib.max[0] &&
+           c->calib.min[1] < c->calib.center[1] && c->calib.center[1] < c->calib.max[1];
+}
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+
+using namespace testing;
+
+class calib : public Test
+{
+public:
+    void SetUp() override
+    {
+        struct config* c = config_get();
+        c->calib.center[0] = 120; c->calib.min[0] = 30; c->calib.max[0] = 220;
+        c->calib.center[1] = 128; c->calib.min[1] = 0;  c->calib.max[1] = 0;
+        calib_build_lut();
+    }
+
+    /* Work in 8-bit values regardless of ADC_10BIT */
+    static int apply(uint8_t axis, int raw)
+    {
+        return ADC_TO_U8(calib_apply(axis, ADC_SCALE(raw)));
+    }
+    static int unapply(uint8_t axis, adc_t value)
+    {
+        return ADC_TO_U8(calib_unapply(axis, value));
+    }
+
+    void TearDown() override
+    {
+        for (uint8_t p = 0; p != CONFIG_PROFILE_COUNT; ++p)
+            memset(&config_get_profile(p)->calib, 0, sizeof(config_get()->calib));
+        calib_build_lut();
+    }
+};
+
+TEST_F(calib, invalid_calibration_passes_through)
+{
+    for (int raw = 0; raw != 256; ++raw)
+        EXPECT_THAT(apply(1, raw), Eq(raw));
+}
+
+TEST_F(calib, center_and_extremes_are_mapped)
+{
+    EXPECT_THAT(apply(0, 120), Eq(128));
+    EXPECT_THAT(apply(0, 30), Eq(0));
+    EXPECT_THAT(apply(0, 10), Eq(0));
+    EXPECT_THAT(apply(0, 220), Eq(255));
+    EXPECT_THAT(apply(0, 250), Eq(255));
+    EXPECT_THAT(apply(0, 75), Eq(64));
+}
+
+TEST_F(calib, mapping_is_monotonic)
+{
+    for (int raw = 1; raw != 256; ++raw)
+        EXPECT_THAT(apply(0, raw), Ge(apply(0, raw - 1))) << "raw=" << raw;
+}
+
+TEST_F(calib, every_reading_maps_monotonically)
+{
+    for (int raw = 1; raw <= ADC_MAX; ++raw)
+        EXPECT_THAT(calib_apply(0, (adc_t)raw), Ge(calib_apply(0, (adc_t)(raw - 1)))) << "raw=" << raw;
+    for (int raw = 0; raw <= ADC_MAX; ++raw)
+        EXPECT_THAT(calib_apply(1, (adc_t)raw), Eq(raw)) << "raw=" << raw;
+}
+
+TEST_F(calib, unapply_inverts_apply)
+{
+    EXPECT_THAT(unapply(0, ADC_CENTER), Eq(120));
+    EXPECT_THAT(unapply(0, 0), Eq(30));
+    EXPECT_THAT(unapply(0, ADC_MAX), Eq(220));
+    EXPECT_THAT(unapply(1, ADC_SCALE(42)), Eq(42));
+    for (int raw = 30; raw <= 220; ++raw)
+    {
+        /* The slopes are rounded, which costs a bit of precision at 10-bit */
+        int value = calib_unapply(0, calib_apply(0, ADC_SCALE(raw)));
+        EXPECT_THAT(value, AllOf(Ge(ADC_SCALE(raw - 2)), Le(ADC_SCALE(raw + 2)))) << "raw=" << raw;
+    }
+}
+
+TEST_F(calib, clamp_bounds_are_unapplied)
+{
+    config_get()->dac_clamp.xy[0] = 40;
+    config_get()->dac_clamp.xy[1] = 100;
+    calib_build_lut();
+
+    EXPECT_THAT(calib_clamp_bound(0, 0), Eq(calib_unapply(0, ADC_SCALE(88))));
+    EXPECT_THAT(calib_clamp_bound(0, 1), Eq(calib_unapply(0, ADC_SCALE(168))));
+    EXPECT_THAT(calib_clamp_bound(1, 0), Eq(ADC_SCALE(28)));
+    EXPECT_THAT(calib_clamp_bound(1, 1), Eq(ADC_SCALE(228)));
+
+    config_get()->dac_clamp.xy[0] = 0;
+    config_get()->dac_clamp.xy[1] = 0;
+}
+
+TEST_F(calib, segments_meet_their_ends_at_every_calibration)
+{
+    struct config* c = config_get();
+    for (int min = 0; min < 254; min += 3)
+        for (int max = min + 2; max < 256; max += 5)
+        {
+            c->calib.min[0] = (uint8_t)min;
+            c->calib.center[0] = (uint8_t)((min + max) / 2);
+            c->calib.max[0] = (uint8_t)max;
+            calib_build_lut();
+
+            adc_t prev = 0;
+            for (int raw = 0; raw <= ADC_MAX; ++raw)
+            {
+                adc_t value = calib_apply(0, (adc_t)raw);
+                ASSERT_THAT(value, Ge(prev)) << min << " " << max << " raw=" << raw;
+                prev = value;
+            }
+            ASSERT_THAT(calib_apply(0, ADC_SCALE(c->calib.center[0])), Eq(ADC_CENTER));
+            ASSERT_THAT(calib_unapply(0, 0), Eq(ADC_SCALE(min)));
+            ASSERT_THAT(calib_unapply(0, ADC_CENTER), Eq(ADC_SCALE(c->calib.center[0])));
+            ASSERT_THAT(calib_unapply(0, ADC_MAX), Eq(ADC_SCALE(max)));
+        }
+}
+
+TEST_F(calib, center_is_used_by_all_profiles_at_once)
+{
+    const adc_t raw[2] = {ADC_SCALE(100), ADC_SCALE(130)};
+    config_get()->calib.min[1] = 20;
+    config_get()->calib.max[1] = 240;
+    calib_set_center(raw);
+
+    EXPECT_THAT(apply(0, 100), Eq(128));
+    EXPECT_THAT(apply(1, 130), Eq(128));
+    EXPECT_THAT(unapply(0, ADC_CENTER), Eq(100));
+    for (uint8_t p = 0; p != CONFIG_PROFILE_COUNT; ++p)
+    {
+        EXPECT_THAT(config_get_profile(p)->calib.center[0], Eq(100)) << "profile " << (int)p;
+        EXPECT_THAT(config_get_profile(p)->calib.center[1], Eq(130)) << "profile " << (int)p;
+    }
+}
+
+TEST_F(calib, capture_widens_range_and_copies_to_all_profiles)
+{
+    const adc_t samples[][2] = {
+        {ADC_SCALE(120), ADC_SCALE(128)}, {ADC_SCALE(40), ADC_SCALE(200)},
+        {ADC_SCALE(210), ADC_SCALE(10)}, {ADC_SCALE(100), ADC_SCALE(128)}
+    };
+    calib_capture_start(samples[0]);
+    for (const auto& s : samples)
+        calib_capture(s);
+    config_get()->calib.center[1] = 128;
+    EXPECT_THAT(calib_capture_stop(), Eq(1));
+
+    for (uint8_t p = 0; p != CONFIG_PROFILE_COUNT; ++p)
+    {
+        const struct config* c = config_get_profile(p);
+        EXPECT_THAT(c->calib.min[0], Eq(40));
+        EXPECT_THAT(c->calib.max[0], Eq(210));
+        EXPECT_THAT(c->calib.min[1], Eq(10));
+        EXPECT_THAT(c->calib.max[1], Eq(200));
+    }
+
+    /* Not capturing anymore */
+    const adc_t outlier[2] = {0, ADC_MAX};
+    calib_capture(outlier);
+    EXPECT_THAT(config_get()->calib.min[0], Eq(40));
+}
+
+#endif
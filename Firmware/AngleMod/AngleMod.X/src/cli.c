@@ -6,33 +6,42 @@
 #include "anglemod/adc.h"
 #include "anglemod/dac.h"
 #include "anglemod/math.h"
+#include "anglemod/calib.h"
+#include "anglemod/btn.h"
+#include "anglemod/bin.h"
+#include "anglemod/boot.h"
 #include <ctype.h>  /* isprint(), isspace() */
 #include <assert.h>
 
 #define PROMPT "> "
 
 #if defined (CLI_USE_UNICODE)
-#   define DEGREES "\xC2\xB0"
+#   define DEGREES UART_TOK_STR(UART_TOK_DEGREES_HEX)
 #else
 #   define DEGREES "d"
 #endif
 
+/* Single byte tokens, expanded by uart_printf(). See UART_TOK_* in uart.h */
+#define CLEAR_EOL UART_TOK_STR(UART_TOK_CLEAR_EOL_HEX)
+#define CURSOR_UP UART_TOK_STR(UART_TOK_CURSOR_UP_HEX)
+
 #if defined (CLI_USE_COLOR)
-#define CLEAR(x)    "\x1b[0m"    x
-#define RED(x)      "\x1b[1;31m" x
-#define GREEN(x)    "\x1b[1;32m" x
-#define YELLOW(x)   "\x1b[1;33m" x
-#define BLUE(x)     "\x1b[1;34m" x
-#define MAGENTA(x)  "\x1b[1;35m" x
-#define CYAN(x)     "\x1b[1;36m" x
-#define WHITE(x)    "\x1b[1;37m" x
-#define REDC(x)     "\x1b[1;31m" x "\x1b[0m"
-#define GREENC(x)   "\x1b[1;32m" x "\x1b[0m"
-#define YELLOWC(x)  "\x1b[1;33m" x "\x1b[0m"
-#define BLUEC(x)    "\x1b[1;34m" x "\x1b[0m"
-#define MAGENTAC(x) "\x1b[1;35m" x "\x1b[0m"
-#define CYANC(x)    "\x1b[1;36m" x "\x1b[0m"
-#define WHITEC(x)   "\x1b[1;37m" x "\x1b[0m"
+#define NOCOLOR     UART_TOK_STR(UART_TOK_RESET_HEX)
+#define CLEAR(x)    NOCOLOR x
+#define RED(x)      UART_TOK_STR(UART_TOK_RED_HEX) x
+#define GREEN(x)    UART_TOK_STR(UART_TOK_GREEN_HEX) x
+#define YELLOW(x)   UART_TOK_STR(UART_TOK_YELLOW_HEX) x
+#define BLUE(x)     UART_TOK_STR(UART_TOK_BLUE_HEX) x
+#define MAGENTA(x)  UART_TOK_STR(UART_TOK_MAGENTA_HEX) x
+#define CYAN(x)     UART_TOK_STR(UART_TOK_CYAN_HEX) x
+#define WHITE(x)    UART_TOK_STR(UART_TOK_WHITE_HEX) x
+#define REDC(x)     RED(x) NOCOLOR
+#define GREENC(x)   GREEN(x) NOCOLOR
+#define YELLOWC(x)  YELLOW(x) NOCOLOR
+#define BLUEC(x)    BLUE(x) NOCOLOR
+#define MAGENTAC(x) MAGENTA(x) NOCOLOR
+#define CYANC(x)    CYAN(x) NOCOLOR
+#define WHITEC(x)   WHITE(x) NOCOLOR
 #else
 #define CLEAR(x) x
 #define RED(x) x
@@ -57,10 +66,19 @@
 static void cli_putc_normal(char c);
 static void cli_putc_escape(char c);
 static void cli_putc_csi(char c);
+static void cli_putc_binary(char c);
 
 static char line[CLI_LINE_LEN + 1];
 static char save_line[CLI_LINE_LEN + 1];
-static char history[CLI_HISTORY_LEN][CLI_LINE_LEN + 1];
+
+/*
+ * Previous lines are stored back to back as null-terminated strings in a
+ * circular buffer. The oldest entries are overwritten as new lines are added.
+ * Two consecutive null bytes (an empty entry) mark the end of the history.
+ */
+static char history[CLI_HISTORY_BUF_SIZE];
+#define HISTORY_IDX(x) ((uint8_t)(x) & (CLI_HISTORY_BUF_SIZE - 1u))
+#define HISTORY_NONE 0xFF
 
 static uint8_t line_len = 0;
 static uint8_t cursor_idx = 0;
@@ -68,12 +86,14 @@ static uint8_t history_write_idx = 0;
 static uint8_t history_read_offset = 0;
 
 static uint8_t log_category = 0;
+static uint8_t machine_mode = 0;
+static uint8_t cmd_failed = 0;
 
 #define CSI_PARAM_BUF_SIZE 1
 static uint8_t csi_param_buf[CSI_PARAM_BUF_SIZE];
 static uint8_t csi_param_idx = 0;
 
-static const char* sequence_name_table[] = {
+static const char* const sequence_name_table[] = {
 #define X(name, mirrx, mirry, str, x, y) str " + x",
     SEQ_LIST
 #undef X
@@ -87,8 +107,14 @@ static void cmd_joy(uint8_t argc, char** argv);
 static void cmd_angle(uint8_t argc, char** argv);
 static void cmd_mirror(uint8_t argc, char** argv);
 static void cmd_clamp(uint8_t argc, char** argv);
+static void cmd_debounce(uint8_t argc, char** argv);
 static void cmd_quantize(uint8_t argc, char** argv);
 static void cmd_log(uint8_t argc, char** argv);
+static void cmd_mode(uint8_t argc, char** argv);
+static void cmd_flow(uint8_t argc, char** argv);
+static void cmd_boot(uint8_t argc, char** argv);
+static void cmd_calibrate(uint8_t argc, char** argv);
+static void cmd_profile(uint8_t argc, char** argv);
 static void cmd_save(uint8_t argc, char** argv);
 static void cmd_discard(uint8_t argc, char** argv);
 static void cmd_defaults(uint8_t argc, char** argv);
@@ -100,31 +126,54 @@ struct cli_cmd {
     void (*handler)(uint8_t argc, char** argv);
 };
 
-static struct cli_cmd commands[] = {
+static const struct cli_cmd commands[] = {
     {"help", "", "Print help.", cmd_help},
     {"joy", "<xy value> [hysteresis]", "Configure how the joystick is converted into directions.", cmd_joy},
     {"toggle", "<index>", "Enable/disable individual angles and modes.", cmd_toggle},
     {"angle", "<index> <angle|<x> <y>>", "Configure the individual angles for command inputs.", cmd_angle},
     {"mirror", "<index> <x|y|xy>", "Mirrors the coordinates across the X or Y axis.", cmd_mirror},
     {"clamp", "<x> [y]", "Set the clamp threshold for normal mode. If only X is specified, then Y will be set to the same value as well.", cmd_clamp},
+    {"debounce", "[ms|reset]", "Set how long the button is ignored after an edge (0-63 ms) and show the measured press latency.", cmd_debounce},
     /*{"quantize", "<mode>", "Set the quantization mode for normal mode.", cmd_quantize},*/
+    {"calibrate", "[center|range|done|reset]", "Calibrate the stick. Let go of it for center, then start range, move it along its edges and finish with done.", cmd_calibrate},
+    {"profile", "[index] [name]", "Switch to or rename one of the stored profiles.", cmd_profile},
     {"save", "", "Save changes to non-volatile memory.", cmd_save},
     {"load", "", "Load values from non-volatile memory, discarding any changes.", cmd_discard},
     {"defaults", "", "Set default values.", cmd_defaults},
     {"log", "<all|off|adc|joy|seq|dac>", "Log values in real-time. Useful for debugging.", cmd_log},
+    {"mode", "<human|machine>", "Machine mode turns off echo, colors and cursor control, and ends every reply with a line saying OK or ERR.", cmd_mode},
+    {"flow", "[on|off|reset]", "XON/XOFF flow control for pasting scripts, and counters for lost input.", cmd_flow},
+    {"boot", "", "Show how many us after reset the control path, the first sample and the CLI were ready.", cmd_boot},
     {NULL}
 };
 
 /* -------------------------------------------------------------------------- */
 static void set_cursor_h(uint8_t idx)
 {
+    if (machine_mode)
+        return;
     uart_printf("\x1B[%uG", idx + sizeof(PROMPT));
 }
 
 /* -------------------------------------------------------------------------- */
 static void clear_from_cursor_until_end(void)
 {
-    uart_printf("\x1b[K");
+    uart_printf(CLEAR_EOL);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Prints what the user typed, unless in machine mode */
+static void echo(const char* s)
+{
+    if (!machine_mode)
+        uart_printf(s);
+}
+
+/* -------------------------------------------------------------------------- */
+static void print_error(const char* msg)
+{
+    uart_printf(REDC("\r\nError: ") "%s", msg);
+    cmd_failed = 1;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -173,7 +222,7 @@ static void print_angles_and_toggle_states()
 {
     const struct config* c = config_get();
     
-    static const char* category_name_table[] = {
+    static const char* const category_name_table[] = {
         "Cardinal Angles",
         "Diagonal Angles",
         "Special Angles"
@@ -185,8 +234,8 @@ static void print_angles_and_toggle_states()
         uint8_t item_idx = i & 0x07;
         if (item_idx == 0)
             uart_printf(MAGENTAC("\r\n%s:"), category_name_table[cat_idx]);
-        uart_printf("\r\n  (\x1b[1;3%cm%c%u\x1b[0m) %s :  " YELLOWC("%u") "," YELLOWC("%u"),
-            (c->enable.bytes[cat_idx] & (1 << item_idx)) ? '2' : '1',
+        uart_printf("\r\n  (%c%c%u" CLEAR(") ") "%s :  " YELLOWC("%u") "," YELLOWC("%u"),
+            (c->enable.bytes[cat_idx] & (1 << item_idx)) ? UART_TOK(UART_TOK_GREEN_HEX) : UART_TOK(UART_TOK_RED_HEX),
             'b' + cat_idx,
             item_idx + 1,
             sequence_name_table[i],
@@ -207,7 +256,7 @@ static void cmd_toggle(uint8_t argc, char** argv)
         uint8_t mask = argv[0][1] ? (uint8_t)(1 << item_idx) : 0xFF;
         if (cat_idx >= 4 || item_idx >= 8)
         {
-            uart_printf(REDC("\r\nError: ") "unknown category/index");
+            print_error("unknown category/index");
             do_print = 0;
             continue;
         }
@@ -229,9 +278,9 @@ static void cmd_toggle(uint8_t argc, char** argv)
     if (do_print)
     {
         uart_printf(MAGENTAC("\r\nNormal Mode:"));
-        uart_printf("\r\n  (\x1b[1;3%cma1\x1b[0m) When no Command is Detected : \x1b[1;3%cm%s\x1b[0m",
-            c->enable.normal_mode == 0 ? '1' : '2',
-            c->enable.normal_mode == 0 ? '1' : '2',
+        uart_printf("\r\n  (%ca1" CLEAR(") ") "When no Command is Detected : %c%s" CLEAR(""),
+            c->enable.normal_mode == 0 ? UART_TOK(UART_TOK_RED_HEX) : UART_TOK(UART_TOK_GREEN_HEX),
+            c->enable.normal_mode == 0 ? UART_TOK(UART_TOK_RED_HEX) : UART_TOK(UART_TOK_GREEN_HEX),
             c->enable.normal_mode == 0 ? "Do Nothing" : c->enable.normal_mode == 1 ? "Clamp" : "Quantize");
 
         print_angles_and_toggle_states();
@@ -354,12 +403,13 @@ static void cmd_clamp(uint8_t argc, char** argv)
     {
         c->dac_clamp.xy[0] = u8_atoi(argv[0]);
         c->dac_clamp.xy[1] = argc > 1 ? u8_atoi(argv[1]) : c->dac_clamp.xy[0];
+        calib_build_lut();
 
         c->enable.normal_mode = NORMAL_MODE_CLAMP;
     }
     else if (argc != 0)
     {
-        uart_printf(REDC("\r\nError: ") "Wrong number of arguments");
+        print_error("Wrong number of arguments");
         return;
     }
 
@@ -368,12 +418,39 @@ static void cmd_clamp(uint8_t argc, char** argv)
         c->dac_clamp.xy[1]);
 }
 
+/* -------------------------------------------------------------------------- */
+static void cmd_debounce(uint8_t argc, char** argv)
+{
+    struct config* c = config_get();
+
+    if (argc > 0)
+    {
+        if (strcmp(argv[0], "reset") == 0)
+            btn_latency_reset();
+        else
+        {
+            uint8_t ms = u8_atoi(argv[0]);
+            if (ms > 63)
+            {
+                print_error("Lockout must be 63 ms or less");
+                return;
+            }
+            c->enable.btn_lockout = ms;
+        }
+    }
+
+    uart_printf("\r\nLockout: " CYANC("%u") " ms\r\nLatency: " CYANC("%u") " us, max " CYANC("%u") " us",
+        (uint8_t)c->enable.btn_lockout,
+        btn_latency_last(),
+        btn_latency_max());
+}
+
 /* -------------------------------------------------------------------------- */
 static void cmd_quantize(uint8_t argc, char** argv)
 {
     struct config* c = config_get();
 
-    static const char* table[] = {
+    static const char* const table[] = {
         "Quantize to 4 cardinal directions",
         "Quantize to 4 diagonal directions (45" DEGREES ")",
         "Quantize to 8 directions (45" DEGREES " increments)",
@@ -386,7 +463,7 @@ static void cmd_quantize(uint8_t argc, char** argv)
         uint8_t i = u8_atoi(argv[0]);
         if (i < 1 || i > 5)
         {
-            uart_printf(REDC("\r\nError: ") "Invalid index");
+            print_error("Invalid index");
             return;
         }
 
@@ -395,7 +472,7 @@ static void cmd_quantize(uint8_t argc, char** argv)
     }
     else if (argc != 0)
     {
-        uart_printf(REDC("\r\nError: ") "Wrong number of arguments");
+        print_error("Wrong number of arguments");
         return;
     }
     else
@@ -407,19 +484,104 @@ static void cmd_quantize(uint8_t argc, char** argv)
     }
 }
 
+/* -------------------------------------------------------------------------- */
+static void cmd_calibrate(uint8_t argc, char** argv)
+{
+    struct config* c = config_get();
+
+    if (argc > 0)
+    {
+        if (strcmp(argv[0], "center") == 0)
+        {
+            calib_set_center(adc_joy_raw_xy());
+        }
+        else if (strcmp(argv[0], "range") == 0)
+        {
+            calib_capture_start(adc_joy_raw_xy());
+            uart_printf("\r\nMove the stick along its edges, then use " GREENC("calibrate done"));
+            return;
+        }
+        else if (strcmp(argv[0], "reset") == 0)
+        {
+            memset(&c->calib, 0, sizeof(c->calib));
+            calib_capture_stop();
+        }
+        else if (strcmp(argv[0], "done") == 0)
+        {
+            if (!calib_capture_stop())
+                print_error("Center is not within range, calibration is disabled");
+        }
+        else
+        {
+            print_error("Unknown argument");
+            return;
+        }
+    }
+
+    uart_printf("\r\n" CYANC("Center: ") "%u,%u  " CYANC("Min: ") "%u,%u  " CYANC("Max: ") "%u,%u",
+        c->calib.center[0], c->calib.center[1],
+        c->calib.min[0], c->calib.min[1],
+        c->calib.max[0], c->calib.max[1]);
+}
+
+/* -------------------------------------------------------------------------- */
+static void cmd_profile(uint8_t argc, char** argv)
+{
+    uint8_t i;
+
+    if (argc > 0)
+    {
+        i = u8_atoi(argv[0]);
+        if (i >= CONFIG_PROFILE_COUNT)
+        {
+            print_error("Profile index out of range");
+            return;
+        }
+
+        if (argc > 1)
+        {
+            /* Pad with null bytes, they end up in NVM */
+            char* name = config_profile_name(i);
+            memset(name, 0, CONFIG_PROFILE_NAME_LEN + 1);
+            strncpy(name, argv[1], CONFIG_PROFILE_NAME_LEN);
+        }
+        else
+        {
+            config_select_profile(i);
+            calib_build_lut();
+        }
+    }
+
+    uart_printf(MAGENTAC("\r\nProfiles:"));
+    for (i = 0; i != CONFIG_PROFILE_COUNT; ++i)
+        uart_printf("\r\n  %c%u" CLEAR(" ") "%s",
+            i == config_active_profile() ? UART_TOK(UART_TOK_GREEN_HEX) : UART_TOK(UART_TOK_WHITE_HEX),
+            i,
+            config_profile_name(i));
+}
+
 /* -------------------------------------------------------------------------- */
 static void cmd_save(uint8_t argc, char** argv)
 {
-    if (config_save_to_nvm())
+    switch (config_save_to_nvm())
+    {
+    case CONFIG_SAVE_OK:
         uart_printf(GREENC("\r\nSuccess: ") "Values written to NVM");
-    else
-        uart_printf(REDC("\r\nError: ") "Write error occurred");
+        break;
+    case CONFIG_SAVE_WRITE_ERROR:
+        print_error("Write error occurred");
+        break;
+    case CONFIG_SAVE_TOO_MANY_CHANGES:
+        print_error("Profiles differ too much from profile 0");
+        break;
+    }
 }
 
 /* -------------------------------------------------------------------------- */
 static void cmd_discard(uint8_t argc, char** argv)
 {
     config_load_from_nvm();
+    calib_build_lut();
     uart_printf(GREENC("\r\nSuccess: ") "Values loaded from NVM");
 }
 
@@ -427,32 +589,154 @@ static void cmd_discard(uint8_t argc, char** argv)
 static void cmd_defaults(uint8_t argc, char** argv)
 {
     config_set_defaults();
+    calib_build_lut();
     uart_printf("\r\nDefault values set\r\n" CYANC("Note: ") "Use " GREENC("save") " if you want to keep default values");
 }
 
 /* -------------------------------------------------------------------------- */
-static uint8_t log_lines_per_category[] = {
-    2,          /* ADC prints 2 lines */
-    2 + 3,      /* joy prints 3 lines */
-    2 + 3 + 3,  /* seq prints 3 lines */
+/*
+ * Log output is drawn in the rows below the prompt. Every value is a field at
+ * a fixed row and column, and the value last sent to each field is remembered
+ * so only fields that changed are sent again. Printing a new prompt scrolls
+ * the screen, after which all fields are drawn again along with their labels.
+ */
+#define LOG_FIELD_LIST \
+    X(ADC_X, 1,  CYANC("X: "),    3) \
+    X(ADC_Y, 2,  CYANC("Y: "),    3) \
+    X(JOY_2, 3,  YELLOWC("2: "),  3) \
+    X(JOY_1, 4,  YELLOWC("1: "),  3) \
+    X(JOY_0, 5,  YELLOWC("0: "),  3) \
+    X(SEQ_2, 6,  GREENC("2: "),   3) \
+    X(SEQ_1, 7,  GREENC("1: "),   3) \
+    X(SEQ_0, 8,  GREENC("0: "),   3) \
+    X(DAC_0, 9,  BLUEC("DAC0: "), 6) \
+    X(DAC_1, 10, BLUEC("DAC1: "), 6)
+
+enum log_field
+{
+#define X(name, row, label, width) LOG_FIELD_##name,
+    LOG_FIELD_LIST
+#undef X
+    LOG_FIELD_COUNT
+};
+
+#define LOG_ROWS 10
+#define LOG_STALE 0xFFFF    /* Field needs to be drawn with its label */
+#define LOG_DASHES 0x100    /* Field shows "--" */
+
+static uint16_t log_field_value[LOG_FIELD_COUNT] = {
+#define X(name, row, label, width) LOG_STALE,
+    LOG_FIELD_LIST
+#undef X
 };
-static void log_skip_other_log_outputs(enum log_category category)
+static uint8_t log_rows_reserved = 0;
+static uint8_t log_row = 0;  /* Cursor row relative to the prompt */
+
+/* -------------------------------------------------------------------------- */
+static void log_invalidate(void)
 {
-#if defined(CLI_SIM)
-    assert(category >= LOG_JOY && category <= LOG_DAC);
-#endif
-    uint8_t l = log_lines_per_category[category - LOG_JOY];
-    while (l--)
-        uart_putc('\n');
+    memset(log_field_value, 0xFF, sizeof(log_field_value));
+    log_rows_reserved = 0;
 }
-static void log_unskip_other_log_outputs(enum log_category category)
+
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Moves the cursor to a field if its value changed, in which case the
+ * caller prints the new value and calls log_field_end(). Returns 0 if there
+ * is nothing to do.
+ */
+static uint8_t log_field_begin(enum log_field field, uint16_t value)
 {
-#if defined(CLI_SIM)
-    assert(category >= LOG_JOY && category <= LOG_DAC);
-#endif
-    uint8_t l = log_lines_per_category[category - LOG_JOY];
-    while (l--)
-        uart_printf("\x1b[A");
+    static const uint8_t rows[] = {
+#define X(name, row, label, width) row,
+        LOG_FIELD_LIST
+#undef X
+    };
+    static const uint8_t widths[] = {
+#define X(name, row, label, width) width,
+        LOG_FIELD_LIST
+#undef X
+    };
+    static const char* const labels[] = {
+#define X(name, row, label, width) label,
+        LOG_FIELD_LIST
+#undef X
+    };
+    static const char* const names[] = {
+#define X(name, row, label, width) #name,
+        LOG_FIELD_LIST
+#undef X
+    };
+    uint8_t row = rows[field];
+
+    if (log_field_value[field] == value)
+        return 0;
+
+    /* One line per change, e.g. "ADC_X=128" */
+    if (machine_mode)
+    {
+        uart_printf("\r\n%s=", names[field]);
+        log_field_value[field] = value;
+        return 1;
+    }
+
+    /* The rows might not exist yet if the prompt is at the bottom of the
+     * terminal. Moving the cursor down doesn't scroll, newlines do */
+    if (!log_rows_reserved)
+    {
+        uint8_t i = LOG_ROWS;
+        while (i--)
+            uart_putc('\n');
+        uart_printf("\x1b[%uA", LOG_ROWS);
+        log_rows_reserved = 1;
+    }
+
+    if (row > log_row)
+        uart_printf("\x1b[%uB", row - log_row);
+    else if (row < log_row)
+        uart_printf("\x1b[%uA", log_row - row);
+    log_row = row;
+
+    if (log_field_value[field] == LOG_STALE)
+        uart_printf("\r%s", labels[field]);
+    else
+        uart_printf("\x1b[%uG", widths[field] + 1);
+
+    log_field_value[field] = value;
+    return 1;
+}
+static void log_field_end(void)
+{
+    uart_printf(CLEAR_EOL);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Puts the cursor back to where the user is typing, if it moved */
+static void log_restore_cursor(void)
+{
+    if (log_row == 0)
+        return;
+    uart_printf("\x1b[%uA", log_row);
+    log_row = 0;
+    set_cursor_h(cursor_idx);
+}
+
+/* -------------------------------------------------------------------------- */
+static void log_field_u8(enum log_field field, uint8_t value)
+{
+    if (log_field_begin(field, value))
+    {
+        uart_printf("%u", value);
+        log_field_end();
+    }
+}
+static void log_field_str(enum log_field field, uint16_t key, const char* str)
+{
+    if (log_field_begin(field, key))
+    {
+        uart_printf("%s", str);
+        log_field_end();
+    }
 }
 
 /* -------------------------------------------------------------------------- */
@@ -461,35 +745,25 @@ void log_adc(void)
     if (!(log_category & LOG_ADC_MASK))
         return;
 
-    uart_printf("\r\n" CYANC("X: ") "%u" "\x1b[K\r\n" CYANC("Y: ") "%u\x1b[K\x1b[2A",
-        adc_joy_xy()[0], 
-        adc_joy_xy()[1]);
-
-    /* Restore cursor to where it was before printing our log message */
-    set_cursor_h(cursor_idx);
+    log_field_u8(LOG_FIELD_ADC_X, ADC_TO_U8(adc_joy_xy()[0]));
+    log_field_u8(LOG_FIELD_ADC_Y, ADC_TO_U8(adc_joy_xy()[1]));
+    log_restore_cursor();
 }
 void log_joy(enum joy_state states[3])
 {
-    static const char* joy_state_table[] = {
+    static const char* const joy_state_table[] = {
 #define X(name, str) str,
         JOY_STATE_LIST
 #undef X
     };
+    uint8_t i;
 
     if (!(log_category & LOG_JOY_MASK))
         return;
 
-    /* Skip over previous log messages if they're enabled */
-    log_skip_other_log_outputs(LOG_JOY);
-
-    uart_printf("\r\n" YELLOWC("2: ") "%s\x1b[K\r\n" YELLOWC("1: ") "%s\x1b[K\r\n" YELLOWC("0: ") "%s\x1b[K\x1b[3A",
-        joy_state_table[states[2]],
-        joy_state_table[states[1]],
-        joy_state_table[states[0]]);
-
-    /* Restore cursor to where it was before printing our log message */
-    log_unskip_other_log_outputs(LOG_JOY);
-    set_cursor_h(cursor_idx);
+    for (i = 0; i != 3; ++i)
+        log_field_str((enum log_field)(LOG_FIELD_JOY_2 + i), states[2 - i], joy_state_table[states[2 - i]]);
+    log_restore_cursor();
 }
 void log_seq(enum seq seq)
 {
@@ -499,56 +773,38 @@ void log_seq(enum seq seq)
     if (!(log_category & LOG_SEQ_MASK))
         return;
 
-    /* Skip over previous log messages if they're enabled */
-    log_skip_other_log_outputs(LOG_SEQ);
-
     seq_history[0] = seq_history[1];
     seq_history[1] = seq_history[2];
     seq_history[2] = seq;
 
-    i = 3;
-    while (i--)
+    for (i = 0; i != 3; ++i)
     {
-        enum seq s = seq_history[i];
-        uart_printf("\r\n" GREENC("%u: ") "%s\x1b[K", 
-                i, 
+        enum seq s = seq_history[2 - i];
+        log_field_str((enum log_field)(LOG_FIELD_SEQ_2 + i), s,
                 s == SEQ_NONE ? "none" : sequence_name_table[s]);
     }
-    uart_printf("\x1b[3A");
-
-    /* Restore cursor to where it was before printing our log message */
-    log_unskip_other_log_outputs(LOG_SEQ);
-    set_cursor_h(cursor_idx);
+    log_restore_cursor();
 }
 void log_dac(uint8_t swx, uint8_t swy, const uint8_t* dac01_write_buf)
 {
+    uint8_t value;
+
     if (!(log_category & LOG_DAC_MASK))
         return;
 
-    /* Skip over previous log messages if they're enabled */
-    log_skip_other_log_outputs(LOG_DAC);
-
-    uart_printf("\r\n" BLUEC("DAC0: "));
-    if (swx)
-    {
-        uint8_t value = (uint8_t)(dac01_write_buf[1] << 6) | (dac01_write_buf[2] >> 2);
-        uart_printf("%u", value);
-    }
+    value = (uint8_t)(dac01_write_buf[1] << 6) | (dac01_write_buf[2] >> 2);
+    if (!swx)
+        log_field_str(LOG_FIELD_DAC_0, LOG_DASHES, "--");
     else
-        uart_printf("--");
-    uart_printf("\x1b[K\r\n" BLUEC("DAC1: "));    
-    if (swy)
-    {
-        uint8_t value = (uint8_t)(dac01_write_buf[4] << 6) | (dac01_write_buf[5] >> 2);
-        uart_printf("%u", value);
-    }
+        log_field_u8(LOG_FIELD_DAC_0, value);
+
+    value = (uint8_t)(dac01_write_buf[4] << 6) | (dac01_write_buf[5] >> 2);
+    if (!swy)
+        log_field_str(LOG_FIELD_DAC_1, LOG_DASHES, "--");
     else
-        uart_printf("--");
-    uart_printf("\x1b[K\x1b[2A");
+        log_field_u8(LOG_FIELD_DAC_1, value);
 
-    /* Restore cursor to where it was before printing our log message */
-    log_unskip_other_log_outputs(LOG_DAC);
-    set_cursor_h(cursor_idx);
+    log_restore_cursor();
 }
 static void cmd_log(uint8_t argc, char** argv)
 {
@@ -581,7 +837,62 @@ static void cmd_log(uint8_t argc, char** argv)
             return;
         }
     
-    uart_printf(REDC("\r\nError: ") "Unknown category");
+    print_error("Unknown category");
+}
+
+/* -------------------------------------------------------------------------- */
+static void cmd_mode(uint8_t argc, char** argv)
+{
+    if (argc == 1 && strcmp(argv[0], "machine") == 0)
+        machine_mode = 1;
+    else if (argc == 1 && strcmp(argv[0], "human") == 0)
+        machine_mode = 0;
+    else
+    {
+        print_error("Expected human or machine");
+        return;
+    }
+
+    uart_set_plain(machine_mode);
+    log_invalidate();
+}
+
+/* -------------------------------------------------------------------------- */
+static void cmd_flow(uint8_t argc, char** argv)
+{
+    if (argc > 0)
+    {
+        if (strcmp(argv[0], "on") == 0)
+            uart_set_flow_control(1);
+        else if (strcmp(argv[0], "off") == 0)
+            uart_set_flow_control(0);
+        else if (strcmp(argv[0], "reset") == 0)
+            uart_rx_stats_reset();
+        else
+        {
+            print_error("Unknown argument");
+            return;
+        }
+    }
+
+    uart_printf("\r\nXON/XOFF: " CYANC("%s") "\r\nDropped: " CYANC("%u") "\r\nOverruns: " CYANC("%u"),
+        uart_flow_control() ? "on" : "off",
+        uart_rx_dropped(),
+        uart_rx_overruns());
+}
+
+/* -------------------------------------------------------------------------- */
+static void cmd_boot(uint8_t argc, char** argv)
+{
+    static const char* const mark_names[] = {
+#define X(name, str) str,
+        BOOT_MARK_LIST
+#undef X
+    };
+    uint8_t i;
+
+    for (i = 0; i != BOOT_MARK_COUNT; ++i)
+        uart_printf("\r\n%s: " CYANC("%U") " us", mark_names[i], boot_time_us(i));
 }
 
 /* -------------------------------------------------------------------------- */
@@ -629,18 +940,80 @@ static void execute_current_line(void)
         return;
     }
 
-    uart_printf(REDC("\r\nError:") " Unknown command");
+    print_error("Unknown command");
 }
 
 /* -------------------------------------------------------------------------- */
-static void set_line_and_print(const char* new_text)
+static void history_push(const char* s)
+{
+    uint8_t idx = history_write_idx;
+    char overwritten;
+
+    do {
+        overwritten = history[idx];
+        history[idx] = *s;
+        idx = HISTORY_IDX(idx + 1);
+    } while (*s++);
+
+    history_write_idx = idx;
+
+    /* If the null terminator landed in the middle of an older entry, erase
+     * the rest of it so it doesn't show up as a truncated line */
+    if (overwritten != '\0')
+        while (history[idx] != '\0')
+        {
+            history[idx] = '\0';
+            idx = HISTORY_IDX(idx + 1);
+        }
+}
+
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Returns the index at which the entry "offset" lines back starts,
+ * where an offset of 1 is the most recent line, or HISTORY_NONE if the
+ * history doesn't go back that far.
+ */
+static uint8_t history_find(uint8_t offset)
+{
+    uint8_t start = history_write_idx;
+    while (offset--)
+    {
+        uint8_t end = HISTORY_IDX(start - 1);
+        if (history[HISTORY_IDX(end - 1)] == '\0')
+            return HISTORY_NONE;
+
+        start = HISTORY_IDX(end - 1);
+        while (history[HISTORY_IDX(start - 1)] != '\0')
+            start = HISTORY_IDX(start - 1);
+
+        /* The oldest entry always starts where the next one will be written */
+        if (start == history_write_idx && offset)
+            return HISTORY_NONE;
+    }
+
+    return start;
+}
+
+/* -------------------------------------------------------------------------- */
+static void history_copy(uint8_t start, char* dst)
+{
+    while ((*dst++ = history[start]) != '\0')
+        start = HISTORY_IDX(start + 1);
+}
+
+/* -------------------------------------------------------------------------- */
+static void print_new_line(void)
 {
-    strcpy(line, new_text);
     line_len = (uint8_t)strlen(line);
     cursor_idx = line_len;
     set_cursor_h(0);
     clear_from_cursor_until_end();
-    uart_printf(line);
+    echo(line);
+}
+static void set_line_and_print(const char* new_text)
+{
+    strcpy(line, new_text);
+    print_new_line();
 }
 
 /* -------------------------------------------------------------------------- */
@@ -676,25 +1049,17 @@ static void cli_putc_csi(char c)
         switch (c)
         {
         case 'A':  /* Cursor up */
-            if (history_read_offset == 0)
-                strcpy(save_line, line);
-
-            if (history_read_offset == CLI_HISTORY_LEN - 1)
-                break;
-            history_read_offset++;
-
             {
-                uint8_t read_idx = history_write_idx - history_read_offset;
-                if (read_idx > CLI_HISTORY_LEN - 1)
-                    read_idx = CLI_HISTORY_LEN - 1;
-
-                if (history[read_idx][0] == '\0')
-                {
-                    history_read_offset--;
+                uint8_t start = history_find(history_read_offset + 1);
+                if (start == HISTORY_NONE)
                     break;
-                }
 
-                set_line_and_print(history[read_idx]);
+                if (history_read_offset == 0)
+                    strcpy(save_line, line);
+                history_read_offset++;
+
+                history_copy(start, line);
+                print_new_line();
             }
 
             break;
@@ -712,16 +1077,13 @@ static void cli_putc_csi(char c)
 
             default:
                 history_read_offset--;
-                {
-                    uint8_t read_idx = history_write_idx - history_read_offset;
-                    if (read_idx > CLI_HISTORY_LEN - 1)
-                        read_idx = CLI_HISTORY_LEN - 1;
-                    set_line_and_print(history[read_idx]);
-                }
-
+                history_copy(history_find(history_read_offset), line);
+                print_new_line();
                 break;
             }
 
+            break;
+
         case 'C':  /* Cursor forward */
             /* Here we make the assumption that the CSI param consists of 1 character. I hope that's OK */
             if (csi_param_idx == 0)
@@ -780,7 +1142,7 @@ static void cli_putc_csi(char c)
                 history_read_offset = 0;
 
                 clear_from_cursor_until_end();
-                uart_printf(line + cursor_idx);
+                echo(line + cursor_idx);
                 set_cursor_h(cursor_idx);
                 break;
             }
@@ -795,6 +1157,27 @@ static void cli_putc_csi(char c)
     }
 }
 
+/* -------------------------------------------------------------------------- */
+static void end_binary(void)
+{
+    uart_suspend_flow_control(0);
+    cli_putc = cli_putc_normal;
+}
+
+/* -------------------------------------------------------------------------- */
+static void cli_putc_binary(char c)
+{
+    if (bin_putc(c))
+        end_binary();
+}
+
+/* -------------------------------------------------------------------------- */
+void cli_poll(void)
+{
+    if (cli_putc == cli_putc_binary && bin_timed_out())
+        end_binary();
+}
+
 /* -------------------------------------------------------------------------- */
 static void cli_putc_normal(char c)
 {
@@ -808,12 +1191,15 @@ static void cli_putc_normal(char c)
         {
             ignore_char = c == '\r' ? '\n' : '\r';
 
-            strcpy(history[history_write_idx++], line);
-            if (history_write_idx == CLI_HISTORY_LEN)
-                history_write_idx = 0;
+            history_push(line);
             history_read_offset = 0;
 
+            cmd_failed = 0;
             execute_current_line();
+
+            /* Every reply in machine mode ends with a status line */
+            if (machine_mode)
+                uart_printf(cmd_failed ? "\r\nERR\r\n" : "\r\nOK\r\n");
         }
         else
         {
@@ -823,12 +1209,15 @@ static void cli_putc_normal(char c)
 
     case 0x03:  /* CTRL+C (End of Text) */
         if (c == 0x03)
-            uart_printf("^C");
+            echo("^C");
 
         cursor_idx = 0;
         line_len = 0;
         line[0] = '\0';
-        uart_printf("\r\n" PROMPT "\x1b[K");
+        if (machine_mode)
+            break;
+        uart_printf("\r\n" PROMPT CLEAR_EOL);
+        log_invalidate();
 
         break;
 
@@ -837,6 +1226,12 @@ static void cli_putc_normal(char c)
         cli_putc = cli_putc_escape;
         break;
 
+    case BIN_STX:  /* Binary request, see bin.h */
+        bin_start();
+        uart_suspend_flow_control(1);
+        cli_putc = cli_putc_binary;
+        break;
+
     case '\b':  /* BS (backspace) */
     case 0x7F:  /* DEL (also gets sent when backspace is pressed in some terminals) */
         if (cursor_idx == 0)  /* Can't erase stuff at beginning */
@@ -850,7 +1245,7 @@ static void cli_putc_normal(char c)
 
         set_cursor_h(cursor_idx);
         clear_from_cursor_until_end();
-        uart_printf(line + cursor_idx);
+        echo(line + cursor_idx);
         set_cursor_h(cursor_idx);
         break;
 
@@ -861,7 +1256,7 @@ static void cli_putc_normal(char c)
         /* Insert character at cursor position */
         memmove(line + cursor_idx + 1, line + cursor_idx, line_len - cursor_idx + 1);
         line[cursor_idx] = c;
-        uart_printf(line + cursor_idx);
+        echo(line + cursor_idx);
         cursor_idx++;
         line_len++;
         history_read_offset = 0;
@@ -872,6 +1267,7 @@ static void cli_putc_normal(char c)
 #if defined(GTEST_TESTING)
 
 #include <gmock/gmock.h>
+#include <terminal.h>
 
 using namespace ::testing;
 
@@ -956,4 +1352,294 @@ TEST(split_args, trailing_spaces)
     EXPECT_THAT(argv[1], StrEq("bar"));
 }
 
+class cli_history : public Test
+{
+public:
+    void SetUp() override
+    {
+        memset(history, 0, sizeof(history));
+        history_write_idx = 0;
+    }
+
+    std::string get(uint8_t offset)
+    {
+        char buf[CLI_HISTORY_BUF_SIZE];
+        uint8_t start = history_find(offset);
+        if (start == HISTORY_NONE)
+            return "<none>";
+        history_copy(start, buf);
+        return buf;
+    }
+};
+
+TEST_F(cli_history, empty)
+{
+    EXPECT_THAT(get(1), StrEq("<none>"));
+}
+
+TEST_F(cli_history, most_recent_first)
+{
+    history_push("save");
+    history_push("log joy");
+    history_push("clamp 40");
+    EXPECT_THAT(get(1), StrEq("clamp 40"));
+    EXPECT_THAT(get(2), StrEq("log joy"));
+    EXPECT_THAT(get(3), StrEq("save"));
+    EXPECT_THAT(get(4), StrEq("<none>"));
+}
+
+TEST_F(cli_history, short_lines_use_less_space)
+{
+    /* 12 entries of 5 bytes each fit into 64 bytes */
+    for (int i = 0; i != 12; ++i)
+    {
+        char s[] = "cmd0";
+        s[3] = (char)('a' + i);
+        history_push(s);
+    }
+    EXPECT_THAT(get(1), StrEq("cmdl"));
+    EXPECT_THAT(get(12), StrEq("cmda"));
+    EXPECT_THAT(get(13), StrEq("<none>"));
+}
+
+TEST_F(cli_history, wrap_around_drops_oldest_entries)
+{
+    for (int i = 0; i != 20; ++i)
+    {
+        char s[] = "angle b0 10 20";
+        s[7] = (char)('0' + i % 10);
+        history_push(s);
+    }
+
+    /* Every entry is 15 bytes, so only the last 4 can fit */
+    EXPECT_THAT(get(1), StrEq("angle b9 10 20"));
+    EXPECT_THAT(get(2), StrEq("angle b8 10 20"));
+    EXPECT_THAT(get(3), StrEq("angle b7 10 20"));
+    EXPECT_THAT(get(4), StrEq("angle b6 10 20"));
+    EXPECT_THAT(get(5), StrEq("<none>"));
+}
+
+TEST_F(cli_history, partially_overwritten_entry_is_erased)
+{
+    history_push("0123456789abcdef");  /* 17 bytes */
+    history_push("0123456789abcdef");
+    history_push("0123456789abcdef");
+    history_push("x");                 /* 53 bytes */
+    history_push("0123456789abcde");   /* Wraps and cuts the first entry */
+    EXPECT_THAT(get(1), StrEq("0123456789abcde"));
+    EXPECT_THAT(get(2), StrEq("x"));
+    EXPECT_THAT(get(3), StrEq("0123456789abcdef"));
+    EXPECT_THAT(get(4), StrEq("0123456789abcdef"));
+    EXPECT_THAT(get(5), StrEq("<none>"));
+}
+
+TEST_F(cli_history, oldest_entry_ending_exactly_at_wrap)
+{
+    history_push("0123456789abcdef");
+    history_push("0123456789abcdef");
+    history_push("0123456789abcdef");
+    history_push("0123456789ab");      /* 13 bytes, ends exactly at 64 */
+    EXPECT_THAT(get(1), StrEq("0123456789ab"));
+    EXPECT_THAT(get(4), StrEq("0123456789abcdef"));
+    EXPECT_THAT(get(5), StrEq("<none>"));
+
+    history_push("new");
+    EXPECT_THAT(get(1), StrEq("new"));
+    EXPECT_THAT(get(4), StrEq("0123456789abcdef"));
+    EXPECT_THAT(get(5), StrEq("<none>"));
+}
+
+class cli_log : public Test
+{
+public:
+    void SetUp() override
+    {
+        log_category = LOG_DAC_MASK;
+        log_invalidate();
+        sent();
+    }
+
+    void TearDown() override
+    {
+        log_category = 0;
+    }
+
+    std::string sent()
+    {
+        while (PIE1bits.TX1IE)  /* Like drain_tx() in main.c */
+            uart_tx_isr();
+        return term.take();
+    }
+
+    /* DAC write buffer with the given 8-bit values for both channels */
+    void dac(uint8_t swx, uint8_t swy, uint8_t v0, uint8_t v1)
+    {
+        const uint8_t buf[6] = {
+            0, (uint8_t)(v0 >> 6), (uint8_t)(v0 << 2),
+            0, (uint8_t)(v1 >> 6), (uint8_t)(v1 << 2)
+        };
+        log_dac(swx, swy, buf);
+    }
+
+    terminal term;
+};
+
+TEST_F(cli_log, first_draw_includes_labels)
+{
+    dac(1, 0, 160, 0);
+    std::string s = sent();
+    EXPECT_THAT(s, HasSubstr("DAC0: "));
+    EXPECT_THAT(s, HasSubstr("160"));
+    EXPECT_THAT(s, HasSubstr("DAC1: "));
+    EXPECT_THAT(s, HasSubstr("--"));
+}
+
+TEST_F(cli_log, unchanged_fields_send_nothing)
+{
+    dac(1, 1, 160, 20);
+    sent();
+    dac(1, 1, 160, 20);
+    EXPECT_THAT(sent(), StrEq(""));
+}
+
+TEST_F(cli_log, only_changed_fields_are_sent)
+{
+    dac(1, 1, 160, 20);
+    sent();
+    dac(1, 1, 161, 20);
+    std::string s = sent();
+    EXPECT_THAT(s, HasSubstr("161"));
+    EXPECT_THAT(s, Not(HasSubstr("DAC")));
+    EXPECT_THAT(s, Not(HasSubstr("20")));
+}
+
+TEST_F(cli_log, new_prompt_redraws_labels)
+{
+    dac(0, 0, 0, 0);
+    sent();
+    cli_putc(0x03);
+    sent();
+    dac(0, 0, 0, 0);
+    EXPECT_THAT(sent(), HasSubstr("DAC1: "));
+}
+
+class cli_machine : public Test
+{
+public:
+    void SetUp() override
+    {
+        type("mode machine\r");
+        sent();
+    }
+
+    void TearDown() override
+    {
+        type("mode human\r");
+        log_category = 0;
+        sent();
+    }
+
+    void type(const char* s)
+    {
+        while (*s)
+            cli_putc(*s++);
+    }
+
+    std::string sent()
+    {
+        while (PIE1bits.TX1IE)  /* Like drain_tx() in main.c */
+            uart_tx_isr();
+        return term.take();
+    }
+
+    terminal term;
+};
+
+TEST_F(cli_machine, no_echo_or_escape_sequences)
+{
+    type("help\r");
+    std::string s = sent();
+    EXPECT_THAT(s, StartsWith("\r\nAvailable Commands"));
+    EXPECT_THAT(s, Not(HasSubstr("\x1b")));
+    EXPECT_THAT(s, EndsWith("\r\nOK\r\n"));
+}
+
+TEST_F(cli_machine, errors_end_with_err)
+{
+    type("foo\r");
+    EXPECT_THAT(sent(), StrEq("\r\nError: Unknown command\r\nERR\r\n"));
+}
+
+TEST_F(cli_machine, empty_line_sends_nothing)
+{
+    type("\r");
+    EXPECT_THAT(sent(), StrEq(""));
+}
+
+TEST_F(cli_machine, stray_stx_is_dropped_after_a_timeout)
+{
+    TMR1 = 1000;
+    type("\x02h");
+    TMR1 = 1000 + BIN_TIMEOUT_US - 1;
+    cli_poll();
+    EXPECT_THAT(cli_putc, Eq(&cli_putc_binary));
+
+    TMR1 = 1000 + BIN_TIMEOUT_US;
+    cli_poll();
+    type("foo\r");
+    EXPECT_THAT(sent(), StrEq("\r\nError: Unknown command\r\nERR\r\n"));
+}
+
+TEST_F(cli_machine, binary_read_with_flow_control_has_no_xoff_in_the_frame)
+{
+    const char req[] = {BIN_STX, BIN_OP_READ, 0, 16};
+    uint8_t crc = 0;
+    uart_set_flow_control(1);
+    for (char c : req)
+        cli_putc(c);
+    for (size_t i = 1; i != sizeof(req); ++i)
+        crc = bin_crc8(crc, (uint8_t)req[i]);
+    cli_putc((char)crc);
+
+    /* The host keeps sending while the response is queued */
+    for (unsigned i = 0; i != UART_RX_XOFF_LEVEL; ++i)
+    {
+        RC1REG = 'a';
+        uart_rx_isr();
+    }
+    std::string s = sent();
+    ASSERT_THAT(s.size(), Eq(4u + 16u));
+    EXPECT_THAT(s[0], Eq(BIN_STX));
+    EXPECT_THAT(s, Not(HasSubstr("\x13")));
+
+    /* Flow control is back once the frame is out */
+    RC1REG = 'a';
+    uart_rx_isr();
+    EXPECT_THAT(sent(), StrEq("\x13"));
+
+    rb_rx_init();
+    uart_set_flow_control(0);
+    EXPECT_THAT(sent(), StrEq("\x11"));
+}
+
+TEST_F(cli_machine, log_fields_are_lines)
+{
+    const uint8_t buf[6] = {0, 2, 128, 0, 0, 0};  /* DAC0 = 160 */
+    log_category = LOG_DAC_MASK;
+    log_dac(1, 0, buf);
+    EXPECT_THAT(sent(), StrEq("\r\nDAC_0=160\r\nDAC_1=--"));
+    log_dac(1, 0, buf);
+    EXPECT_THAT(sent(), StrEq(""));
+}
+
+TEST_F(cli_machine, boot_times_are_listed)
+{
+    _boot_times[BOOT_CONTROL] = 913;
+    _boot_times[BOOT_SAMPLE] = 1041;
+    _boot_times[BOOT_CLI] = 1187;
+    type("boot\r");
+    EXPECT_THAT(sent(), StrEq("\r\nControl: 913 us\r\nSample: 1041 us\r\nCLI: 1187 us\r\nOK\r\n"));
+    memset(_boot_times, 0, sizeof(_boot_times));
+}
+
 #endif
@@ -0,0 +1,241 @@
+#include "anglemod/clk.h"
+#include "anglemod/uart.h"
+#include <xc.h>
+
+#define UART_BAUD 38400ul
+
+uint8_t _clk_busy = 0;
+
+/* RSTOSC starts HFINTOSC at 32 MHz */
+enum clk_mode _clk_mode = CLK_BOOST;
+
+static const uint8_t oscfrq_table[CLK_MODE_COUNT] = {
+#define X(name, hz, oscfrq, t1con) oscfrq,
+    CLK_LIST
+#undef X
+};
+
+static const uint8_t t1con_table[CLK_MODE_COUNT] = {
+#define X(name, hz, oscfrq, t1con) t1con,
+    CLK_LIST
+#undef X
+};
+
+static const uint8_t sp1brg_table[CLK_MODE_COUNT] = {
+#define X(name, hz, oscfrq, t1con) (uint8_t)((hz) / (4 * UART_BAUD) - 1),
+    CLK_LIST
+#undef X
+};
+
+/* -------------------------------------------------------------------------- */
+static void switch_to(enum clk_mode new_mode)
+{
+    uint8_t gie = INTCONbits.GIE;
+
+    /* A byte that is shifting out would change its bit rate halfway, and
+     * with interrupts on the TX ISR could start the next one */
+    INTCONbits.GIE = 0;
+    while (!TX1STAbits.TRMT) {}
+
+    OSCFRQ = oscfrq_table[new_mode];
+    SP1BRG = sp1brg_table[new_mode];
+    T1CON = t1con_table[new_mode];
+    while (!OSCSTATbits.HFOR) {}
+
+    _clk_mode = new_mode;
+    INTCONbits.GIE = gie;
+}
+
+/* -------------------------------------------------------------------------- */
+void clk_init(void)
+{
+    /* Nothing was received yet, so there's no need to wait for the line */
+    _clk_busy = 0;
+    switch_to(CLK_IDLE);
+}
+
+/* -------------------------------------------------------------------------- */
+void clk_set_busy(uint8_t busy)
+{
+    _clk_busy = busy;
+    clk_poll();
+}
+
+/* -------------------------------------------------------------------------- */
+void clk_poll(void)
+{
+    enum clk_mode new_mode = _clk_busy ? CLK_BOOST : CLK_IDLE;
+    if (new_mode == _clk_mode)
+        return;
+
+    /* The DACs and TMR2 can't wait for the line, even if a byte that is
+     * being received gets garbled */
+    if ((_clk_busy & CLK_OVERRIDE) || uart_quiet())
+        switch_to(new_mode);
+}
+
+/* -------------------------------------------------------------------------- */
+enum clk_mode clk_active_mode(void)
+{
+    return _clk_mode;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t clk_sp1brg(void)
+{
+    return sp1brg_table[_clk_mode];
+}
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <sim.h>
+
+using namespace testing;
+
+static const uint32_t hz_table[CLK_MODE_COUNT] = {
+#define X(name, hz, oscfrq, t1con) hz,
+    CLK_LIST
+#undef X
+};
+
+class clk : public Test
+{
+public:
+    void SetUp() override
+    {
+        sim_tx_done_ns = 0;
+        sim_rx_idle_ns = 0;
+        TMR1 = 0;
+        uart_init();
+        clk_init();
+    }
+
+    void TearDown() override
+    {
+        sim_tx_done_ns = 0;
+        sim_rx_idle_ns = 0;
+        clk_init();
+    }
+};
+
+TEST_F(clk, baud_rate_is_the_same_in_every_mode)
+{
+    for (int m = 0; m != CLK_MODE_COUNT; ++m)
+    {
+        double baud = hz_table[m] / (4.0 * (sp1brg_table[m] + 1));
+        EXPECT_THAT(baud, DoubleNear(38400, 38400 * 0.002)) << "mode " << m;
+    }
+}
+
+TEST_F(clk, tmr1_counts_us_in_every_mode)
+{
+    for (int m = 0; m != CLK_MODE_COUNT; ++m)
+        EXPECT_THAT(hz_table[m] / 4 >> ((t1con_table[m] >> 4) & 0x03), Eq(1000000u)) << "mode " << m;
+}
+
+TEST_F(clk, init_drops_to_idle)
+{
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+    EXPECT_THAT(OSCFRQ, Eq(0x02));
+    EXPECT_THAT(SP1BRG, Eq(25));
+    EXPECT_THAT(T1CON, Eq(0x03));
+    EXPECT_THAT(sim_fosc_hz, Eq(4000000u));
+}
+
+TEST_F(clk, boosted_while_any_reason_is_set)
+{
+    clk_boost(CLK_UART);
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    EXPECT_THAT(SP1BRG, Eq(207));
+    EXPECT_THAT(T1CON, Eq(0x33));
+    EXPECT_THAT(sim_fosc_hz, Eq(32000000u));
+
+    sim_counts_reset();
+    clk_boost(CLK_OVERRIDE);
+    clk_release(CLK_UART);
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    EXPECT_THAT(sim_sfr_writes[SFR_OSCFRQ], Eq(0u));
+
+    clk_release(CLK_OVERRIDE);
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+    EXPECT_THAT(sim_sfr_writes[SFR_OSCFRQ], Eq(1u));
+}
+
+TEST_F(clk, waits_for_the_last_byte_to_be_sent)
+{
+    sim_tx_done_ns = sim_time_ns + 100000;
+    clk_boost(CLK_OVERRIDE);
+    EXPECT_THAT(sim_time_ns, Ge(sim_tx_done_ns + sim_clk_switch_ns));
+    clk_release(CLK_OVERRIDE);
+}
+
+TEST_F(clk, override_doesnt_wait_for_the_line)
+{
+    sim_rx_idle_ns = sim_time_ns + 100000;
+    clk_boost(CLK_OVERRIDE);
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    EXPECT_THAT(sim_time_ns, Lt(sim_rx_idle_ns));
+
+    sim_time_advance_to(sim_rx_idle_ns);
+    clk_release(CLK_OVERRIDE);
+}
+
+TEST_F(clk, interrupts_are_off_while_switching)
+{
+    struct gie_watch : sim_device
+    {
+        int writes_with_gie = 0;
+        void sfr_written(enum sfr_id reg, uint8_t, uint8_t) override
+        {
+            if (reg == SFR_OSCFRQ && INTCONbits.GIE)
+                writes_with_gie++;
+        }
+    } watch;
+    INTCONbits.GIE = 1;
+    sim_attach(&watch);
+    clk_boost(CLK_UART);
+    clk_release(CLK_UART);
+    sim_detach(&watch);
+
+    EXPECT_THAT(sim_sfr_writes[SFR_OSCFRQ], Ge(2u));
+    EXPECT_THAT(watch.writes_with_gie, Eq(0));
+    EXPECT_THAT(INTCONbits.GIE, Eq(1u));
+    INTCONbits.GIE = 0;
+}
+
+TEST_F(clk, doesnt_switch_while_receiving)
+{
+    sim_rx_idle_ns = sim_time_ns + 100000;
+    clk_boost(CLK_UART);
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+    EXPECT_THAT(sim_time_ns, Lt(sim_rx_idle_ns));
+
+    sim_time_advance_to(sim_rx_idle_ns);
+    clk_poll();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    clk_release(CLK_UART);
+}
+
+TEST_F(clk, waits_a_byte_time_for_the_next_byte)
+{
+    char c;
+    ASSERT_THAT(rb_rx_put_single_value('a'), Ne(0));
+    TMR1 = 1000;
+    ASSERT_THAT(uart_getc(&c), Eq(1));
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+
+    TMR1 = 1200;
+    clk_poll();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+
+    TMR1 = 1300;
+    clk_poll();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+}
+
+#endif
@@ -1,10 +1,41 @@
 #include "anglemod/config.h"
 #include "anglemod/seq.h"
+#include "anglemod/host.h"
 #include <xc.h>
+#include <string.h>
 
 #define MAGIC 0xAA
 
-static struct config config;
+/*
+ * SAF spans 128 words from 0x1F80 - 0x1FFF, where 1 row consists of 32 14-bit
+ * program memory words. Only the low byte of each word is used.
+ *
+ *   0x1F80-0x1FBF  Profile area: Header byte (PROFILE_MAGIC | active profile),
+ *                  the name of each profile, then the runs of bytes in which
+ *                  profiles 1, 2, ... differ from profile 0. Each run starts
+ *                  with a byte containing (length-1) << 6 | offset, followed
+ *                  by the bytes. The runs of a profile end with RUN_END.
+ *   0x1FC0-0x1FFF  Profile 0, stored as a full copy of the config structure.
+ *                  This is the same layout older firmware used.
+ *
+ * The pattern area at 0x1F00-0x1F7F is ordinary program memory, but is laid
+ * out the same way.
+ */
+#define PROFILE_MAGIC     0xA0
+#define PROFILE_AREA_SIZE 64
+#define RUN_MAX_LEN       4
+#define RUN_END           0xFF
+
+/* The pattern area (see config.h) shares the high address byte with SAF */
+#define PATTERN_AREA_ADDR_L 0x00
+
+#if defined(__cplusplus)
+static_assert(sizeof(struct config) == CONFIG_NVM_SIZE, "Profiles are saved as CONFIG_NVM_SIZE bytes");
+#endif
+
+static HOST_LOCAL struct config profiles[CONFIG_PROFILE_COUNT];
+static HOST_LOCAL char profile_names[CONFIG_PROFILE_COUNT][CONFIG_PROFILE_NAME_LEN + 1];
+static HOST_LOCAL struct config* active = &profiles[0];
 
 static const struct config default_config =
 #if !defined(CLI_SIM) && !defined(GTEST_TESTING)
@@ -14,7 +45,8 @@ static const struct config default_config =
         .cardinal_angles = 0xFF,
         .diagonal_angles = 0xFF,
         .special_angles = 0x1F,
-        .normal_mode = NORMAL_MODE_CLAMP
+        .normal_mode = NORMAL_MODE_CLAMP,
+        .btn_lockout = 10
     },
     .joy = {
         .xythreshold = 42,
@@ -30,6 +62,11 @@ static const struct config default_config =
 #define X(name, mirrx, mirry, str, initx, inity) {initx, inity},
         SEQ_LIST
 #undef X
+    },
+    .calib = {  /* None, values pass through */
+        .center = {0, 0},
+        .min = {0, 0},
+        .max = {0, 0}
     }
 };
 #else
@@ -39,50 +76,168 @@ static const struct config default_config =
 /* -------------------------------------------------------------------------- */
 void config_set_defaults(void)
 {
-    config = default_config;
+    /* Calibration belongs to the stick, keep it */
+    uint8_t calib[sizeof(active->calib)];
+    memcpy(calib, &active->calib, sizeof(calib));
+    *active = default_config;
+    memcpy(&active->calib, calib, sizeof(calib));
 }
 
 /* -------------------------------------------------------------------------- */
 struct config* config_get(void)
 {
-    return &config;
+    return active;
 }
 
 /* -------------------------------------------------------------------------- */
-void config_load_from_nvm(void)
+struct config* config_get_profile(uint8_t idx)
 {
-    uint8_t* data_start = (uint8_t*)&config;
-    uint8_t* data_end = (uint8_t*)&config + sizeof(config);
-
-    /* 
-     * Config structure is 58 bytes -> need 2 rows in SAF to store it.
-     * 
-     * SAF spans 128 words from 0x1F80 - 0x1FFF, where 1 row consists of 32 14-bit
-     * program memory words.
-     * First row is  0x1FC0-0x1FDF
-     * Second row is 0x1FE0-0x1FFF
-     */
-    
-    NVMCON1 = 0;  /* Point to PFM (instead of config) */
+    return &profiles[idx];
+}
+
+/* -------------------------------------------------------------------------- */
+void config_select_profile(uint8_t idx)
+{
+    active = &profiles[idx];
+}
 
-    uint8_t saf_addr_l = 0xC0;  /* Begin reading at 0x1FC0 */
-    while (data_start != data_end)
+/* -------------------------------------------------------------------------- */
+uint8_t config_active_profile(void)
+{
+    return (uint8_t)(active - profiles);
+}
+
+/* -------------------------------------------------------------------------- */
+char* config_profile_name(uint8_t idx)
+{
+    return profile_names[idx];
+}
+
+/* -------------------------------------------------------------------------- */
+static void read_saf(uint8_t saf_addr_l, uint8_t* data, uint8_t len)
+{
+    NVMCON1 = 0;              /* Point to PFM (instead of config) */
+    NVMADRH = 0x1F;           /* Address of word to read (high byte) */
+
+    while (len--)
     {
-        NVMADRH = 0x1F;           /* Address of word to read (high byte) */
         NVMADRL = saf_addr_l;     /* Address of word to read (low byte) */
         NVMCON1bits.RD = 1;       /* Initiate read cycle */
-        *data_start = NVMDATL;
-        
-        data_start++;
+        *data++ = NVMDATL;
         saf_addr_l++;
     }
-    
-    /* See if the data we read makes any sense. If not, load the struct with
-     * default values */
-    if (config.magic != MAGIC)
-        config_set_defaults();
 }
 
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Encodes the names and the differences of all profiles to profile 0
+ * into the layout of the profile area.
+ * @return Returns 0 if the differences don't fit.
+ */
+static uint8_t encode_profiles(uint8_t* buf)
+{
+    const uint8_t* end = buf + PROFILE_AREA_SIZE;
+    const uint8_t* base = (const uint8_t*)&profiles[0];
+    uint8_t p, i, n;
+
+    memset(buf, 0xFF, PROFILE_AREA_SIZE);
+    *buf++ = PROFILE_MAGIC | config_active_profile();
+    for (p = 0; p != CONFIG_PROFILE_COUNT; ++p)
+        for (i = 0; i != CONFIG_PROFILE_NAME_LEN; ++i)
+            *buf++ = (uint8_t)profile_names[p][i];
+
+    for (p = 1; p != CONFIG_PROFILE_COUNT; ++p)
+    {
+        const uint8_t* data = (const uint8_t*)&profiles[p];
+        for (i = 0; i != CONFIG_NVM_SIZE; i += n)
+        {
+            uint8_t len = 0;
+            if (data[i] == base[i])
+            {
+                n = 1;
+                continue;
+            }
+
+            /* Run ends on the last differing byte within reach */
+            for (n = 0; n != RUN_MAX_LEN && i + n != CONFIG_NVM_SIZE; ++n)
+                if (data[i + n] != base[i + n])
+                    len = n + 1;
+
+            if (end - buf < len + 1)
+                return 0;
+            *buf++ = (uint8_t)((len - 1) << 6) | i;
+            for (n = 0; n != len; ++n)
+                *buf++ = data[i + n];
+        }
+
+        if (buf == end)
+            return 0;
+        *buf++ = RUN_END;
+    }
+
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Rebuilds profiles 1, 2, ... from profile 0 and the profile area. If
+ * the area is erased or corrupt, they all become copies of profile 0.
+ */
+static void decode_profiles(const uint8_t* buf)
+{
+    const uint8_t* end = buf + PROFILE_AREA_SIZE;
+    uint8_t p, i;
+
+    for (p = 1; p != CONFIG_PROFILE_COUNT; ++p)
+        profiles[p] = profiles[0];
+    memset(profile_names, 0, sizeof(profile_names));
+    active = &profiles[0];
+
+    if ((*buf & 0xF0) != PROFILE_MAGIC || (*buf & 0x0F) >= CONFIG_PROFILE_COUNT)
+        return;
+    active = &profiles[*buf++ & 0x0F];
+
+    for (p = 0; p != CONFIG_PROFILE_COUNT; ++p)
+        for (i = 0; i != CONFIG_PROFILE_NAME_LEN; ++i, ++buf)
+            profile_names[p][i] = (*buf >= ' ' && *buf <= '~') ? (char)*buf : '\0';
+
+    for (p = 1; p != CONFIG_PROFILE_COUNT; ++p)
+    {
+        uint8_t* data = (uint8_t*)&profiles[p];
+        while (buf != end && *buf != RUN_END)
+        {
+            uint8_t offset = *buf & 0x3F;
+            uint8_t len = (uint8_t)(*buf++ >> 6) + 1;
+            if (offset + len > CONFIG_NVM_SIZE || end - buf < len)
+                return;  /* Corrupt */
+            while (len--)
+                data[offset++] = *buf++;
+        }
+        if (buf != end)
+            buf++;  /* Skip RUN_END */
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+void config_load_from_nvm(void)
+{
+    uint8_t profile_area[PROFILE_AREA_SIZE];
+
+    read_saf(0xC0, (uint8_t*)&profiles[0], CONFIG_NVM_SIZE);
+
+    /* See if the data we read makes any sense. If not, load the struct with
+     * default values and ignore the other profiles, which saves reading them
+     * on a fresh chip */
+    if (profiles[0].magic != MAGIC)
+    {
+        profiles[0] = default_config;
+        profile_area[0] = 0xFF;
+    }
+    else
+        read_saf(0x80, profile_area, PROFILE_AREA_SIZE);
+
+    decode_profiles(profile_area);
+}
 /* -------------------------------------------------------------------------- */
 static void write_byte(uint8_t saf_addr_l, uint8_t byte)
 {
@@ -97,12 +252,14 @@ static void write_byte(uint8_t saf_addr_l, uint8_t byte)
 }
 
 /* -------------------------------------------------------------------------- */
-static void write_row(uint8_t saf_addr_l, const uint8_t* data)
+/* Loads len write latches and writes them to the row. Latches that aren't
+ * loaded stay erased and leave their words unchanged */
+static void write_row(uint8_t saf_addr_l, const uint8_t* data, uint8_t len)
 {
-    for (uint8_t i = 0; i != 32; ++i)
+    for (uint8_t i = 0; i != len; ++i)
     {
-        /* Last word in row? */
-        if (i == 31)
+        /* Last word? */
+        if (i == len - 1)
             NVMCON1bits.LWLO = 0;  /* Next write command will write to PFM */
 
         write_byte(saf_addr_l++, *data++);
@@ -110,38 +267,352 @@ static void write_row(uint8_t saf_addr_l, const uint8_t* data)
 }
 
 /* -------------------------------------------------------------------------- */
-uint8_t config_save_to_nvm(void)
+enum config_save_result config_save_to_nvm(void)
 {
+    uint8_t profile_area[PROFILE_AREA_SIZE];
+    uint8_t saf_addr_l;
     uint8_t success;
-    
-    /*
-     * Config structure is 58 bytes -> need 2 rows in SAF to store it.
-     *
-     * SAF spans 128 words from 0x1F80 - 0x1FFF, where 1 row consists of 32 14-bit
-     * program memory words.
-     * First row is  0x1FC0-0x1FDF
-     * Second row is 0x1FE0-0x1FFF
-     */
+
+    if (!encode_profiles(profile_area))
+        return CONFIG_SAVE_TOO_MANY_CHANGES;
     
     INTCONbits.GIE = 0;  /* Disable interrupts */
     
-    /* Erase 64 bytes in SAF from 0x1FC0-0x1FFF */
-    NVMCON1 = 0x14;  /* NVMREGS=0 (PFM), LWLO=0, FREE=1, WREN=1 */
-    write_byte(0xC0, 0);   /* Erase 0x1FC0-0x1FDF */
-    NVMCON1 = 0x14;  /* NVMREGS=0 (PFM), LWLO=0, FREE=1, WREN=1 */
-    write_byte(0xE0, 0);   /* Erase 0x1FE0-0x1FFF */
-
-    /* Write config structure */
-    const uint8_t* data = (uint8_t*)&config;
+    /* Erase all 4 rows of SAF from 0x1F80-0x1FFF */
+    for (saf_addr_l = 0x80; saf_addr_l; saf_addr_l += 0x20)
+    {
+        NVMCON1 = 0x14;  /* NVMREGS=0 (PFM), LWLO=0, FREE=1, WREN=1 */
+        write_byte(saf_addr_l, 0);
+    }
+
+    /* Write profile area */
+    NVMCON1 = 0x24;  /* NVMREGS=0 (PFM), LWLO=1, FREE=0, WREN=1 */
+    write_row(0x80, profile_area, 32);
     NVMCON1 = 0x24;  /* NVMREGS=0 (PFM), LWLO=1, FREE=0, WREN=1 */
-    write_row(0xC0, data);
+    write_row(0xA0, profile_area + 32, 32);
+
+    /* Write profile 0 */
+    const uint8_t* data = (uint8_t*)&profiles[0];
     NVMCON1 = 0x24;  /* NVMREGS=0 (PFM), LWLO=1, FREE=0, WREN=1 */
-    write_row(0xE0, data + 32);
+    write_row(0xC0, data, 32);
+    NVMCON1 = 0x24;  /* NVMREGS=0 (PFM), LWLO=1, FREE=0, WREN=1 */
+    write_row(0xE0, data + 32, 32);
     
     success = !NVMCON1bits.WRERR;
     
     NVMCON1 = 0;           /* Disable writes */
     INTCONbits.GIE = 1;    /* Enable interrupts */
     
+    return success ? CONFIG_SAVE_OK : CONFIG_SAVE_WRITE_ERROR;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t config_read_pattern_area(uint8_t offset)
+{
+    uint8_t byte;
+    read_saf(PATTERN_AREA_ADDR_L + offset, &byte, 1);
+    return byte;
+}
+
+/* -------------------------------------------------------------------------- */
+static uint8_t write_pattern_area(uint8_t offset, const uint8_t* data, uint8_t len, uint8_t erase)
+{
+    uint8_t saf_addr_l = PATTERN_AREA_ADDR_L + offset;
+    uint8_t success;
+
+    INTCONbits.GIE = 0;  /* Disable interrupts */
+
+    if (erase && !(saf_addr_l & 0x1F))
+    {
+        NVMCON1 = 0x14;  /* NVMREGS=0 (PFM), LWLO=0, FREE=1, WREN=1 */
+        write_byte(saf_addr_l, 0);
+    }
+
+    NVMCON1 = 0x24;  /* NVMREGS=0 (PFM), LWLO=1, FREE=0, WREN=1 */
+    write_row(saf_addr_l, data, len);
+
+    success = !NVMCON1bits.WRERR;
+
+    NVMCON1 = 0;           /* Disable writes */
+    INTCONbits.GIE = 1;    /* Enable interrupts */
+
     return success;
 }
+uint8_t config_write_pattern_area(uint8_t offset, const uint8_t* data, uint8_t len)
+{
+    return write_pattern_area(offset, data, len, 1);
+}
+uint8_t config_program_pattern_byte(uint8_t offset, uint8_t byte)
+{
+    return write_pattern_area(offset, &byte, 1, 0);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <nvm.h>
+#include <sim.h>
+
+using namespace testing;
+
+class config_profiles : public Test
+{
+public:
+    void SetUp() override
+    {
+        uint8_t erased[PROFILE_AREA_SIZE];
+        memset(erased, 0xFF, sizeof(erased));
+        memset(&profiles[0], 0, sizeof(struct config));
+        profiles[0].magic = MAGIC;
+        decode_profiles(erased);
+    }
+
+    void TearDown() override
+    {
+        config_select_profile(0);
+        config_set_defaults();
+    }
+
+    /* Encodes and decodes all profiles, as if saving and loading */
+    void round_trip()
+    {
+        uint8_t area[PROFILE_AREA_SIZE];
+        ASSERT_THAT(encode_profiles(area), Eq(1));
+        memset(&profiles[1], 0x55, sizeof(struct config) * (CONFIG_PROFILE_COUNT - 1));
+        decode_profiles(area);
+    }
+};
+
+TEST_F(config_profiles, erased_area_copies_profile_0)
+{
+    EXPECT_THAT(config_active_profile(), Eq(0));
+    EXPECT_THAT(memcmp(&profiles[1], &profiles[0], sizeof(struct config)), Eq(0));
+    EXPECT_THAT(memcmp(&profiles[2], &profiles[0], sizeof(struct config)), Eq(0));
+    EXPECT_THAT(config_profile_name(1), StrEq(""));
+}
+
+TEST_F(config_profiles, select_swaps_active_config)
+{
+    profiles[2].joy.xythreshold = 77;
+    config_select_profile(2);
+    EXPECT_THAT(config_get(), Eq(&profiles[2]));
+    EXPECT_THAT(config_get()->joy.xythreshold, Eq(77));
+}
+
+TEST_F(config_profiles, differences_and_names_survive_round_trip)
+{
+    strcpy(config_profile_name(0), "main");
+    strcpy(config_profile_name(2), "ice");
+    profiles[1].joy.hysteresis = 20;
+    profiles[1].angles[23].xy[1] = 99;
+    profiles[2].dac_clamp.xy[0] = 50;
+    profiles[2].dac_clamp.xy[1] = 51;
+    profiles[2].angles[0].xy[0] = 3;
+    config_select_profile(1);
+
+    round_trip();
+
+    EXPECT_THAT(config_active_profile(), Eq(1));
+    EXPECT_THAT(config_profile_name(0), StrEq("main"));
+    EXPECT_THAT(config_profile_name(1), StrEq(""));
+    EXPECT_THAT(config_profile_name(2), StrEq("ice"));
+    EXPECT_THAT(profiles[1].joy.hysteresis, Eq(20));
+    EXPECT_THAT(profiles[1].angles[23].xy[1], Eq(99));
+    EXPECT_THAT(profiles[1].dac_clamp.xy[0], Eq(0));
+    EXPECT_THAT(profiles[2].dac_clamp.xy[0], Eq(50));
+    EXPECT_THAT(profiles[2].dac_clamp.xy[1], Eq(51));
+    EXPECT_THAT(profiles[2].angles[0].xy[0], Eq(3));
+    EXPECT_THAT(profiles[2].joy.hysteresis, Eq(0));
+}
+
+TEST_F(config_profiles, every_byte_of_one_profile_can_differ)
+{
+    /* 64 bytes need 16 runs of 4 -> 80 bytes, too much. Half of them fit. */
+    uint8_t area[PROFILE_AREA_SIZE];
+    uint8_t* data = (uint8_t*)&profiles[1];
+    for (uint8_t i = 1; i != CONFIG_NVM_SIZE; ++i)
+        data[i] = i;
+    EXPECT_THAT(encode_profiles(area), Eq(0));
+
+    memcpy(&profiles[1], &profiles[0], sizeof(struct config));
+    for (uint8_t i = 1; i != 30; ++i)
+        data[i] = i;
+    round_trip();
+    for (uint8_t i = 1; i != 30; ++i)
+        EXPECT_THAT(data[i], Eq(i));
+    EXPECT_THAT(memcmp(data + 30, (uint8_t*)&profiles[0] + 30, CONFIG_NVM_SIZE - 30), Eq(0));
+}
+
+/* Saving and loading through the flash model */
+#define SAF_ROW 0xFC  /* 0x1F80 / 32 */
+#define SAVE_BUSY_NS (4 * (uint64_t)(SIM_NVM_ERASE_NS + SIM_NVM_WRITE_NS))
+
+class config_nvm : public config_profiles
+{
+public:
+    void SetUp() override
+    {
+        config_profiles::SetUp();
+        INTCON = 0xC0;
+    }
+
+    nvm flash;
+};
+
+TEST_F(config_nvm, save_then_load_restores_profiles)
+{
+    strcpy(config_profile_name(2), "ice");
+    profiles[0].joy.xythreshold = 42;
+    profiles[2].dac_clamp.xy[0] = 50;
+    config_select_profile(2);
+    ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+    EXPECT_THAT(flash.word(0x1FC0), Eq(MAGIC));
+
+    memset(profiles, 0x55, sizeof(profiles));
+    config_select_profile(0);
+    config_load_from_nvm();
+
+    EXPECT_THAT(config_active_profile(), Eq(2));
+    EXPECT_THAT(config_profile_name(2), StrEq("ice"));
+    EXPECT_THAT(profiles[0].magic, Eq(MAGIC));
+    EXPECT_THAT(profiles[0].joy.xythreshold, Eq(42));
+    EXPECT_THAT(profiles[1].dac_clamp.xy[0], Eq(0));
+    EXPECT_THAT(profiles[2].dac_clamp.xy[0], Eq(50));
+}
+
+TEST_F(config_nvm, last_bytes_of_every_profile_are_saved)
+{
+    profiles[0].calib.max[1] = 200;
+    profiles[2].calib.min[1] = 10;
+    profiles[2].calib.max[0] = 220;
+    profiles[2].calib.max[1] = 230;
+    ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+    EXPECT_THAT(flash.word(0x1FFF), Eq(200));
+
+    memset(profiles, 0x55, sizeof(profiles));
+    config_load_from_nvm();
+
+    EXPECT_THAT(profiles[0].calib.max[1], Eq(200));
+    EXPECT_THAT(profiles[1].calib.max[1], Eq(0));
+    EXPECT_THAT(profiles[2].calib.min[1], Eq(10));
+    EXPECT_THAT(profiles[2].calib.max[0], Eq(220));
+    EXPECT_THAT(profiles[2].calib.max[1], Eq(230));
+}
+
+TEST_F(config_nvm, load_stays_in_saf)
+{
+    ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+
+    sim_counts_reset();
+    config_load_from_nvm();
+    EXPECT_THAT(sim_sfr_reads[SFR_NVMDATL], Le(CONFIG_NVM_SIZE + PROFILE_AREA_SIZE));
+    EXPECT_THAT(profiles[0].magic, Eq(MAGIC));
+}
+
+TEST_F(config_nvm, save_erases_and_writes_each_saf_row_once)
+{
+    ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+    for (uint16_t row = 0; row != NVM_ROWS; ++row)
+    {
+        unsigned expected = row >= SAF_ROW ? 1 : 0;
+        EXPECT_THAT(flash.erases(row), Eq(expected)) << "row " << row;
+        EXPECT_THAT(flash.writes(row), Eq(expected)) << "row " << row;
+    }
+    EXPECT_THAT(flash.unlock_errors(), Eq(0u));
+    EXPECT_THAT(flash.unerased_writes(), Eq(0u));
+    EXPECT_THAT(flash.busy_ns(), Eq(SAVE_BUSY_NS));
+}
+
+TEST_F(config_nvm, interrupts_are_off_for_the_whole_save)
+{
+    uint64_t start = sim_time_ns;
+    ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+    EXPECT_THAT(INTCONbits.GIE, Eq(1u));
+    EXPECT_THAT(flash.max_gie_off_ns(), Ge(SAVE_BUSY_NS));
+    EXPECT_THAT(flash.max_gie_off_ns(), Le(sim_time_ns - start));
+}
+
+TEST_F(config_nvm, load_doesnt_wear_or_stall)
+{
+    config_load_from_nvm();
+    EXPECT_THAT(flash.max_erases(), Eq(0u));
+    EXPECT_THAT(flash.busy_ns(), Eq(0u));
+}
+
+TEST_F(config_nvm, write_without_unlock_sequence_is_ignored)
+{
+    flash.set_word(0x1F80, 0x12);
+    NVMCON1 = 0x14;
+    NVMADRH = 0x1F;
+    NVMADRL = 0x80;
+    NVMCON2 = 0x55;
+    NVMDATL = 0;  /* Breaks the sequence */
+    NVMCON2 = 0xAA;
+    NVMCON1bits.WR = 1;
+
+    EXPECT_THAT(NVMCON1bits.WR, Eq(0u));
+    EXPECT_THAT(flash.unlock_errors(), Eq(1u));
+    EXPECT_THAT(flash.erases(SAF_ROW), Eq(0u));
+    EXPECT_THAT(flash.word(0x1F80), Eq(0x12));
+    NVMCON1 = 0;
+}
+
+TEST_F(config_nvm, wear_after_a_thousand_saves)
+{
+    for (int i = 0; i != 1000; ++i)
+    {
+        profiles[1].joy.hysteresis = (uint8_t)i;
+        ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+    }
+    EXPECT_THAT(flash.max_erases(), Eq(1000u));
+    EXPECT_THAT(flash.erases(SAF_ROW - 1), Eq(0u));
+    EXPECT_THAT(flash.busy_ns(), Eq(1000 * SAVE_BUSY_NS));
+
+    profiles[1].joy.hysteresis = 0;
+    config_load_from_nvm();
+    EXPECT_THAT(profiles[1].joy.hysteresis, Eq(999 & 0xFF));
+}
+
+#define PATTERN_ROW 0xF8  /* 0x1F00 / 32 */
+
+TEST_F(config_nvm, pattern_area_is_written_in_halves_of_a_row)
+{
+    uint8_t first[16], second[16];
+    for (uint8_t i = 0; i != 16; ++i)
+    {
+        first[i] = i;
+        second[i] = (uint8_t)(0x80 | i);
+    }
+    ASSERT_THAT(config_write_pattern_area(32, first, 16), Eq(1));
+    ASSERT_THAT(config_write_pattern_area(48, second, 16), Eq(1));
+
+    EXPECT_THAT(flash.erases(PATTERN_ROW + 1), Eq(1u));
+    EXPECT_THAT(flash.writes(PATTERN_ROW + 1), Eq(2u));
+    EXPECT_THAT(flash.unerased_writes(), Eq(0u));
+    EXPECT_THAT(INTCONbits.GIE, Eq(1u));
+    for (uint8_t i = 0; i != 16; ++i)
+    {
+        EXPECT_THAT(config_read_pattern_area(32 + i), Eq(i));
+        EXPECT_THAT(config_read_pattern_area(48 + i), Eq(0x80 | i));
+    }
+}
+
+TEST_F(config_nvm, pattern_area_leaves_profiles_alone)
+{
+    const uint8_t data[4] = {1, 2, 3, 4};
+    ASSERT_THAT(config_save_to_nvm(), Eq(CONFIG_SAVE_OK));
+    ASSERT_THAT(config_write_pattern_area(96, data, 4), Eq(1));
+
+    EXPECT_THAT(flash.erases(PATTERN_ROW + 3), Eq(1u));
+    for (uint16_t row = SAF_ROW; row != NVM_ROWS; ++row)
+        EXPECT_THAT(flash.erases(row), Eq(1u)) << "row " << row;
+    EXPECT_THAT(flash.word(0x1FC0), Eq(MAGIC));
+    EXPECT_THAT(config_read_pattern_area(99), Eq(4));
+    EXPECT_THAT(config_read_pattern_area(100), Eq(0xFF));
+}
+
+#endif
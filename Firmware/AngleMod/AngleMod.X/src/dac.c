@@ -2,15 +2,17 @@
 #include "anglemod/gpio.h"
 #include "anglemod/config.h"
 #include "anglemod/log.h"
+#include "anglemod/calib.h"
+#include "anglemod/host.h"
 
 #include "anglemod/uart.h"
 
-static uint8_t dac_write_cmd[6] = {
+static HOST_LOCAL uint8_t dac_write_cmd[6] = {
     0x00, 0x00, 0x00, /* DAC0 */
     0x08, 0x00, 0x00  /* DAC1 */
 };
 
-static uint8_t log_counter = 0;
+static HOST_LOCAL uint8_t log_counter = 0;
 
 /* -------------------------------------------------------------------------- */
 void dac_init(void)
@@ -30,6 +32,7 @@ void dac_override_disable(void)
 /* -------------------------------------------------------------------------- */
 static void dac_buf_transfer(void)
 {
+    HOST_COUNT_CALL(dac_buf_transfer);
     uint8_t i = 0;
     
     /* 
@@ -44,7 +47,7 @@ static void dac_buf_transfer(void)
     {    
         SSP1BUF = dac_write_cmd[i]; /* Byte to transfer */
         while (!SSP1STATbits.BF) {}   /* Wait for transmit complete */
-        (void)SSP1BUF;                /* Reading received byte resets BF flag */
+        (void)(uint8_t)SSP1BUF;       /* Reading received byte resets BF flag */
     }
 
     gpio_deselect_dac();
@@ -56,8 +59,18 @@ static void dac_buf_transfer(void)
 }
 
 /* -------------------------------------------------------------------------- */
-void dac_override_clamp(const uint8_t xy[2])
+static void set_dac_code(uint8_t* write_ptr, adc_t value)
 {
+    /* The DACs take a 10-bit code. 8-bit values leave the 2 LSBs at zero */
+    uint16_t code = (uint16_t)value << (10 - ADC_BITS);
+    write_ptr[0] = (uint8_t)(code >> 8);
+    write_ptr[1] = (uint8_t)code;
+}
+
+/* -------------------------------------------------------------------------- */
+void dac_override_clamp(const adc_t xy[2])
+{
+    HOST_COUNT_CALL(dac_override_clamp);
     const struct config* c = config_get();
     
     uint8_t pending_sw = 0;
@@ -66,21 +79,20 @@ void dac_override_clamp(const uint8_t xy[2])
     uint8_t* write_ptr = &dac_write_cmd[1];
     for (uint8_t i = 0; i != 2; ++i, write_ptr += 3)
     {
-        uint8_t dac_value;
+        adc_t dac_value;
 
         uint8_t lower = (uint8_t)(128 - c->dac_clamp.xy[i]);
         uint8_t upper = (uint8_t)(128 + c->dac_clamp.xy[i]);
         
-        if (xy[i] < lower)
-            dac_value = lower;
-        else if (xy[i] > upper)
-            dac_value = upper;
+        if (xy[i] < ADC_SCALE(lower))
+            dac_value = calib_clamp_bound(i, 0);
+        else if (xy[i] > ADC_SCALE(upper))
+            dac_value = calib_clamp_bound(i, 1);
         else
             continue;  /* Skip writing to DAC */
         
         /* Update 10-bit value to transfer to DAC in transmit buffer */
-        write_ptr[0] = dac_value >> 6;
-        write_ptr[1] = (dac_value << 2) & 0xFF;
+        set_dac_code(write_ptr, dac_value);
         pending_sw |= sw_bits[i];  /* Analog switch needs to be enabled after latch */
     }
     
@@ -95,22 +107,22 @@ void dac_override_clamp(const uint8_t xy[2])
     /* Enable/disable analog switches as needed */
     PORTx(SW_PORT) = (PORTx(SW_PORT) & ~(SWX_BIT | SWY_BIT)) | pending_sw;
     
-    /* This routine gets called at about 500 Hz. Try to log at 20 Hz */
+    /* This routine gets called at ADC_HIGH_RATE_PAIR_HZ. Try to log at 20 Hz */
     if (log_counter-- == 0)
     {
         log_dac(pending_sw & SWX_BIT, pending_sw & SWY_BIT, dac_write_cmd);
-        log_counter = 25;
+        log_counter = ADC_HIGH_RATE_PAIR_HZ / 20;
     }
 }
 
 /* -------------------------------------------------------------------------- */
 void dac_override(const uint8_t xy[2])
 {
+    HOST_COUNT_CALL(dac_override);
     uint8_t* write_ptr = &dac_write_cmd[1];
     for (uint8_t i = 0; i != 2; ++i)
     {
-        write_ptr[0] = xy[i] >> 6;
-        write_ptr[1] = (xy[i] << 2) & 0xFF;
+        set_dac_code(write_ptr, calib_unapply(i, ADC_SCALE(xy[i])));
         write_ptr += 3;
     }
 
@@ -118,3 +130,175 @@ void dac_override(const uint8_t xy[2])
     PORTx(SW_PORT) |= (SWX_BIT | SWY_BIT);
     log_dac(1, 1, dac_write_cmd);
 }
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <mcp48.h>
+#include <sim.h>
+
+using namespace testing;
+
+class dac_trace : public Test
+{
+public:
+    void SetUp() override
+    {
+        gpio_init();
+        sim_trace_start();
+    }
+
+    void TearDown() override
+    {
+        sim_trace_stop();
+    }
+
+    /* Recorded writes as "<reg>=<value>" */
+    std::vector<std::string> writes()
+    {
+        size_t count;
+        const struct sim_event* e = sim_trace_events(&count);
+        std::vector<std::string> result;
+        for (size_t i = 0; i != count; ++i)
+        {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%s=%02x", sim_sfr_name((enum sfr_id)e[i].reg), e[i].value);
+            result.push_back(buf);
+        }
+        return result;
+    }
+};
+
+TEST_F(dac_trace, transfer_is_framed_by_ncs_and_latched)
+{
+    const uint8_t xy[2] = {200, 50};
+    dac_override(xy);
+
+    std::vector<std::string> w = writes();
+    ASSERT_THAT(w.size(), Eq(3u + 1u + 6u + 1u + 2u + 1u));
+    EXPECT_THAT(w[3], StrEq("PORTB=00"));     /* nCS low */
+    EXPECT_THAT(w[4], StrEq("SSP1BUF=00"));   /* DAC0 command */
+    EXPECT_THAT(w[7], StrEq("SSP1BUF=08"));   /* DAC1 command */
+    EXPECT_THAT(w[10], StrEq("PORTB=10"));    /* nCS high */
+    EXPECT_THAT(w[11], StrEq("PORTA=00"));    /* nLAT pulse */
+    EXPECT_THAT(w[12], StrEq("PORTA=04"));
+    EXPECT_THAT(w[13], StrEq("PORTC=30"));    /* SWX and SWY on */
+}
+
+TEST_F(dac_trace, vcd_shows_the_latch_pulse_and_bytes)
+{
+    const uint8_t xy[2] = {200, 50};
+    dac_override(xy);
+    FILE* fp = tmpfile();  /* Removed once closed */
+    ASSERT_THAT(fp, NotNull());
+    ASSERT_THAT(sim_trace_write_vcd_to(fp), Ne(0));
+
+    std::string vcd(ftell(fp), '\0');
+    rewind(fp);
+    ASSERT_THAT(fread(&vcd[0], 1, vcd.size(), fp), Eq(vcd.size()));
+    fclose(fp);
+    EXPECT_THAT(vcd, HasSubstr("$var wire 1 ! nLAT $end"));
+    EXPECT_THAT(vcd, HasSubstr("$var wire 8 & SSP1BUF $end"));
+    EXPECT_THAT(vcd, HasSubstr("\n0!\n"));
+    EXPECT_THAT(vcd, HasSubstr("\nb00001000 &\n"));
+    EXPECT_THAT(vcd, HasSubstr("\nbxxxxxxxx &\n"));
+    EXPECT_THAT(vcd, HasSubstr("\n1$\n"));
+}
+
+TEST_F(dac_trace, stops_recording_when_full)
+{
+    size_t count;
+    sim_trace_events(&count);
+    for (size_t i = count; i != SIM_TRACE_MAX_EVENTS + 2; ++i)
+        SSP1BUF = 0x00;
+
+    sim_trace_events(&count);
+    EXPECT_THAT(count, Eq(SIM_TRACE_MAX_EVENTS));
+    EXPECT_THAT(sim_trace_dropped(), Eq(2u));
+
+    sim_trace_start();
+    EXPECT_THAT(sim_trace_dropped(), Eq(0u));
+}
+
+class dac_mcp48 : public Test
+{
+public:
+    void SetUp() override
+    {
+        gpio_init();
+        config_get()->dac_clamp.xy[0] = 41;
+        config_get()->dac_clamp.xy[1] = 41;
+        calib_build_lut();
+    }
+
+    void TearDown() override
+    {
+        config_get()->dac_clamp.xy[0] = 0;
+        config_get()->dac_clamp.xy[1] = 0;
+        calib_build_lut();
+    }
+
+    static uint16_t code(uint8_t axis, adc_t value)
+    {
+        return (uint16_t)(calib_unapply(axis, value) << (10 - ADC_BITS));
+    }
+
+    mcp48 dac;
+};
+
+TEST_F(dac_mcp48, override_reaches_both_outputs)
+{
+    const uint8_t xy[2] = {200, 50};
+    dac_override(xy);
+    EXPECT_THAT(dac.commands(), Eq(2u));
+    EXPECT_THAT(dac.unsupported(), Eq(0u));
+    EXPECT_THAT(dac.output_code(0), Eq(code(0, ADC_SCALE(200))));
+    EXPECT_THAT(dac.output_code(1), Eq(code(1, ADC_SCALE(50))));
+    EXPECT_THAT(PORTC & (SWX_BIT | SWY_BIT), Eq(SWX_BIT | SWY_BIT));
+}
+
+TEST_F(dac_mcp48, clamp_outputs_the_bound)
+{
+    const adc_t xy[2] = {ADC_SCALE(250), ADC_SCALE(128)};
+    dac_override_clamp(xy);
+    EXPECT_THAT(dac.output_code(0), Eq(code(0, (adc_t)(ADC_CENTER + ADC_SCALE(41)))));
+    EXPECT_THAT(PORTC & (SWX_BIT | SWY_BIT), Eq(SWX_BIT));
+}
+
+TEST_F(dac_mcp48, output_changes_only_on_latch)
+{
+    gpio_select_dac();
+    SSP1BUF = 0x08;
+    SSP1BUF = 0x01;
+    SSP1BUF = 0x23;
+    gpio_deselect_dac();
+    EXPECT_THAT(dac.dac_register(1), Eq(0x123));
+    EXPECT_THAT(dac.output_code(1), Eq(0));
+
+    gpio_latch_dac();
+    gpio_unlatch_dac();
+    EXPECT_THAT(dac.output_code(1), Eq(0x123));
+    EXPECT_THAT(dac.output_volts(1), DoubleNear(3.3 * 0x123 / 1024, 1e-9));
+}
+
+TEST_F(dac_mcp48, deselecting_mid_command_discards_it)
+{
+    gpio_select_dac();
+    SSP1BUF = 0x00;
+    SSP1BUF = 0x01;
+    gpio_deselect_dac();
+    gpio_select_dac();
+    SSP1BUF = 0x00;
+    SSP1BUF = 0x00;
+    SSP1BUF = 0x42;
+    gpio_deselect_dac();
+    EXPECT_THAT(dac.aborted(), Eq(1u));
+    EXPECT_THAT(dac.commands(), Eq(1u));
+    EXPECT_THAT(dac.dac_register(0), Eq(0x42));
+}
+
+#endif
@@ -24,21 +24,24 @@
 /* -------------------------------------------------------------------------- */
 void gpio_init(void)
 {
-    /* Configure all GPIO pins */
-    PORTA  = 0x04;  /* nLAT=1 by default */
+    /* Configure all GPIO pins. Writing PORTx writes the latch, so it has to
+     * come after clearing LATx or the defaults are lost.
+     * Port C goes first: SWX and SWY float until they're driven low, so
+     * until then the console may see the DACs instead of the stick */
+    LATC   = 0x00;  /* Clear port latch bits */
+    PORTC  = 0x00;  /* Clear port bits */
+    TRISC  = 0x81;  /* SWX and SWY are digital outputs, MISO and RX are digital 
+                     * inputs */
+
     LATA   = 0x00;  /* Clear port latch bits */
+    PORTA  = 0x04;  /* nLAT=1 by default */
     TRISA  = 0x18;  /* BTN and nMCLR are inputs (set to 1).
                      * nMCLR must be input. Rest are outputs. */
 
-    PORTB  = 0x10;  /* nCS=1 by default */
     LATB   = 0x00;  /* Clear port latch bits */
+    PORTB  = 0x10;  /* nCS=1 by default */
     TRISB  = 0xE0;  /* JOYX, JOYY and RB7 are inputs. */
 
-    PORTC  = 0x00;  /* Clear port bits */
-    LATC   = 0x00;  /* Clear port latch bits */
-    TRISC  = 0x81;  /* SWX and SWY are digital outputs, MISO and RX are digital 
-                     * inputs */
-
     ANSELA = 0x00;  /* Set to digital IO (default is analog) */
     ANSELB = 0xE0;  /* JOYX, JOYY and RB7 are analog */
     ANSELC = 0x00;  /* All are digital */
@@ -1,8 +1,19 @@
 #include "anglemod/joy.h"
 #include "anglemod/log.h"
 #include "anglemod/config.h"
+#include "anglemod/seq.h"
+#include "anglemod/host.h"
 
-static enum joy_state state_history[3] = {JOY_NEUTRAL, JOY_NEUTRAL, JOY_NEUTRAL};
+static HOST_LOCAL enum joy_state state_history[3] = {JOY_NEUTRAL, JOY_NEUTRAL, JOY_NEUTRAL};
+
+/* -------------------------------------------------------------------------- */
+void joy_init(void)
+{
+    state_history[0] = JOY_NEUTRAL;
+    state_history[1] = JOY_NEUTRAL;
+    state_history[2] = JOY_NEUTRAL;
+    seq_reset();
+}
 
 /* -------------------------------------------------------------------------- */
 static void push_state(enum joy_state state)
@@ -13,22 +24,25 @@ static void push_state(enum joy_state state)
     state_history[0] = state_history[1];
     state_history[1] = state_history[2];
     state_history[2] = state;
+    seq_push_state(state);
     
     log_joy(state_history);
 }
 
 /* -------------------------------------------------------------------------- */
-void joy_push_state(const uint8_t xy[2])
+void joy_push_state(const adc_t xy[2])
 {
+    HOST_COUNT_CALL(joy_push_state);
     const struct config* c = config_get();
     
-    uint8_t h2 = (uint8_t)(c->joy.hysteresis / 2);
-    uint8_t thresh[5] = {
-        (uint8_t)(128 - c->joy.xythreshold - h2 - 1),
-        (uint8_t)(128 - c->joy.xythreshold + h2),
-        (uint8_t)(128 + c->joy.xythreshold - h2 - 1),
-        (uint8_t)(128 + c->joy.xythreshold + h2),
-        255
+    adc_t h2 = ADC_SCALE(c->joy.hysteresis / 2);
+    adc_t t = ADC_SCALE(c->joy.xythreshold);
+    adc_t thresh[5] = {
+        (adc_t)(ADC_CENTER - t - h2 - 1),
+        (adc_t)(ADC_CENTER - t + h2),
+        (adc_t)(ADC_CENTER + t - h2 - 1),
+        (adc_t)(ADC_CENTER + t + h2),
+        ADC_MAX
     };
     
     for (uint8_t ix = 0; ix != 5; ++ix)
@@ -92,9 +106,11 @@ public:
         state_history[2] = state;
     }
 
+    /* Coordinates are 8-bit, scaled up if ADC_10BIT is defined */
     enum joy_state push(uint8_t x, uint8_t y) const
     {
-        joy_push_state(x, y);
+        const adc_t xy[2] = {ADC_SCALE(x), ADC_SCALE(y)};
+        joy_push_state(xy);
         return state();
     }
 };
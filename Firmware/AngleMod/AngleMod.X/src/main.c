@@ -10,12 +10,16 @@
 #include "anglemod/uart.h"
 #include "anglemod/adc.h"
 #include "anglemod/config.h"
+#include "anglemod/calib.h"
 
 #include "anglemod/btn.h"
 #include "anglemod/joy.h"
 #include "anglemod/dac.h"
 #include "anglemod/seq.h"
 #include "anglemod/cli.h"
+#include "anglemod/host.h"
+#include "anglemod/boot.h"
+#include "anglemod/clk.h"
 
 #if !defined(CLI_SIM) && !defined(GTEST_TESTING)
 
@@ -44,6 +48,106 @@
 
 static enum seq active_seq = SEQ_NONE;
 
+/*
+ * Tapping the button and then holding it for PROFILE_HOLD_MS, with the stick in
+ * the neutral zone the whole time, switches to the next profile. The tap and
+ * the gap after it each have to be shorter than PROFILE_TAP_MS, so holding the
+ * button in play doesn't do it. Timed with TMR1, which counts us and wraps
+ * every 65 ms, so the elapsed time is picked up with every ADC pair.
+ */
+#define PROFILE_TAP_MS  250u
+#define PROFILE_HOLD_MS 1000u
+
+enum profile_gesture
+{
+    GESTURE_IDLE,
+    GESTURE_PRESSED,  /* Might be the tap */
+    GESTURE_TAPPED,   /* Waiting for the second press */
+    GESTURE_HOLDING,
+    GESTURE_DONE      /* Switched, until the button is released */
+};
+
+static enum profile_gesture gesture = GESTURE_IDLE;
+static uint16_t gesture_tmr1;
+static uint16_t gesture_ms;  /* Since the last step */
+
+/* -------------------------------------------------------------------------- */
+static void profile_gesture_step(enum profile_gesture step)
+{
+    gesture = step;
+    gesture_tmr1 = TMR1;
+    gesture_ms = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+static uint16_t profile_gesture_elapsed_ms(void)
+{
+    uint16_t now = TMR1;
+    while ((uint16_t)(now - gesture_tmr1) >= 1000u)
+    {
+        gesture_tmr1 += 1000u;
+        gesture_ms++;
+    }
+    return gesture_ms;
+}
+
+/* -------------------------------------------------------------------------- */
+static uint8_t stick_is_neutral(const adc_t xy[2])
+{
+    const struct config* c = config_get();
+    adc_t dx = xy[0] > ADC_CENTER ? xy[0] - ADC_CENTER : ADC_CENTER - xy[0];
+    adc_t dy = xy[1] > ADC_CENTER ? xy[1] - ADC_CENTER : ADC_CENTER - xy[1];
+    return dx < ADC_SCALE(c->joy.xythreshold) && dy < ADC_SCALE(c->joy.xythreshold);
+}
+
+/* -------------------------------------------------------------------------- */
+static void profile_gesture_press(void)
+{
+    if (active_seq != SEQ_NONE || !stick_is_neutral(adc_joy_xy()))
+        gesture = GESTURE_IDLE;
+    else if (gesture == GESTURE_TAPPED && profile_gesture_elapsed_ms() < PROFILE_TAP_MS)
+        profile_gesture_step(GESTURE_HOLDING);
+    else
+        profile_gesture_step(GESTURE_PRESSED);
+}
+
+/* -------------------------------------------------------------------------- */
+static void profile_gesture_release(void)
+{
+    if (gesture == GESTURE_PRESSED && profile_gesture_elapsed_ms() < PROFILE_TAP_MS)
+        profile_gesture_step(GESTURE_TAPPED);
+    else
+        gesture = GESTURE_IDLE;
+}
+
+/* -------------------------------------------------------------------------- */
+static void profile_gesture_update(const adc_t xy[2])
+{
+    uint8_t p;
+
+    if (gesture == GESTURE_IDLE || gesture == GESTURE_DONE)
+        return;
+    if (!stick_is_neutral(xy))
+    {
+        gesture = GESTURE_IDLE;
+        return;
+    }
+    if (gesture != GESTURE_HOLDING)
+    {
+        /* Too slow for a tap, or for the press after it */
+        if (profile_gesture_elapsed_ms() >= PROFILE_TAP_MS)
+            gesture = GESTURE_IDLE;
+        return;
+    }
+    if (profile_gesture_elapsed_ms() < PROFILE_HOLD_MS)
+        return;
+
+    gesture = GESTURE_DONE;
+    p = config_active_profile() + 1;
+    config_select_profile(p == CONFIG_PROFILE_COUNT ? 0 : p);
+    calib_build_lut();
+}
+
 /* -------------------------------------------------------------------------- */
 #if !defined(CLI_SIM) && !defined(GTEST_TESTING)
 static void init(void)
@@ -51,20 +155,30 @@ static void init(void)
 void pic16_init(void)
 #endif
 {
-    /* Init system-level stuff */
+    /* The pins are safe for pass-through first. btn_init() also starts TMR1,
+     * which timestamps the boot marks */
     gpio_init();
-    uart_init();
-    adc_init();
+    btn_init();
 
-    /* Load config before initializing the user-level stuff */
+    /* Load config before the control path, which depends on it */
     config_load_from_nvm();
+    calib_build_lut();
 
-    /* Init user-level stuff */
-    btn_init();
+    /* Control path. The first conversion is started by adc_init() and
+     * completes as soon as interrupts are enabled */
+    adc_init();
+    joy_init();
     dac_init();
-
-    /* Enable interrupts */
     INTCON = 0xC0;  /* GIE=1, PEIE=1, INTEDG=0 (falling edge on INT pin) */
+    boot_mark(BOOT_CONTROL);
+
+    /* Whatever isn't needed to pass the stick through or clamp it. States
+     * are only pushed by the main loop, so the pattern table is still in
+     * time for the first one */
+    seq_init();
+    uart_init();
+    clk_init();
+    boot_mark(BOOT_CLI);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -80,12 +194,14 @@ void pic16_process_events(void)
 
     if (btn_pressed())
     {
+        clk_boost(CLK_OVERRIDE);
         active_seq = seq_find(joy_state_history());
+        profile_gesture_press();
 
         if (active_seq == SEQ_NONE)
         {
             dac_override_clamp(adc_joy_xy());
-            adc_set_fast_sampling_mode();
+            adc_set_high_rate_mode();
         }
         else
         {
@@ -98,10 +214,14 @@ void pic16_process_events(void)
     {
         dac_override_disable();
         adc_set_slow_sampling_mode();
+        clk_release(CLK_OVERRIDE);
+        profile_gesture_release();
     }
 
     if (adc_has_new_data_get_and_clear())
     {
+        calib_capture(adc_joy_raw_xy());
+
         if (btn_is_active())
         {
             if (active_seq == SEQ_NONE)
@@ -111,11 +231,20 @@ void pic16_process_events(void)
         {
             joy_push_state(adc_joy_xy());
         }
+        profile_gesture_update(adc_joy_xy());
     }
 
     /* Update CLI with incoming data */
-    while (rb_rx_take_single(&c))
+    while (uart_getc(&c))
         cli_putc(c);
+    cli_poll();
+
+    /* Sending and receiving boost the clock in uart_putc() and uart_getc().
+     * Drop it once the line is quiet. Either only happens once nothing is
+     * being received, see clk.h */
+    if (clk_is_busy(CLK_UART) && uart_idle())
+        clk_release(CLK_UART);
+    clk_poll();
 }
 
 
@@ -151,3 +280,532 @@ void __interrupt() isr(void)
     if (PIR1bits.TX1IF)
         uart_tx_isr();
 }
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <nvm.h>
+#include <sim.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace testing;
+
+struct host_calls host_calls;
+
+/* ADRESH, plus ADRESL with the 10-bit ADC, for each axis */
+#if defined(ADC_10BIT)
+#   define ADC_PAIR_READS 4u
+#else
+#   define ADC_PAIR_READS 2u
+#endif
+
+/* ADCON0: select RB6, set GO once it was acquired, select RB5 again */
+#define ADC_PAIR_WRITES 3u
+
+/*
+ * Cost budgets of the hot paths. There's no cycle counter on the host, but
+ * the stubs count every register access, and HOST_COUNT_CALL() counts calls
+ * into the functions of HOST_CALL_LIST. Each scenario fails if it needs more
+ * than its budget. When a change makes a path cheaper, lower the budget so it
+ * stays that way.
+ */
+class cost_budget : public Test
+{
+public:
+    void SetUp() override
+    {
+        struct config* c;
+
+        pic16_init();
+        c = config_get();
+        c->enable.cardinal_angles = 0xFF;
+        c->enable.diagonal_angles = 0xFF;
+        c->enable.special_angles = 0x1F;
+        c->enable.btn_lockout = 10;
+        c->joy.xythreshold = 42;
+        c->joy.hysteresis = 14;
+        c->dac_clamp.xy[0] = 41;
+        c->dac_clamp.xy[1] = 41;
+        calib_build_lut();
+
+        /* Nothing half typed, the button rests high, and the UART has been
+         * idle for a while */
+        cli_putc(0x03);
+        PORTx(BTN_PORT).set(PORTx(BTN_PORT).value() | BTN_BIT);
+        btn_init();
+        PIR1.set(PIR1.value() | 0x10);  /* TX1IF */
+        for (int i = 0; i != 8; ++i)
+            pic16_process_events();
+        drain_tx();
+        TMR1.set((uint16_t)(TMR1.value() + 1000));
+        adc_pair(128, 128);
+        pic16_process_events();
+
+        sim_counts_reset();
+        memset(&host_calls, 0, sizeof(host_calls));
+    }
+
+    void TearDown() override
+    {
+        cli_putc(0x03);
+        drain_tx();
+        PIR1.set(0);
+        config_set_defaults();
+        active_seq = SEQ_NONE;
+        gesture = GESTURE_IDLE;
+    }
+
+    /* One conversion of each axis, like the hardware would deliver them.
+     * Coordinates are 8-bit, scaled up if ADC_10BIT is defined */
+    static void adc_pair(uint8_t x, uint8_t y)
+    {
+        const uint8_t xy[2] = {x, y};
+        for (int i = 0; i != 2; ++i)
+        {
+            adc_t value = ADC_SCALE(xy[i]);
+#if defined(ADC_10BIT)
+            ADRESH.set((uint8_t)(value >> 8));
+            ADRESL.set((uint8_t)value);
+#else
+            ADRESH.set(value);
+#endif
+            ADCON0.set(ADCON0.value() & ~0x02);  /* GO clears when done */
+            PIR1.set(PIR1.value() | 0x01);       /* ADIF */
+            isr();
+        }
+    }
+
+    static void press()
+    {
+        PORTx(BTN_PORT).set(PORTx(BTN_PORT).value() & ~BTN_BIT);
+        IOCxF(BTN_PORT).set(IOCxF(BTN_PORT).value() | BTN_BIT);
+        isr();
+        pic16_process_events();
+    }
+
+    static void drain_tx()
+    {
+        while (PIE1bits.TX1IE)
+            isr();
+    }
+
+    static unsigned total(const unsigned* counts)
+    {
+        unsigned sum = 0;
+        for (int i = 0; i != SFR_COUNT; ++i)
+            sum += counts[i];
+        return sum;
+    }
+
+    static unsigned reads() { return total(sim_sfr_reads); }
+    static unsigned writes() { return total(sim_sfr_writes); }
+
+    /* Where the accesses and calls went, for the failure message */
+    static std::string report()
+    {
+        std::string s;
+        char buf[48];
+        for (int i = 0; i != SFR_COUNT; ++i)
+            if (sim_sfr_reads[i] || sim_sfr_writes[i])
+            {
+                snprintf(buf, sizeof(buf), "\n  %-8s %3u reads %3u writes",
+                    sim_sfr_name((enum sfr_id)i), sim_sfr_reads[i], sim_sfr_writes[i]);
+                s += buf;
+            }
+#define X(fn) \
+        if (host_calls.fn) \
+        { \
+            snprintf(buf, sizeof(buf), "\n  %s() %u", #fn, host_calls.fn); \
+            s += buf; \
+        }
+        HOST_CALL_LIST
+#undef X
+        return s;
+    }
+
+    nvm flash;  /* Erased, so pic16_init() loads the defaults */
+};
+
+TEST_F(cost_budget, adc_pair)
+{
+    adc_pair(128, 0);
+    pic16_process_events();
+
+    EXPECT_THAT(joy_state_history()[2], Eq(JOY_N));
+    EXPECT_THAT(reads(), Le(10u + ADC_PAIR_READS)) << report();
+    EXPECT_THAT(writes(), Le(4u + ADC_PAIR_WRITES)) << report();
+    EXPECT_THAT(host_calls.joy_push_state, Eq(1u)) << report();
+}
+
+TEST_F(cost_budget, button_press_with_sequence_hit)
+{
+    adc_pair(128, 0);
+    pic16_process_events();
+    adc_pair(255, 0);
+    pic16_process_events();
+    sim_counts_reset();
+    memset(&host_calls, 0, sizeof(host_calls));
+
+    press();
+
+    /* Includes boosting the clock, which is one write, two to turn
+     * interrupts off and on around it, and reads of GIE and TRMT. It doesn't
+     * wait for the line to be quiet */
+    EXPECT_THAT(active_seq, Ne(SEQ_NONE));
+    EXPECT_THAT(reads(), Le(24u)) << report();
+    EXPECT_THAT(writes(), Le(16u)) << report();
+    EXPECT_THAT(host_calls.seq_find, Eq(1u)) << report();
+    EXPECT_THAT(host_calls.calib_unapply, Eq(2u)) << report();  /* Once per axis */
+    EXPECT_THAT(host_calls.dac_buf_transfer, Eq(1u)) << report();
+}
+
+TEST_F(cost_budget, clamp_update)
+{
+    press();
+    sim_counts_reset();
+    memset(&host_calls, 0, sizeof(host_calls));
+
+    adc_pair(255, 0);
+    pic16_process_events();
+
+    EXPECT_THAT(reads(), Le(25u + ADC_PAIR_READS)) << report();
+    EXPECT_THAT(writes(), Le(15u + ADC_PAIR_WRITES)) << report();
+    EXPECT_THAT(host_calls.dac_override_clamp, Eq(1u)) << report();
+    EXPECT_THAT(host_calls.calib_unapply, Eq(0u)) << report();  /* Precomputed */
+    EXPECT_THAT(host_calls.dac_buf_transfer, Eq(1u)) << report();
+}
+
+TEST_F(cost_budget, cli_character)
+{
+    RC1REG.set('h');
+    PIR1.set(PIR1.value() | 0x20);  /* RC1IF */
+    isr();
+    pic16_process_events();
+    drain_tx();
+
+    /* The byte is timestamped, and the main loop checks if the line is quiet
+     * to boost the clock for the echo */
+    EXPECT_THAT(reads(), Le(46u)) << report();
+    EXPECT_THAT(writes(), Le(13u)) << report();
+    EXPECT_THAT(host_calls.uart_putc, Le(5u)) << report();
+    EXPECT_THAT(host_calls.uart_printf, Le(2u)) << report();
+}
+
+/* Same setup as the budgets: the button is up and nothing is being sent */
+class clk_policy : public cost_budget
+{
+public:
+    static void release()
+    {
+        TMR1.set((uint16_t)(TMR1.value() + 20000));  /* Past the lockout */
+        pic16_process_events();
+        PORTx(BTN_PORT).set(PORTx(BTN_PORT).value() | BTN_BIT);
+        IOCxF(BTN_PORT).set(IOCxF(BTN_PORT).value() | BTN_BIT);
+        isr();
+        pic16_process_events();
+    }
+};
+
+TEST_F(clk_policy, idle_until_the_button_is_pressed)
+{
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+    press();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    adc_pair(255, 0);
+    pic16_process_events();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    release();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+}
+
+TEST_F(clk_policy, dac_transfers_only_happen_boosted)
+{
+    uint32_t fosc_during_spi = 0;
+    struct spi_watch : sim_device
+    {
+        uint32_t* fosc;
+        void sfr_written(enum sfr_id reg, uint8_t, uint8_t) override
+        {
+            if (reg == SFR_SSP1BUF && (*fosc == 0 || sim_fosc_hz < *fosc))
+                *fosc = sim_fosc_hz;
+        }
+    } watch;
+    watch.fosc = &fosc_during_spi;
+    sim_attach(&watch);
+
+    press();
+    adc_pair(255, 0);
+    pic16_process_events();
+    release();
+    sim_detach(&watch);
+
+    EXPECT_THAT(fosc_during_spi, Eq(32000000u));
+}
+
+TEST_F(clk_policy, button_boosts_even_while_bytes_arrive)
+{
+    RC1REG.set('h');
+    PIR1.set(PIR1.value() | 0x20);  /* RC1IF */
+    isr();
+    pic16_process_events();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));  /* More may follow */
+
+    press();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    EXPECT_THAT(sim_fosc_hz, Eq(32000000u));
+    release();
+}
+
+TEST_F(clk_policy, boosted_once_input_stops_until_output_is_sent)
+{
+    RC1REG.set('h');
+    PIR1.set(PIR1.value() | 0x20);  /* RC1IF */
+    isr();
+    pic16_process_events();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));  /* More may follow */
+
+    TMR1.set((uint16_t)(TMR1.value() + 300));
+    pic16_process_events();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+
+    drain_tx();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_BOOST));
+    pic16_process_events();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+}
+
+TEST_F(clk_policy, bytes_back_to_back_see_one_clock)
+{
+    const char typed[] = "status\r";
+    for (const char* c = typed; *c; ++c)
+    {
+        TMR1.set((uint16_t)(TMR1.value() + 260));
+        RC1REG.set((uint8_t)*c);
+        PIR1.set(PIR1.value() | 0x20);  /* RC1IF */
+        isr();
+        pic16_process_events();
+        if (*c == '\r')
+            drain_tx();  /* Lets the command's output out */
+    }
+    EXPECT_THAT(sim_sfr_writes[SFR_OSCFRQ], Eq(0u));
+
+    drain_tx();
+    TMR1.set((uint16_t)(TMR1.value() + 300));
+    pic16_process_events();
+    EXPECT_THAT(clk_active_mode(), Eq(CLK_IDLE));
+}
+
+/* The ADC keeps sampling the resting stick while time passes */
+class profile_switch : public clk_policy
+{
+public:
+    void TearDown() override
+    {
+        clk_policy::TearDown();
+        config_select_profile(0);
+        calib_build_lut();
+    }
+
+    static void wait_ms(unsigned ms)
+    {
+        for (unsigned i = 0; i != ms; i += 5)
+        {
+            TMR1.set((uint16_t)(TMR1.value() + 5000));
+            adc_pair(128, 128);
+            pic16_process_events();
+        }
+    }
+
+    static void tap()
+    {
+        press();
+        wait_ms(100);
+        release_now();
+        wait_ms(100);
+    }
+
+    /* Unlike clk_policy::release(), which waits 20 ms first */
+    static void release_now()
+    {
+        PORTx(BTN_PORT).set(PORTx(BTN_PORT).value() | BTN_BIT);
+        IOCxF(BTN_PORT).set(IOCxF(BTN_PORT).value() | BTN_BIT);
+        isr();
+        pic16_process_events();
+    }
+};
+
+TEST_F(profile_switch, tap_then_hold_switches_once)
+{
+    tap();
+    press();
+    wait_ms(900);
+    EXPECT_THAT(config_active_profile(), Eq(0u));
+    wait_ms(200);
+    EXPECT_THAT(config_active_profile(), Eq(1u));
+    wait_ms(2000);
+    EXPECT_THAT(config_active_profile(), Eq(1u));
+    release_now();
+}
+
+TEST_F(profile_switch, holding_alone_does_nothing)
+{
+    press();
+    wait_ms(5000);
+    release_now();
+    EXPECT_THAT(config_active_profile(), Eq(0u));
+}
+
+TEST_F(profile_switch, slow_tap_does_nothing)
+{
+    press();
+    wait_ms(300);
+    release_now();
+    wait_ms(100);
+    press();
+    wait_ms(2000);
+    release_now();
+    EXPECT_THAT(config_active_profile(), Eq(0u));
+}
+
+TEST_F(profile_switch, late_second_press_does_nothing)
+{
+    press();
+    wait_ms(100);
+    release_now();
+    wait_ms(300);
+    press();
+    wait_ms(2000);
+    release_now();
+    EXPECT_THAT(config_active_profile(), Eq(0u));
+}
+
+TEST_F(profile_switch, moving_the_stick_cancels)
+{
+    tap();
+    press();
+    wait_ms(500);
+    TMR1.set((uint16_t)(TMR1.value() + 5000));
+    adc_pair(255, 128);
+    pic16_process_events();
+    wait_ms(2000);
+    release_now();
+    EXPECT_THAT(config_active_profile(), Eq(0u));
+}
+
+/*
+ * Hot-plugging runs init() while the console is already reading the stick, so
+ * the order matters. TMR1 counts the virtual time in us, like it would at
+ * 1:8 from Fosc/4.
+ */
+class boot : public Test, public sim_device
+{
+public:
+    void SetUp() override
+    {
+        memset(_boot_times, 0, sizeof(_boot_times));
+        sim_time_ns = 0;
+        TMR1.set(0);
+        sim_counts_reset();
+        sim_attach(this);
+    }
+
+    void TearDown() override
+    {
+        sim_detach(this);
+        config_set_defaults();
+    }
+
+    void sfr_written(enum sfr_id reg, uint8_t old, uint8_t value) override
+    {
+        (void)old;
+        TMR1.set((uint16_t)(sim_time_ns / 1000));
+        written.push_back(reg);
+        if (reg == SFR_ADCON0)
+            adcon0.push_back(std::make_pair(value, sim_time_ns));
+    }
+
+    size_t first_write(enum sfr_id reg) const
+    {
+        for (size_t i = 0; i != written.size(); ++i)
+            if (written[i] == reg)
+                return i;
+        return written.size();
+    }
+
+    std::vector<enum sfr_id> written;
+    std::vector<std::pair<uint8_t, uint64_t> > adcon0;  /* Value, time */
+    nvm flash;
+};
+
+TEST_F(boot, switches_are_released_first)
+{
+    pic16_init();
+    ASSERT_THAT(written.size(), Ge(2u));
+    EXPECT_THAT(written[0], Eq(SFR_LATC));
+    EXPECT_THAT(written[1], Eq(SFR_PORTC));
+    EXPECT_THAT(PORTC & (SWX_BIT | SWY_BIT), Eq(0));
+}
+
+TEST_F(boot, control_path_is_up_before_the_cli)
+{
+    pic16_init();
+    EXPECT_THAT(first_write(SFR_ADCON0), Lt(first_write(SFR_INTCON)));
+    EXPECT_THAT(first_write(SFR_INTCON), Lt(first_write(SFR_RC1STA)));
+    EXPECT_THAT(first_write(SFR_RC1STA), Lt(written.size()));
+}
+
+TEST_F(boot, first_conversion_doesnt_wait_for_the_timer)
+{
+    pic16_init();
+    EXPECT_THAT(ADCON0 & 0x02, Ne(0));  /* GO */
+}
+
+TEST_F(boot, first_conversion_waits_for_the_acquisition)
+{
+    pic16_init();
+    ASSERT_THAT(adcon0.size(), Ge(2u));
+    EXPECT_THAT(adcon0.front().first, Eq(0x35));  /* RB5, ON */
+    EXPECT_THAT(adcon0.back().first, Eq(0x37));   /* GO */
+    EXPECT_THAT(adcon0.back().second - adcon0.front().second, Ge(ADC_TACQ_US * 1000u));
+}
+
+TEST_F(boot, erased_flash_skips_the_profile_area)
+{
+    /* Profile 0 and the header of the pattern table */
+    pic16_init();
+    EXPECT_THAT(sim_sfr_reads[SFR_NVMDATL], Le(sizeof(struct config) + SEQ_DFA_HEADER));
+}
+
+TEST_F(boot, marks_are_timestamped_once)
+{
+    pic16_init();
+    uint16_t control = boot_time_us(BOOT_CONTROL);
+    uint16_t cli = boot_time_us(BOOT_CLI);
+    EXPECT_THAT(control, Gt(0));
+    EXPECT_THAT(control, Le(cli));
+    EXPECT_THAT(cli, Le((uint16_t)(sim_time_ns / 1000 + 1)));
+    EXPECT_THAT(boot_time_us(BOOT_SAMPLE), Eq(0));
+
+    /* The first pair, 20 us later */
+    sim_time_advance_to(sim_time_ns + 20000);
+    for (int i = 0; i != 2; ++i)
+    {
+        ADCON0.set(ADCON0.value() & ~0x02);
+        PIR1.set(PIR1.value() | 0x01);  /* ADIF */
+        isr();
+    }
+    EXPECT_THAT(boot_time_us(BOOT_SAMPLE), Ge((uint16_t)(cli + 20)));
+
+    /* Another init doesn't move them */
+    pic16_init();
+    EXPECT_THAT(boot_time_us(BOOT_CONTROL), Eq(control));
+    EXPECT_THAT(boot_time_us(BOOT_CLI), Eq(cli));
+}
+
+#endif
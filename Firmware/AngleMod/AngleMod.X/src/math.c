@@ -1,7 +1,7 @@
 #include "anglemod/math.h"
 
 /* ------------------------------------------------------------------------- */
-static int8_t table[] = {
+static const int8_t table[] = {
     0,   
     2,   4,   6,   8,   11,  13,  15,  17,  19,  22,  24,  26,  28,  30,  32,  /* 15 */
     35,  37,  39,  41,  43,  45,  47,  49,  51,  53,  55,  57,  59,  61,  63,  /* 30 */
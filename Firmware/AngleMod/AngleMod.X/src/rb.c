@@ -85,9 +85,9 @@ TEST_F(NAME, write_some_bytes_single)
     EXPECT_THAT(rb_test_u8_put_single_value(0xB), IsTrue());
     EXPECT_THAT(rb_test_u8_put_single_value(0xC), IsTrue());
 
-    EXPECT_THAT(rb_test_u8.read, Eq(0));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(0));
     EXPECT_THAT(RB_COUNT(&rb_test_u8, N), Eq(3));
-    EXPECT_THAT(rb_test_u8.write, Eq(3));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(3));
 
     EXPECT_THAT(rb_test_u8.buffer[0], Eq(0xA));
     EXPECT_THAT(rb_test_u8.buffer[1], Eq(0xB));
@@ -105,8 +105,8 @@ TEST_F(NAME, read_some_bytes_single)
     ASSERT_THAT(rb_test_u8_take_single(out_buf+2), IsTrue());
 
     EXPECT_THAT(RB_COUNT(&rb_test_u8, N), Eq(0));
-    EXPECT_THAT(rb_test_u8.read, Eq(3));
-    EXPECT_THAT(rb_test_u8.write, Eq(3));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(3));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(3));
 
     EXPECT_THAT(out_buf[0], Eq(0xA));
     EXPECT_THAT(out_buf[1], Eq(0xB));
@@ -146,9 +146,9 @@ TEST_F(NAME, write_and_read_bytes_with_wrap_around_single)
         ASSERT_THAT(rb_test_u8_take_single(out_buf+2), IsTrue());
 
         EXPECT_THAT(RB_COUNT(&rb_test_u8, N), Eq(0));
-        EXPECT_THAT(rb_test_u8.write, Eq(rb_test_u8.read));
-        EXPECT_THAT(rb_test_u8.write, Lt(N));
-        EXPECT_THAT(rb_test_u8.read, Lt(N));
+        EXPECT_THAT((S)rb_test_u8.write, Eq((S)rb_test_u8.read));
+        EXPECT_THAT((S)rb_test_u8.write, Lt(N));
+        EXPECT_THAT((S)rb_test_u8.read, Lt(N));
     }
 }
 
@@ -165,15 +165,15 @@ TEST_F(NAME, if_it_dont_fit_dont_shit_single)
 
     EXPECT_THAT(RB_SPACE(&rb_test_u8, N), Eq(0));
     EXPECT_THAT(RB_IS_FULL(&rb_test_u8, N), IsTrue());
-    EXPECT_THAT(rb_test_u8.read, Eq(0));
-    EXPECT_THAT(rb_test_u8.write, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(0));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(N - 1));
 
     // Writing doesn't work
     EXPECT_THAT(rb_test_u8_put_single_value(0xA), IsFalse());
     EXPECT_THAT(rb_test_u8_put_single_value(0xB), IsFalse());
     EXPECT_THAT(RB_SPACE(&rb_test_u8, N), Eq(0));
-    EXPECT_THAT(rb_test_u8.read, Eq(0));
-    EXPECT_THAT(rb_test_u8.write, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(0));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(N - 1));
 
     // Read everything back
     bytes_left = N - 1;
@@ -185,8 +185,8 @@ TEST_F(NAME, if_it_dont_fit_dont_shit_single)
 
     EXPECT_THAT(RB_SPACE(&rb_test_u8, N), Eq(N - 1));
     EXPECT_THAT(RB_IS_EMPTY(&rb_test_u8, N), IsTrue());
-    EXPECT_THAT(rb_test_u8.read, Eq(N - 1));
-    EXPECT_THAT(rb_test_u8.write, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(N - 1));
 }
 
 TEST_F(NAME, write_some_bytes)
@@ -196,9 +196,9 @@ TEST_F(NAME, write_some_bytes)
 
     EXPECT_THAT(rb_test_u8_put(in_buf, 3), Eq(3));
 
-    EXPECT_THAT(rb_test_u8.read, Eq(0));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(0));
     EXPECT_THAT(RB_COUNT(&rb_test_u8, N), Eq(3));
-    EXPECT_THAT(rb_test_u8.write, Eq(3));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(3));
 
     EXPECT_THAT(rb_test_u8.buffer[0], Eq(0xA));
     EXPECT_THAT(rb_test_u8.buffer[1], Eq(0xB));
@@ -213,8 +213,8 @@ TEST_F(NAME, read_some_bytes)
     ASSERT_THAT(rb_test_u8_take(out_buf, 3), Eq(3));
 
     EXPECT_THAT(RB_COUNT(&rb_test_u8, N), Eq(0));
-    EXPECT_THAT(rb_test_u8.read, Eq(3));
-    EXPECT_THAT(rb_test_u8.write, Eq(3));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(3));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(3));
 
     EXPECT_THAT(out_buf[0], Eq(0xA));
     EXPECT_THAT(out_buf[1], Eq(0xB));
@@ -252,9 +252,9 @@ TEST_F(NAME, write_and_read_bytes_with_wrap_around)
         ASSERT_THAT(rb_test_u8_take(out_buf, 3), Eq(3));
 
         EXPECT_THAT(RB_COUNT(&rb_test_u8, N), Eq(0));
-        EXPECT_THAT(rb_test_u8.write, Eq(rb_test_u8.read));
-        EXPECT_THAT(rb_test_u8.write, Lt(N));
-        EXPECT_THAT(rb_test_u8.read, Lt(N));
+        EXPECT_THAT((S)rb_test_u8.write, Eq((S)rb_test_u8.read));
+        EXPECT_THAT((S)rb_test_u8.write, Lt(N));
+        EXPECT_THAT((S)rb_test_u8.read, Lt(N));
     }
 }
 
@@ -270,15 +270,15 @@ TEST_F(NAME, if_it_dont_fit_dont_shit)
 
     EXPECT_THAT(RB_SPACE(&rb_test_u8, N), Eq(0));
     EXPECT_THAT(RB_IS_FULL(&rb_test_u8, N), IsTrue());
-    EXPECT_THAT(rb_test_u8.read, Eq(0));
-    EXPECT_THAT(rb_test_u8.write, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(0));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(N - 1));
 
     // Writing doesn't work
     EXPECT_THAT(rb_test_u8_put(in_buf, 5), Eq(0));
     EXPECT_THAT(rb_test_u8_put(in_buf, 5), Eq(0));
     EXPECT_THAT(RB_SPACE(&rb_test_u8, N), Eq(0));
-    EXPECT_THAT(rb_test_u8.read, Eq(0));
-    EXPECT_THAT(rb_test_u8.write, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(0));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(N - 1));
 
     // Read everything back
     EXPECT_THAT(rb_test_u8_take(out_buf, N), Eq(N - 1));
@@ -287,8 +287,8 @@ TEST_F(NAME, if_it_dont_fit_dont_shit)
 
     EXPECT_THAT(RB_SPACE(&rb_test_u8, N), Eq(N - 1));
     EXPECT_THAT(RB_IS_EMPTY(&rb_test_u8, N), IsTrue());
-    EXPECT_THAT(rb_test_u8.read, Eq(N - 1));
-    EXPECT_THAT(rb_test_u8.write, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.read, Eq(N - 1));
+    EXPECT_THAT((S)rb_test_u8.write, Eq(N - 1));
 }
 
 TEST_F(NAME, write_and_read_more_than_available_with_wrap_around)
@@ -327,4 +327,243 @@ TEST_F(NAME, write_and_read_more_less_available_with_wrap_around)
         ASSERT_THAT(out_buf[i], Eq(0));
 }
 
+TEST_F(NAME, peek_returns_span_up_to_end)
+{
+    const uint8_t* data;
+    uint8_t in_buf[N / 2];
+    for (int i = 0; i != N / 2; ++i)
+        in_buf[i] = i;
+
+    rb_test_u8.read = N - 4;
+    rb_test_u8.write = N - 4;
+    EXPECT_THAT(rb_test_u8_peek_contiguous(&data), Eq(0));
+    rb_test_u8_put(in_buf, N / 2);
+
+    ASSERT_THAT(rb_test_u8_peek_contiguous(&data), Eq(4));
+    EXPECT_THAT(data[0], Eq(0));
+    EXPECT_THAT(data[3], Eq(3));
+    EXPECT_THAT(rb_test_u8_count(), Eq(N / 2));  /* Nothing taken before commit */
+
+    rb_test_u8_commit_take(4);
+    ASSERT_THAT(rb_test_u8_peek_contiguous(&data), Eq(N / 2 - 4));
+    EXPECT_THAT(data[0], Eq(4));
+    rb_test_u8_commit_take(N / 2 - 4);
+    EXPECT_THAT(rb_test_u8_count(), Eq(0));
+}
+
+TEST_F(NAME, reserve_returns_writable_span_up_to_end)
+{
+    uint8_t* data;
+    uint8_t out_buf[N];
+
+    rb_test_u8.read = 4;
+    rb_test_u8.write = N - 2;
+    ASSERT_THAT(rb_test_u8_reserve_contiguous(&data), Eq(2));
+    data[0] = 'a';
+    data[1] = 'b';
+    EXPECT_THAT(rb_test_u8_count(), Eq(N - 6));  /* Nothing visible before commit */
+    rb_test_u8_commit_put(2);
+
+    /* Wrapped around, one slot stays free */
+    ASSERT_THAT(rb_test_u8_reserve_contiguous(&data), Eq(3));
+    data[0] = 'c';
+    rb_test_u8_commit_put(1);
+
+    rb_test_u8.read = N - 2;
+    ASSERT_THAT(rb_test_u8_take(out_buf, N), Eq(3));
+    EXPECT_THAT(out_buf[0], Eq('a'));
+    EXPECT_THAT(out_buf[1], Eq('b'));
+    EXPECT_THAT(out_buf[2], Eq('c'));
+}
+
+/* -------------------------------------------------------------------------- */
+/* Stress tests */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * The ISR side runs on its own thread and preempts the main loop at arbitrary
+ * points, on the UART's own buffers. Without RB_ATOMIC this would be a data
+ * race as far as the host compiler is concerned.
+ */
+#if defined(RB_ATOMIC)
+
+#include "anglemod/uart.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+#define STRESS_BYTES (1ul << 20)
+
+class ring_buffer_stress : public Test
+{
+public:
+    void SetUp() override
+    {
+        rb_rx_init();
+        rb_tx_init();
+        start = std::chrono::steady_clock::now();
+    }
+
+    /* Random delay so both sides get interrupted at different points */
+    static void jitter(std::minstd_rand& rng)
+    {
+        for (unsigned i = rng() % 64; i; --i)
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    void report(const char* name)
+    {
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        printf("[          ] %s: %.1f MB/s\n", name, STRESS_BYTES / t.count() / 1e6);
+    }
+
+    std::chrono::steady_clock::time_point start;
+};
+
+/* Like uart_rx_isr(), except that a full buffer is retried instead of
+ * dropping the byte, so any gap in the sequence is a bug */
+TEST_F(ring_buffer_stress, rx_isr_to_main_loop)
+{
+    std::thread isr([] {
+        std::minstd_rand rng(1);
+        for (unsigned long i = 0; i != STRESS_BYTES; ++i)
+        {
+            while (!rb_rx_put_single_value((char)i))
+                std::this_thread::yield();
+            jitter(rng);
+        }
+    });
+
+    std::minstd_rand rng(2);
+    unsigned long received = 0;
+    unsigned long errors = 0;
+    while (received != STRESS_BYTES)
+    {
+        char c;
+        if (rb_rx_count() > RX_BUF_SIZE - 1)
+            errors++;
+        if (!rb_rx_take_single(&c))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        if (c != (char)received)
+            errors++;
+        received++;
+        jitter(rng);
+    }
+
+    isr.join();
+    report("rx");
+    EXPECT_THAT(errors, Eq(0u));
+    EXPECT_THAT(rb_rx_count(), Eq(0));
+}
+
+/* The main loop writes strings of random length, like uart_printf() and
+ * bin.c, and the TX ISR takes one byte at a time */
+TEST_F(ring_buffer_stress, main_loop_to_tx_isr)
+{
+    std::atomic<unsigned long> errors(0);
+    std::thread isr([&errors] {
+        std::minstd_rand rng(3);
+        unsigned long sent = 0;
+        while (sent != STRESS_BYTES)
+        {
+            char c;
+            if (!rb_tx_take_single(&c))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if (c != (char)sent)
+                errors++;
+            sent++;
+            jitter(rng);
+        }
+    });
+
+    std::minstd_rand rng(4);
+    unsigned long queued = 0;
+    while (queued != STRESS_BYTES)
+    {
+        char buf[24];
+        uint8_t len = (uint8_t)(1 + rng() % sizeof(buf));
+        if (len > STRESS_BYTES - queued)
+            len = (uint8_t)(STRESS_BYTES - queued);
+        for (uint8_t i = 0; i != len; ++i)
+            buf[i] = (char)(queued + i);
+
+        uint8_t done = 0;
+        while (done != len)
+        {
+            TX_RWTYPE n = rb_tx_put(buf + done, (uint8_t)(len - done));
+            if (n == 0)
+                std::this_thread::yield();
+            done += n;
+        }
+        queued += len;
+        jitter(rng);
+    }
+
+    isr.join();
+    report("tx");
+    EXPECT_THAT(errors.load(), Eq(0u));
+    EXPECT_THAT(rb_tx_count(), Eq(0));
+}
+
+/* Both ends work on the spans in place, like the simulators draining TX */
+TEST_F(ring_buffer_stress, spans_in_place)
+{
+    std::atomic<unsigned long> errors(0);
+    std::thread isr([&errors] {
+        std::minstd_rand rng(5);
+        unsigned long sent = 0;
+        while (sent != STRESS_BYTES)
+        {
+            const char* data;
+            TX_RWTYPE n = rb_tx_peek_contiguous(&data);
+            if (n == 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            for (uint8_t i = 0; i != n; ++i)
+                if (data[i] != (char)(sent + i))
+                    errors++;
+            rb_tx_commit_take(n);
+            sent += n;
+            jitter(rng);
+        }
+    });
+
+    std::minstd_rand rng(6);
+    unsigned long queued = 0;
+    while (queued != STRESS_BYTES)
+    {
+        char* data;
+        TX_RWTYPE n = rb_tx_reserve_contiguous(&data);
+        if (n > STRESS_BYTES - queued)
+            n = (uint8_t)(STRESS_BYTES - queued);
+        if (n == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        n = (uint8_t)(1 + rng() % n);
+        for (uint8_t i = 0; i != n; ++i)
+            data[i] = (char)(queued + i);
+        rb_tx_commit_put(n);
+        queued += n;
+        jitter(rng);
+    }
+
+    isr.join();
+    report("spans");
+    EXPECT_THAT(errors.load(), Eq(0u));
+    EXPECT_THAT(rb_tx_count(), Eq(0));
+}
+
+#endif
+
 #endif
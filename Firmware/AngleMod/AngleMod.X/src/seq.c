@@ -2,41 +2,138 @@
 #include "anglemod/joy.h"
 #include "anglemod/log.h"
 #include "anglemod/config.h"
+#include "anglemod/bin.h"
+#include "anglemod/host.h"
 
-static enum joy_state match_table[][3] = {
+/*
+ * The 3 joystick states of each sequence are packed into nibbles, oldest
+ * state in the highest nibble. JOY_NEUTRAL matches any state. Being const,
+ * the table lives in program memory.
+ */
+#define MATCH(s0, s1, s2) \
+    (uint16_t)((JOY_##s0 << 8) | (JOY_##s1 << 4) | JOY_##s2)
+
+static const uint16_t match_table[SEQ_COUNT] = {
     /* Cardinal angles */
-    {JOY_NEUTRAL, JOY_N, JOY_NE},
-    {JOY_NEUTRAL, JOY_E, JOY_NE},
-    {JOY_NEUTRAL, JOY_E, JOY_SE},
-    {JOY_NEUTRAL, JOY_S, JOY_SE},
-    {JOY_NEUTRAL, JOY_N, JOY_NW},
-    {JOY_NEUTRAL, JOY_W, JOY_NW},
-    {JOY_NEUTRAL, JOY_W, JOY_SW},
-    {JOY_NEUTRAL, JOY_S, JOY_SW},
+    MATCH(NEUTRAL, N, NE),
+    MATCH(NEUTRAL, E, NE),
+    MATCH(NEUTRAL, E, SE),
+    MATCH(NEUTRAL, S, SE),
+    MATCH(NEUTRAL, N, NW),
+    MATCH(NEUTRAL, W, NW),
+    MATCH(NEUTRAL, W, SW),
+    MATCH(NEUTRAL, S, SW),
     /* Diagonal angles */
-    {JOY_NEUTRAL, JOY_NE, JOY_N},
-    {JOY_NEUTRAL, JOY_NE, JOY_E},
-    {JOY_NEUTRAL, JOY_SE, JOY_E},
-    {JOY_NEUTRAL, JOY_SE, JOY_S},
-    {JOY_NEUTRAL, JOY_NW, JOY_N},
-    {JOY_NEUTRAL, JOY_NW, JOY_W},
-    {JOY_NEUTRAL, JOY_SW, JOY_W},
-    {JOY_NEUTRAL, JOY_SW, JOY_S},
+    MATCH(NEUTRAL, NE, N),
+    MATCH(NEUTRAL, NE, E),
+    MATCH(NEUTRAL, SE, E),
+    MATCH(NEUTRAL, SE, S),
+    MATCH(NEUTRAL, NW, N),
+    MATCH(NEUTRAL, NW, W),
+    MATCH(NEUTRAL, SW, W),
+    MATCH(NEUTRAL, SW, S),
     /* Special angles*/
-    {JOY_E, JOY_NE, JOY_N},
-    {JOY_E, JOY_SE, JOY_S},
-    {JOY_W, JOY_NW, JOY_N},
-    {JOY_W, JOY_SW, JOY_S},
-    {JOY_N, JOY_NE, JOY_E},
-    {JOY_S, JOY_SE, JOY_E},
-    {JOY_N, JOY_NW, JOY_W},
-    {JOY_S, JOY_SW, JOY_W}
+    MATCH(E, NE, N),
+    MATCH(E, SE, S),
+    MATCH(W, NW, N),
+    MATCH(W, SW, S),
+    MATCH(N, NE, E),
+    MATCH(S, SE, E),
+    MATCH(N, NW, W),
+    MATCH(S, SW, W)
 };
 
+/* States of the table in the pattern area, 0 if there is none */
+static HOST_LOCAL uint8_t dfa_states = 0;
+static HOST_LOCAL uint8_t dfa_state = 0;
+
+#define DFA_ROW_OFFSET(state) (uint8_t)(SEQ_DFA_HEADER + (state) * SEQ_DFA_ROW)
+#define DFA_MASK_OFFSET 5  /* After the 9 next state nibbles */
+
+/* -------------------------------------------------------------------------- */
+/* Number of states if the area holds a complete table, the magic aside */
+static uint8_t complete_table(void)
+{
+    uint8_t i, end, crc = 0;
+    uint8_t n = config_read_pattern_area(1);
+
+    if (n == 0 || n > SEQ_DFA_MAX_STATES)
+        return 0;
+
+    /* An interrupted upload leaves a table with a bad CRC */
+    end = DFA_ROW_OFFSET(n);
+    for (i = SEQ_DFA_HEADER; i != end; ++i)
+        crc = bin_crc8(crc, config_read_pattern_area(i));
+    return crc == config_read_pattern_area(2) ? n : 0;
+}
+
+/* -------------------------------------------------------------------------- */
+void seq_init(void)
+{
+    dfa_states = config_read_pattern_area(0) == SEQ_DFA_MAGIC ? complete_table() : 0;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t seq_commit(void)
+{
+    uint8_t success = 1;
+    if (config_read_pattern_area(0) == 0xFF && complete_table())
+        success = config_program_pattern_byte(0, SEQ_DFA_MAGIC);
+    seq_init();
+    return success;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t seq_dfa_states(void)
+{
+    return dfa_states;
+}
+
+/* -------------------------------------------------------------------------- */
+void seq_reset(void)
+{
+    dfa_state = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+void seq_push_state(enum joy_state state)
+{
+    uint8_t next;
+    if (!dfa_states)
+        return;
+
+    next = config_read_pattern_area(DFA_ROW_OFFSET(dfa_state) + (state >> 1));
+    dfa_state = state & 0x01 ? next >> 4 : next & 0x0F;
+    if (dfa_state >= dfa_states)  /* Only a broken table gets here */
+        dfa_state = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+static enum seq find_in_dfa(void)
+{
+    uint8_t i = 3, item_idx, mask;
+    uint8_t offset = DFA_ROW_OFFSET(dfa_state) + DFA_MASK_OFFSET;
+    const struct config* c = config_get();
+
+    /* The highest enabled sequence wins, like with the built-in ones */
+    while (i--)
+    {
+        mask = config_read_pattern_area(offset + i) & c->enable.bytes[i];
+        if (!mask)
+            continue;
+
+        for (item_idx = 7; !(mask & (1u << item_idx)); --item_idx) {}
+        return (enum seq)((i << 3) | item_idx);
+    }
+
+    return SEQ_NONE;
+}
+
 /* -------------------------------------------------------------------------- */
 static enum seq find_sequence(const enum joy_state* state_history)
 {
     uint8_t i, s = SEQ_COUNT;
+    uint16_t match;
     const struct config* c = config_get();
     while (s--)
     {
@@ -47,9 +144,11 @@ static enum seq find_sequence(const enum joy_state* state_history)
         if (!(c->enable.bytes[cat_idx] & mask))
             continue;
 
-        for (i = 0; i != 3; ++i)
+        match = match_table[s];
+        for (i = 3; i--; match >>= 4)
         {
-            if (match_table[s][i] != JOY_NEUTRAL && match_table[s][i] != state_history[i])
+            uint8_t state = match & 0x0F;
+            if (state != JOY_NEUTRAL && state != state_history[i])
                 goto unmatched;
         }
 
@@ -64,7 +163,246 @@ static enum seq find_sequence(const enum joy_state* state_history)
 /* -------------------------------------------------------------------------- */
 enum seq seq_find(const enum joy_state* state_history)
 {
-    enum seq s = find_sequence(state_history);
+    HOST_COUNT_CALL(seq_find);
+    enum seq s = dfa_states ? find_in_dfa() : find_sequence(state_history);
     log_seq(s);
     return s;
 }
+
+/* -------------------------------------------------------------------------- */
+enum joy_state seq_state(enum seq seq, uint8_t idx)
+{
+    return (enum joy_state)((match_table[seq] >> (8 - 4 * idx)) & 0x0F);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <nvm.h>
+#include <sim.h>
+#include <vector>
+
+using namespace testing;
+
+class seq_match : public Test
+{
+public:
+    void SetUp() override
+    {
+        struct config* c = config_get();
+        c->enable.bytes[0] = 0xFF;
+        c->enable.bytes[1] = 0xFF;
+        c->enable.bytes[2] = 0xFF;
+    }
+
+    void TearDown() override
+    {
+        config_set_defaults();
+    }
+};
+
+TEST_F(seq_match, every_sequence_matches_its_own_states)
+{
+    for (uint8_t s = 0; s != SEQ_COUNT; ++s)
+    {
+        const enum joy_state history[3] = {
+            seq_state((enum seq)s, 0), seq_state((enum seq)s, 1), seq_state((enum seq)s, 2)
+        };
+        EXPECT_THAT(find_sequence(history), Eq((enum seq)s)) << "s=" << (int)s;
+    }
+}
+
+TEST_F(seq_match, neutral_is_a_wildcard_for_the_oldest_state)
+{
+    const enum joy_state history[3] = {JOY_SW, JOY_N, JOY_NE};
+    EXPECT_THAT(find_sequence(history), Eq(SEQ_CARD_N_NE));
+}
+
+TEST_F(seq_match, disabled_sequences_are_skipped)
+{
+    const enum joy_state history[3] = {JOY_E, JOY_NE, JOY_N};
+    EXPECT_THAT(find_sequence(history), Eq(SEQ_SPEC_E_NE_N));
+
+    config_get()->enable.bytes[2] = 0x00;
+    EXPECT_THAT(find_sequence(history), Eq(SEQ_DIAG_NE_N));
+
+    config_get()->enable.bytes[1] = 0x00;
+    EXPECT_THAT(find_sequence(history), Eq(SEQ_NONE));
+}
+
+/*
+ * A table for the patterns "S SE E" (SPEC_S_SE_E) and "SE E" (DIAG_SE_E),
+ * as provision would compile them:
+ *
+ *   0  Nothing       3  SE           5  SE E
+ *   1  S             4  S SE E
+ *   2  S SE
+ */
+class seq_dfa : public seq_match
+{
+public:
+    void SetUp() override
+    {
+        seq_match::SetUp();
+        INTCON = 0xC0;
+    }
+
+    void TearDown() override
+    {
+        flash.set_word(0x1F00, NVM_ERASED);
+        seq_init();
+        seq_match::TearDown();
+    }
+
+    static std::vector<uint8_t> table()
+    {
+        const uint8_t n = 6;
+        std::vector<uint8_t> t = {SEQ_DFA_MAGIC, n, 0};
+        for (uint8_t s = 0; s != n; ++s)
+        {
+            uint8_t next[10] = {0};
+            next[JOY_S] = 1;
+            next[JOY_SE] = s == 1 ? 2 : 3;
+            next[JOY_E] = s == 2 ? 4 : s == 3 ? 5 : 0;
+            for (uint8_t i = 0; i != 10; i += 2)
+                t.push_back((uint8_t)(next[i] | (next[i + 1] << 4)));
+
+            uint32_t mask = (s == 4 ? 1ul << SEQ_SPEC_S_SE_E : 0) |
+                            (s >= 4 ? 1ul << SEQ_DIAG_SE_E : 0);
+            for (uint8_t i = 0; i != 3; ++i)
+                t.push_back((uint8_t)(mask >> (i * 8)));
+        }
+        for (size_t i = SEQ_DFA_HEADER; i != t.size(); ++i)
+            t[2] = bin_crc8(t[2], t[i]);
+        return t;
+    }
+
+    void load(const std::vector<uint8_t>& t)
+    {
+        for (size_t i = 0; i != t.size(); ++i)
+            flash.set_word((uint16_t)(0x1F00 + i), t[i]);
+        seq_init();
+        seq_reset();
+    }
+
+    enum seq input(std::vector<enum joy_state> states)
+    {
+        for (enum joy_state s : states)
+            seq_push_state(s);
+        return seq_find(history);
+    }
+
+    /* Ignored with a table */
+    const enum joy_state history[3] = {JOY_NEUTRAL, JOY_NEUTRAL, JOY_NEUTRAL};
+    nvm flash;
+};
+
+TEST_F(seq_dfa, erased_area_uses_the_built_in_sequences)
+{
+    seq_init();
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+    const enum joy_state history[3] = {JOY_S, JOY_SE, JOY_E};
+    EXPECT_THAT(seq_find(history), Eq(SEQ_SPEC_S_SE_E));
+}
+
+TEST_F(seq_dfa, matches_after_the_states_of_a_pattern)
+{
+    load(table());
+    ASSERT_THAT(seq_dfa_states(), Eq(6));
+    EXPECT_THAT(input({JOY_S}), Eq(SEQ_NONE));
+    EXPECT_THAT(input({JOY_SE}), Eq(SEQ_NONE));
+    EXPECT_THAT(input({JOY_E}), Eq(SEQ_SPEC_S_SE_E));
+    EXPECT_THAT(input({JOY_NE}), Eq(SEQ_NONE));
+}
+
+TEST_F(seq_dfa, shorter_pattern_matches_on_its_own)
+{
+    load(table());
+    EXPECT_THAT(input({JOY_W, JOY_SE, JOY_E}), Eq(SEQ_DIAG_SE_E));
+    EXPECT_THAT(input({JOY_S, JOY_W, JOY_SE, JOY_E}), Eq(SEQ_DIAG_SE_E));
+}
+
+TEST_F(seq_dfa, disabled_sequences_are_skipped)
+{
+    load(table());
+    config_get()->enable.bytes[2] = 0x00;
+    EXPECT_THAT(input({JOY_S, JOY_SE, JOY_E}), Eq(SEQ_DIAG_SE_E));
+    config_get()->enable.bytes[1] = 0x00;
+    EXPECT_THAT(seq_find(history), Eq(SEQ_NONE));
+}
+
+TEST_F(seq_dfa, joy_init_starts_over)
+{
+    load(table());
+    input({JOY_S});
+    joy_init();
+    EXPECT_THAT(input({JOY_SE, JOY_E}), Eq(SEQ_DIAG_SE_E));
+}
+
+TEST_F(seq_dfa, incomplete_table_is_ignored)
+{
+    std::vector<uint8_t> t = table();
+    t.back() ^= 0x01;
+    load(t);
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+
+    t = table();
+    t[1] = SEQ_DFA_MAX_STATES + 1;
+    load(t);
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+}
+
+TEST_F(seq_dfa, commit_programs_the_magic_of_a_complete_table)
+{
+    load(table());
+    flash.set_word(0x1F00, NVM_ERASED);
+    seq_init();
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+
+    ASSERT_THAT(seq_commit(), Eq(1));
+    EXPECT_THAT(seq_dfa_states(), Eq(6));
+    EXPECT_THAT(flash.word(0x1F00), Eq(SEQ_DFA_MAGIC));
+    EXPECT_THAT(flash.erases(0xF8), Eq(0u));
+    EXPECT_THAT(flash.unerased_writes(), Eq(0u));
+}
+
+TEST_F(seq_dfa, commit_leaves_an_incomplete_table_alone)
+{
+    std::vector<uint8_t> t = table();
+    t.back() ^= 0x01;
+    load(t);
+    flash.set_word(0x1F00, NVM_ERASED);
+
+    ASSERT_THAT(seq_commit(), Eq(1));
+    EXPECT_THAT(seq_dfa_states(), Eq(0));
+    EXPECT_THAT(flash.word(0x1F00), Eq(NVM_ERASED));
+}
+
+TEST_F(seq_dfa, next_state_past_the_table_starts_over)
+{
+    std::vector<uint8_t> t = table();
+    uint8_t& next = t[SEQ_DFA_HEADER + (JOY_S >> 1)];
+    next = JOY_S & 0x01 ? (uint8_t)(next | 0xF0) : (uint8_t)(next | 0x0F);
+    t[2] = 0;
+    for (size_t i = SEQ_DFA_HEADER; i != t.size(); ++i)
+        t[2] = bin_crc8(t[2], t[i]);
+    load(t);
+
+    /* S goes to state 15 of 6, so SE and E continue from state 0 */
+    ASSERT_THAT(seq_dfa_states(), Eq(6));
+    EXPECT_THAT(input({JOY_S, JOY_SE, JOY_E}), Eq(SEQ_DIAG_SE_E));
+}
+
+TEST_F(seq_dfa, state_change_costs_one_flash_read)
+{
+    load(table());
+    sim_counts_reset();
+    input({JOY_S, JOY_SE, JOY_E, JOY_N, JOY_S});
+    EXPECT_THAT(sim_sfr_reads[SFR_NVMDATL], Eq(5u + 3u));  /* + the mask in seq_find() */
+}
+
+#endif
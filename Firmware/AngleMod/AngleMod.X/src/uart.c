@@ -1,27 +1,129 @@
 #include "anglemod/uart.h"
 #include "anglemod/cli.h"
+#include "anglemod/clk.h"
+#include "anglemod/host.h"
 #include <xc.h>
 #include <stdarg.h>
 
+static uint8_t uart_plain = 0;
+static uint8_t flow_control = 0;
+static volatile uint8_t rx_stopped = 0;  /* XOFF was sent */
+static volatile char flow_byte = 0;      /* XON/XOFF waiting to be sent */
+static volatile uint8_t flow_suspended = 0;  /* 2 until the TX buffer drains */
+static volatile uint8_t rx_dropped = 0;
+static volatile uint8_t rx_overruns = 0;
+static uint16_t rx_time;  /* TMR1 when the last byte was taken */
+
+/* 10 bits at 38400 baud, in TMR1 ticks */
+#define UART_BYTE_US 261u
+
 /* -------------------------------------------------------------------------- */
 void uart_init(void)
 {
-    SP1BRG = 12;  /* Baud rate of 38400 */
-    /*SP1BRG = 25;  * Baud rate of 19200 */
-    TX1STA = 0x20;  /* TXEN=1 (transmit enable), SYNC=0 */
+    BAUD1CON = 0x08;  /* BRG16=1 */
+    SP1BRG = clk_sp1brg();  /* Baud rate of 38400, see clk.h */
+    TX1STA = 0x24;  /* TXEN=1 (transmit enable), SYNC=0, BRGH=1 */
     RC1STA = 0x90;  /* SPEN=1 (serial port enable), CREN=1 */
     
     PIE1bits.RC1IE = 1;  /* Enable RX interrupt */
+
+    rx_time = (uint16_t)(TMR1 - UART_BYTE_US);  /* Quiet until a byte comes in */
 }
 /* -------------------------------------------------------------------------- */
 void uart_putc(char c)
 {
+    HOST_COUNT_CALL(uart_putc);
     /* Enabling the TX interrupt will cause the ISR to execute immediately,
      * so make sure to put data into the buffer before doing so. */
-    while (rb_tx_put_single_value(c) == 0) {}
+    while (rb_tx_put_single_value(c) == 0)
+    {
+#if defined(GTEST_TESTING)
+        uart_tx_isr();  /* Nothing else empties the buffer in unit tests */
+#endif
+    }
+    clk_boost(CLK_UART);  /* Before the first byte starts shifting out */
     PIE1bits.TX1IE = 1;
 }
 
+/* -------------------------------------------------------------------------- */
+uint8_t uart_quiet(void)
+{
+    return BAUD1CONbits.RCIDL && !rb_rx_count()
+        && (uint16_t)(TMR1 - rx_time) >= UART_BYTE_US;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t uart_idle(void)
+{
+    return !PIE1bits.TX1IE && TX1STAbits.TRMT && uart_quiet();
+}
+
+/* -------------------------------------------------------------------------- */
+void uart_set_plain(uint8_t enable)
+{
+    uart_plain = enable;
+}
+
+/* -------------------------------------------------------------------------- */
+static void uart_puts_raw(const char* s)
+{
+    while (*s)
+        uart_putc(*s++);
+}
+
+/* -------------------------------------------------------------------------- */
+/*!
+ * @brief Sends a character, expanding the UART_TOK_* bytes into the sequences
+ * they stand for.
+ */
+static void uart_put_expanded(char c)
+{
+    /* Last byte of U+2190-U+2199, in the order of the arrow tokens */
+    static const char arrow_table[] = {
+        '\x90', '\x91', '\x92', '\x93', '\x96', '\x97', '\x98', '\x99'
+    };
+    /* Same as the fallbacks used without CLI_USE_UNICODE */
+    static const char* const arrow_plain_table[] = {
+        " W", " N", " E", " S", " NW", " NE", " SE", " SW"
+    };
+    uint8_t t = (uint8_t)c;
+
+    if (uart_plain)
+    {
+        if (t >= UART_TOK_ARROW && t < UART_TOK_ARROW + 8)
+            uart_puts_raw(arrow_plain_table[t - UART_TOK_ARROW]);
+        else if (t == UART_TOK_DEGREES)
+            uart_putc('d');
+        else if ((t >= UART_TOK_COLOR && t < UART_TOK_COLOR + 7) || (t >= UART_TOK_RESET && t <= UART_TOK_CURSOR_UP))
+            return;  /* Colors and cursor control are dropped */
+        else
+            uart_putc(c);
+        return;
+    }
+
+    if (t >= UART_TOK_COLOR && t < UART_TOK_COLOR + 7)
+    {
+        uart_puts_raw("\x1b[1;3");
+        uart_putc((char)('0' + t));
+        uart_putc('m');
+    }
+    else if (t == UART_TOK_RESET)
+        uart_puts_raw("\x1b[0m");
+    else if (t == UART_TOK_CLEAR_EOL)
+        uart_puts_raw("\x1b[K");
+    else if (t == UART_TOK_CURSOR_UP)
+        uart_puts_raw("\x1b[A");
+    else if (t >= UART_TOK_ARROW && t < UART_TOK_ARROW + 8)
+    {
+        uart_puts_raw("\xE2\x86");
+        uart_putc(arrow_table[t - UART_TOK_ARROW]);
+    }
+    else if (t == UART_TOK_DEGREES)
+        uart_puts_raw("\xC2\xB0");
+    else
+        uart_putc(c);
+}
+
 /* -------------------------------------------------------------------------- */
 /*!
  * @brief Converts a u8 integer into a decimal string and sends it over uart
@@ -51,9 +153,32 @@ static void uart_put_u8(uint8_t value)
         uart_putc(buf[digits]);
 }
 
+/* -------------------------------------------------------------------------- */
+static void uart_put_u16(uint16_t value)
+{
+    static const uint16_t powers[] = {10000, 1000, 100, 10};
+    uint8_t started = 0;
+
+    for (uint8_t i = 0; i != 4; ++i)
+    {
+        char digit = '0';
+        while (value >= powers[i]) {
+            value -= powers[i];
+            digit++;
+        }
+        if (digit != '0' || started)
+        {
+            uart_putc(digit);
+            started = 1;
+        }
+    }
+    uart_putc('0' + (uint8_t)value);
+}
+
 /* -------------------------------------------------------------------------- */
 void uart_printf(const char* fmt, ...)
 {
+    HOST_COUNT_CALL(uart_printf);
     va_list ap;
     va_start(ap, fmt);
     
@@ -67,16 +192,20 @@ void uart_printf(const char* fmt, ...)
                 case 's': {
                     const char* s = va_arg(ap, const char*);
                     while (*s)
-                        uart_putc(*s++);
+                        uart_put_expanded(*s++);
                 } break;
                 
                 case 'u': {
-                    uint8_t value = va_arg(ap, uint8_t);
+                    uint8_t value = va_arg_u8(ap);
                     uart_put_u8(value);
                 } break;
+
+                case 'U': {
+                    uart_put_u16((uint16_t)va_arg(ap, unsigned));
+                } break;
                 
                 case 'c': {
-                    uart_putc(va_arg(ap, char));
+                    uart_put_expanded((char)va_arg_u8(ap));
                 } break;
                 
                 case '%': {
@@ -91,21 +220,109 @@ void uart_printf(const char* fmt, ...)
         }
         else
         {
-            uart_putc(*fmt);
+            uart_put_expanded(*fmt);
         }
     }
     
     va_end(ap);
 }
 
+/* -------------------------------------------------------------------------- */
+static void uart_send_flow_byte(char c)
+{
+    flow_byte = c;
+    PIE1bits.TX1IE = 1;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t uart_getc(char* c)
+{
+    if (!rb_rx_take_single(c))
+        return 0;
+
+    /* More bytes may follow right away, see uart_quiet() */
+    rx_time = TMR1;
+    clk_boost(CLK_UART);
+
+    /* The RX ISR can't set rx_stopped again before this finishes, because the
+     * buffer would have to fill up first */
+    if (rx_stopped && rb_rx_count() <= UART_RX_XON_LEVEL)
+    {
+        rx_stopped = 0;
+        uart_send_flow_byte(UART_XON);
+    }
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+void uart_set_flow_control(uint8_t enable)
+{
+    flow_control = enable;
+    if (!enable && rx_stopped)
+    {
+        rx_stopped = 0;
+        uart_send_flow_byte(UART_XON);
+    }
+}
+uint8_t uart_flow_control(void)
+{
+    return flow_control;
+}
+
+/* -------------------------------------------------------------------------- */
+void uart_suspend_flow_control(uint8_t suspend)
+{
+    if (suspend)
+    {
+        /* The RX ISR can't stop the host anymore once this is set */
+        flow_suspended = 1;
+        if (rx_stopped)
+        {
+            rx_stopped = 0;
+            uart_send_flow_byte(UART_XON);
+        }
+    }
+    else
+    {
+        /* Frames still queued have to go out first, the TX ISR resumes once
+         * it runs out of bytes */
+        flow_suspended = 2;
+        PIE1bits.TX1IE = 1;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t uart_rx_dropped(void)
+{
+    return rx_dropped;
+}
+uint8_t uart_rx_overruns(void)
+{
+    return rx_overruns;
+}
+void uart_rx_stats_reset(void)
+{
+    rx_dropped = 0;
+    rx_overruns = 0;
+}
+
 /* -------------------------------------------------------------------------- */
 void uart_tx_isr(void)
 {
     char c;
-    if (rb_tx_take_single(&c))
+    if (flow_byte)
+    {
+        /* Goes out ahead of everything that is queued */
+        TX1REG = flow_byte;
+        flow_byte = 0;
+    }
+    else if (rb_tx_take_single(&c))
         TX1REG = c;  /* Write to transmit register */
     else
     {
+        if (flow_suspended == 2)
+            flow_suspended = 0;
+
         /* Last byte was queued, disable interrupt.
          * The TX1IF flag functions a bit differently than the other interrupt
          * flags, namely, it is read-only, and it is only ever clear when
@@ -120,8 +337,227 @@ void uart_tx_isr(void)
 void uart_rx_isr(void)
 {
     char c = RC1REG;  /* Read from receive register */
-    rb_rx_put_single_value(c);
+
+    /* OERR stops the receiver until CREN is toggled */
+    if (RC1STA & 0x02)
+    {
+        RC1STA &= ~0x10;
+        RC1STA |= 0x10;
+        if (rx_overruns != 255)
+            rx_overruns++;
+    }
+
+    if (!rb_rx_put_single_value(c) && rx_dropped != 255)
+        rx_dropped++;
+
+    if (flow_control && !flow_suspended && !rx_stopped && rb_rx_count() >= UART_RX_XOFF_LEVEL)
+    {
+        rx_stopped = 1;
+        uart_send_flow_byte(UART_XOFF);
+    }
 }
 
 RB_DEFINE_API(rx, char, RX_BUF_SIZE, RX_RWTYPE)
 RB_DEFINE_API(tx, char, TX_BUF_SIZE, TX_RWTYPE)
+
+/* -------------------------------------------------------------------------- */
+/* Unit Tests */
+/* -------------------------------------------------------------------------- */
+
+#if defined(GTEST_TESTING)
+
+#include <gmock/gmock.h>
+#include <string>
+
+using namespace testing;
+
+class uart_tokens : public Test
+{
+public:
+    void SetUp() override
+    {
+        sent();
+    }
+
+    std::string sent()
+    {
+        std::string s;
+        char c;
+        while (rb_tx_take_single(&c))
+            s += c;
+        return s;
+    }
+};
+
+TEST_F(uart_tokens, plain_text_is_unchanged)
+{
+    uart_printf("\r\nhello");
+    EXPECT_THAT(sent(), StrEq("\r\nhello"));
+}
+
+#define TOK(name) UART_TOK_STR(UART_TOK_##name##_HEX)
+
+TEST_F(uart_tokens, strings_hold_the_token_bytes_in_order)
+{
+    EXPECT_THAT(TOK(RED), StrEq("\x01"));
+    EXPECT_THAT(TOK(WHITE)[0], Eq(UART_TOK_COLOR + 6));
+    EXPECT_THAT(TOK(RESET)[0], Eq(UART_TOK_RESET));
+    EXPECT_THAT(TOK(CURSOR_UP)[0], Eq(UART_TOK_CLEAR_EOL + 1));
+    EXPECT_THAT(TOK(ARROW_W)[0], Eq(UART_TOK_ARROW));
+    EXPECT_THAT(TOK(ARROW_SW)[0], Eq(UART_TOK_ARROW + 7));
+    EXPECT_THAT(TOK(DEGREES), StrEq("\x19"));
+}
+
+TEST_F(uart_tokens, colors_expand_to_escape_sequences)
+{
+    uart_printf(TOK(RED) "a" TOK(WHITE) "b" TOK(RESET));
+    EXPECT_THAT(sent(), StrEq("\x1b[1;31m" "a" "\x1b[1;37m" "b" "\x1b[0m"));
+}
+
+TEST_F(uart_tokens, cursor_tokens_expand)
+{
+    uart_printf(TOK(CLEAR_EOL) TOK(CURSOR_UP));
+    EXPECT_THAT(sent(), StrEq("\x1b[K" "\x1b[A"));
+}
+
+TEST_F(uart_tokens, arrows_and_degrees_expand_to_utf8)
+{
+    uart_printf(TOK(ARROW_W) TOK(ARROW_S) TOK(ARROW_NW) TOK(ARROW_SW) TOK(DEGREES));
+    EXPECT_THAT(sent(), StrEq("\xE2\x86\x90" "\xE2\x86\x93" "\xE2\x86\x96" "\xE2\x86\x99" "\xC2\xB0"));
+}
+
+TEST_F(uart_tokens, string_arguments_are_expanded)
+{
+    uart_printf("%s!", TOK(ARROW_N) TOK(ARROW_NE));
+    EXPECT_THAT(sent(), StrEq("\xE2\x86\x91" "\xE2\x86\x97" "!"));
+}
+
+TEST_F(uart_tokens, plain_mode_drops_formatting)
+{
+    uart_set_plain(1);
+    uart_printf(TOK(RED) "a" TOK(RESET) TOK(CLEAR_EOL) TOK(CURSOR_UP) "\r\n" "%s", TOK(ARROW_W) TOK(ARROW_NE) "45" TOK(DEGREES));
+    uart_set_plain(0);
+    EXPECT_THAT(sent(), StrEq("a\r\n W NE45d"));
+}
+
+TEST_F(uart_tokens, u16_is_printed_without_leading_zeros)
+{
+    uart_printf("%U %U %U %U", (uint16_t)0, (uint16_t)7, (uint16_t)1005, (uint16_t)65535);
+    EXPECT_THAT(sent(), StrEq("0 7 1005 65535"));
+}
+
+class uart_flow : public Test
+{
+public:
+    void SetUp() override
+    {
+        rb_rx_init();
+        rb_tx_init();
+        flow_byte = 0;
+        rx_stopped = 0;
+        flow_suspended = 0;
+        uart_rx_stats_reset();
+        uart_set_flow_control(1);
+        RC1STA = 0x90;
+    }
+
+    void TearDown() override
+    {
+        uart_set_flow_control(0);
+        wire();
+    }
+
+    void receive(int count)
+    {
+        while (count--)
+        {
+            RC1REG = 'a';
+            uart_rx_isr();
+        }
+    }
+
+    /* Runs the TX interrupt until it disables itself */
+    std::string wire()
+    {
+        std::string s;
+        while (PIE1bits.TX1IE)
+        {
+            TX1REG = 0;
+            uart_tx_isr();
+            if (PIE1bits.TX1IE)
+                s += (char)TX1REG;
+        }
+        return s;
+    }
+};
+
+TEST_F(uart_flow, xoff_is_sent_once_when_buffer_fills)
+{
+    receive(UART_RX_XOFF_LEVEL - 1);
+    EXPECT_THAT(wire(), StrEq(""));
+    receive(3);
+    EXPECT_THAT(wire(), StrEq("\x13"));
+}
+
+TEST_F(uart_flow, xoff_goes_out_before_queued_output)
+{
+    uart_printf("abc");
+    receive(UART_RX_XOFF_LEVEL);
+    EXPECT_THAT(wire(), StrEq("\x13" "abc"));
+}
+
+TEST_F(uart_flow, xon_is_sent_after_draining)
+{
+    char c;
+    receive(UART_RX_XOFF_LEVEL);
+    wire();
+    while (rb_rx_count() > UART_RX_XON_LEVEL + 1)
+        uart_getc(&c);
+    EXPECT_THAT(wire(), StrEq(""));
+    uart_getc(&c);
+    EXPECT_THAT(wire(), StrEq("\x11"));
+}
+
+TEST_F(uart_flow, disabling_releases_the_host)
+{
+    receive(UART_RX_XOFF_LEVEL);
+    wire();
+    uart_set_flow_control(0);
+    EXPECT_THAT(wire(), StrEq("\x11"));
+}
+
+TEST_F(uart_flow, suspending_releases_the_host_until_output_is_sent)
+{
+    receive(UART_RX_XOFF_LEVEL);
+    EXPECT_THAT(wire(), StrEq("\x13"));
+    uart_suspend_flow_control(1);
+    EXPECT_THAT(wire(), StrEq("\x11"));
+
+    receive(2);
+    uart_printf("abc");
+    uart_suspend_flow_control(0);
+    receive(1);
+    EXPECT_THAT(wire(), StrEq("abc"));
+
+    receive(1);
+    EXPECT_THAT(wire(), StrEq("\x13"));
+}
+
+TEST_F(uart_flow, full_buffer_counts_dropped_bytes)
+{
+    uart_set_flow_control(0);
+    receive(RX_BUF_SIZE + 4);
+    EXPECT_THAT(uart_rx_dropped(), Eq(5));
+    EXPECT_THAT(wire(), StrEq(""));
+}
+
+TEST_F(uart_flow, overrun_is_counted_and_receiver_restarted)
+{
+    RC1STA = 0x92;
+    receive(1);
+    EXPECT_THAT(uart_rx_overruns(), Eq(1));
+    EXPECT_THAT(RC1STA & 0x10, Ne(0));
+    EXPECT_THAT(rb_rx_count(), Eq(1));
+}
+
+#endif
@@ -18,27 +18,41 @@ static void DataReceived(const char* buf, DWORD bytesRead)
     }
 }
 
+static void COMWriteBuf(HANDLE hPort, const char* buf, DWORD len)
+{
+    DWORD bytesWritten = 0;
+    OVERLAPPED ov = { 0 };
+    WriteFile(hPort, buf, len, &bytesWritten, &ov);
+    GetOverlappedResult(hPort, &ov, &bytesWritten, TRUE);
+}
+
 void COMWrite(HANDLE hPort)
 {
-    static char buf[TX_BUF_SIZE];
+    /* The TX buffer is written out in place. uart_tx_isr() still runs last to
+     * send a pending XON/XOFF and to disable itself */
     DWORD len = 0;
     while (PIE1bits.TX1IE)
     {
+        const char* data;
+        TX_RWTYPE n;
+        while ((n = rb_tx_peek_contiguous(&data)) != 0)
+        {
+            COMWriteBuf(hPort, data, n);
+            rb_tx_commit_take(n);
+            len += n;
+        }
+
         uart_tx_isr();
-        if (PIE1bits.TX1IE == 0)
-            break;
-        buf[len++] = TX1REG;
+        if (PIE1bits.TX1IE)
+        {
+            char c = (char)TX1REG;
+            COMWriteBuf(hPort, &c, 1);
+            len++;
+        }
     }
-    buf[len] = 0;
 
-    DWORD bytesWritten = 0;
-    OVERLAPPED ov = { 0 };
     if (len > 0)
-    {
-        WriteFile(hPort, buf, len, &bytesWritten, &ov);
-        GetOverlappedResult(hPort, &ov, &bytesWritten, TRUE);
         printf("%d\n", len);
-    }
 }
 
 void JoystickToADC(void)
@@ -46,8 +60,10 @@ void JoystickToADC(void)
     JOYINFO ji;
     joyGetPos(0, &ji);
 
+    ADCON0 &= ~0x02;  /* GO clears when a conversion is done */
     ADRESH = ji.wXpos / 256;
     adc_isr();
+    ADCON0 &= ~0x02;
     ADRESH = 255 - ji.wYpos / 256;
     adc_isr();
 
@@ -0,0 +1,383 @@
+/*
+ * Generates a RAM and flash budget report from the map file XC8 writes when
+ * building AngleMod.X, e.g.
+ *
+ *   mem-report --budget budget.txt \
+ *       ../AngleMod.X/dist/default/production/AngleMod.X.production.map
+ *
+ * Pass --baseline with the map file of an older build to see how much memory
+ * a change freed or consumed. The exit code is non-zero if any region exceeds
+ * its budget.
+ *
+ * --strings reports how much program memory the string literals of a
+ * preprocessed source file take, and how much the single byte UART_TOK_*
+ * tokens (see uart.h) save compared to storing the sequences they expand to.
+ * Each byte of a string costs one RETLW instruction word on the PIC16, e.g.
+ *
+ *   gcc -E -I../AngleMod.X/include -I../pic16f152-stubs/include \
+ *       ../AngleMod.X/src/cli.c > cli.i
+ *   mem-report --strings cli.i
+ */
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Symbol
+{
+    std::string name;
+    std::string psect;
+    unsigned long addr;
+    long size;  /* Estimated from the next symbol in the same psect, -1 if unknown */
+};
+
+struct MapFile
+{
+    /* Region name -> used words/bytes, in the order XC8 lists them */
+    std::vector<std::pair<std::string, long>> regions;
+    std::map<std::string, std::string> units;
+    std::vector<Symbol> symbols;
+};
+
+/* -------------------------------------------------------------------------- */
+bool is_ram_psect(const std::string& psect)
+{
+    static const char* prefixes[] = {"bss", "data", "cstack", "nv"};
+    for (const char* p : prefixes)
+        if (psect.compare(0, strlen(p), p) == 0)
+            return true;
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_map(const std::string& filename, MapFile* map)
+{
+    std::ifstream f(filename);
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open map file '%s'\n", filename.c_str());
+        return false;
+    }
+
+    /* e.g. "    PROGRAM          used   D60h (  3424) of  2000h words   ( 41.8%)" */
+    static const std::regex summary_re(
+        R"(^\s*([A-Z_]+)\s+used\s+[0-9A-Fa-f]+h\s+\(\s*(\d+)\)\s+of\s+[0-9A-Fa-f]+h\s+(words|bytes))");
+    /* e.g. "_adc_xy                  bssBANK0     0020" */
+    static const std::regex symbol_re(
+        R"(^\s*(\S+)\s+(\S+)\s+([0-9A-Fa-f]+)\s*$)");
+
+    enum { OTHER, SYMBOLS } section = OTHER;
+    std::string line;
+    std::smatch m;
+    while (std::getline(f, line))
+    {
+        if (line.find("Symbol Table") != std::string::npos)
+        {
+            section = SYMBOLS;
+            continue;
+        }
+        if (line.find("Memory Summary") != std::string::npos)
+        {
+            section = OTHER;
+            continue;
+        }
+
+        if (std::regex_search(line, m, summary_re))
+        {
+            map->regions.emplace_back(m[1], std::stol(m[2]));
+            map->units[m[1]] = m[3];
+        }
+        else if (section == SYMBOLS && std::regex_match(line, m, symbol_re))
+        {
+            if (m[2] == "(abs)")  /* SFRs and absolute symbols */
+                continue;
+            map->symbols.push_back({m[1], m[2], std::stoul(m[3], nullptr, 16), -1});
+        }
+    }
+
+    if (map->regions.empty())
+    {
+        fprintf(stderr, "'%s' has no memory summary, is it an XC8 map file?\n", filename.c_str());
+        return false;
+    }
+
+    /* Estimate object sizes from the distance to the next symbol in the psect */
+    std::sort(map->symbols.begin(), map->symbols.end(), [](const Symbol& a, const Symbol& b) {
+        return a.psect != b.psect ? a.psect < b.psect : a.addr < b.addr;
+    });
+    for (size_t i = 0; i + 1 < map->symbols.size(); ++i)
+        if (map->symbols[i].psect == map->symbols[i + 1].psect)
+            map->symbols[i].size = (long)(map->symbols[i + 1].addr - map->symbols[i].addr);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_budget(const std::string& filename, std::map<std::string, long>* budget)
+{
+    std::ifstream f(filename);
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open budget file '%s'\n", filename.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(f, line))
+    {
+        line = line.substr(0, line.find('#'));
+        char region[32];
+        long limit;
+        if (sscanf(line.c_str(), "%31s %ld", region, &limit) == 2)
+            (*budget)[region] = limit;
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+long region_used(const MapFile& map, const std::string& region)
+{
+    for (const auto& r : map.regions)
+        if (r.first == region)
+            return r.second;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+struct StringStats
+{
+    long literals = 0;
+    long bytes = 0;  /* Including null terminators */
+    long tokens = 0;
+    long expanded = 0;  /* Bytes the tokens would take as escape sequences */
+    long escapes = 0;  /* Escape sequences that are still stored in full */
+};
+
+/* Must match UART_TOK_* in uart.h */
+int token_expanded_length(unsigned char c)
+{
+    if (c >= 0x01 && c <= 0x07) return 7;  /* "\x1b[1;3<n>m" */
+    if (c == 0x0E) return 4;  /* "\x1b[0m" */
+    if (c == 0x0F) return 3;  /* "\x1b[K" */
+    if (c == 0x10) return 3;  /* "\x1b[A" */
+    if (c >= 0x11 && c <= 0x18) return 3;  /* UTF-8 arrows */
+    if (c == 0x19) return 2;  /* UTF-8 degree sign */
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Decodes one escape sequence starting after the backslash */
+unsigned char decode_escape(const std::string& src, size_t* i)
+{
+    char c = src[(*i)++];
+    switch (c)
+    {
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'b': return '\b';
+        case 'a': return '\a';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case 'x': {
+            unsigned value = 0;
+            while (*i < src.size() && isxdigit((unsigned char)src[*i]))
+                value = value * 16 + (unsigned)std::stoi(src.substr((*i)++, 1), nullptr, 16);
+            return (unsigned char)value;
+        }
+        default:
+            if (c >= '0' && c <= '7')
+            {
+                unsigned value = (unsigned)(c - '0');
+                for (int n = 0; n != 2 && *i < src.size() && src[*i] >= '0' && src[*i] <= '7'; ++n)
+                    value = value * 8 + (unsigned)(src[(*i)++] - '0');
+                return (unsigned char)value;
+            }
+            return (unsigned char)c;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_strings(const std::string& filename, StringStats* stats)
+{
+    std::ifstream f(filename);
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open source file '%s'\n", filename.c_str());
+        return false;
+    }
+
+    /* Drop line markers and other directives, join the rest */
+    std::string src, line;
+    while (std::getline(f, line))
+        if (line.find_first_not_of(" \t") == std::string::npos || line[line.find_first_not_of(" \t")] != '#')
+            src += line + "\n";
+
+    bool adjacent = false;  /* Only whitespace since the end of the last literal */
+    for (size_t i = 0; i < src.size(); )
+    {
+        char c = src[i++];
+        if (c == '\'')
+        {
+            while (i < src.size() && src[i] != '\'')
+                i += src[i] == '\\' ? 2 : 1;
+            i++;
+            adjacent = false;
+        }
+        else if (c == '"')
+        {
+            if (!adjacent)
+            {
+                stats->literals++;
+                stats->bytes++;  /* Null terminator */
+            }
+            while (i < src.size() && src[i] != '"')
+            {
+                unsigned char b = (unsigned char)src[i++];
+                if (b == '\\')
+                    b = decode_escape(src, &i);
+                stats->bytes++;
+                if (b == 0x1B)
+                    stats->escapes++;
+                else if (token_expanded_length(b))
+                {
+                    stats->tokens++;
+                    stats->expanded += token_expanded_length(b);
+                }
+            }
+            i++;
+            adjacent = true;
+        }
+        else if (!isspace((unsigned char)c))
+            adjacent = false;
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+void print_string_report(const StringStats& stats)
+{
+    printf("String literals:       %7ld\n", stats.literals);
+    printf("Program words:         %7ld\n", stats.bytes);
+    printf("Tokens:                %7ld\n", stats.tokens);
+    printf("Words saved by tokens: %7ld\n", stats.expanded - stats.tokens);
+    printf("Unencoded escapes:     %7ld\n", stats.escapes);
+}
+
+/* -------------------------------------------------------------------------- */
+void print_usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] <map file>\n"
+        "  --budget <file>     Region limits to check against\n"
+        "  --baseline <map>    Map file of an older build to compare against\n"
+        "  --top <n>           Number of largest RAM objects to list (default 15)\n"
+        "       %s --strings <preprocessed source>\n",
+        prog, prog);
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+    std::string map_file, budget_file, baseline_file, strings_file;
+    int top = 15;
+
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--budget" || arg == "--baseline" || arg == "--top" || arg == "--strings") && i + 1 < argc)
+        {
+            const char* value = argv[++i];
+            if (arg == "--strings")
+                strings_file = value;
+            else if (arg == "--budget")
+                budget_file = value;
+            else if (arg == "--baseline")
+                baseline_file = value;
+            else
+                top = atoi(value);
+        }
+        else if (arg.rfind("--", 0) != 0 && map_file.empty())
+            map_file = arg;
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (!strings_file.empty())
+    {
+        StringStats stats;
+        if (!parse_strings(strings_file, &stats))
+            return -1;
+        print_string_report(stats);
+        return 0;
+    }
+    if (map_file.empty())
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    MapFile map, baseline;
+    std::map<std::string, long> budget;
+    if (!parse_map(map_file, &map))
+        return -1;
+    if (!baseline_file.empty() && !parse_map(baseline_file, &baseline))
+        return -1;
+    if (!budget_file.empty() && !parse_budget(budget_file, &budget))
+        return -1;
+
+    int over_budget = 0;
+    printf("Region          Used    Budget    Free   Change\n");
+    for (const auto& r : map.regions)
+    {
+        if (r.second == 0 && budget.count(r.first) == 0)
+            continue;
+
+        printf("%-12s %7ld", r.first.c_str(), r.second);
+        if (budget.count(r.first))
+        {
+            long free = budget[r.first] - r.second;
+            printf(" %9ld %7ld", budget[r.first], free);
+            if (free < 0)
+                over_budget = 1;
+        }
+        else
+            printf(" %9s %7s", "-", "-");
+
+        if (!baseline_file.empty())
+            printf(" %+8ld", r.second - region_used(baseline, r.first));
+        printf("  %s%s\n", map.units[r.first].c_str(),
+            budget.count(r.first) && budget[r.first] < r.second ? "  OVER BUDGET" : "");
+    }
+
+    std::vector<Symbol> ram;
+    for (const Symbol& s : map.symbols)
+        if (s.size > 0 && is_ram_psect(s.psect))
+            ram.push_back(s);
+    std::stable_sort(ram.begin(), ram.end(), [](const Symbol& a, const Symbol& b) {
+        return a.size > b.size;
+    });
+
+    if (!ram.empty())
+    {
+        printf("\nLargest RAM objects (estimated from symbol addresses):\n");
+        for (int i = 0; i != top && i != (int)ram.size(); ++i)
+            printf("  %5ld  %-32s %s\n", ram[i].size, ram[i].name.c_str(), ram[i].psect.c_str());
+    }
+
+    return over_budget;
+}
@@ -0,0 +1,499 @@
+/*
+ * Replays labeled joystick traces through joy_push_state() and seq_find()
+ * for a grid of threshold, hysteresis and enable mask settings and reports
+ * which configuration detects the labeled sequences best.
+ *
+ * Trace file format (one event per line, '#' starts a comment):
+ *
+ *   <x> <y>            One ADC sample pair, as adc_joy_xy() would return it
+ *   press <expected>   Button is pressed. <expected> is a sequence name from
+ *                      SEQ_LIST (e.g. CARD_N_NE) or "none"
+ *   release            Button is released
+ *
+ * While the button is held, samples are not pushed into the joystick state
+ * history, exactly like process_events() in main.c.
+ */
+#include "anglemod/config.h"
+#include "anglemod/joy.h"
+#include "anglemod/seq.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Event
+{
+    enum Type : uint8_t { SAMPLE, PRESS, RELEASE } type;
+    uint8_t xy[2];
+    uint8_t expected;  /* enum seq, only valid for PRESS */
+};
+
+typedef std::vector<Event> Trace;
+
+struct Range
+{
+    int first, last, step;
+};
+
+struct Options
+{
+    std::vector<std::string> trace_files;
+    int synth = 0;
+    Range threshold = {20, 100, 1};
+    Range hysteresis = {0, 40, 1};
+    std::vector<uint32_t> masks;
+    double noise = 0.0;
+    int repeat = 1;
+    int false_weight = 2;
+    int top = 10;
+    unsigned threads = 0;
+    unsigned seed = 1;
+};
+
+struct Result
+{
+    uint8_t threshold;
+    uint8_t hysteresis;
+    uint32_t mask;
+    uint32_t presses;
+    uint32_t missed;
+    uint32_t false_detections;
+    uint32_t score;
+};
+
+const char* seq_names[] = {
+#define X(name, mirrx, mirry, str, x, y) #name,
+    SEQ_LIST
+#undef X
+};
+
+/* Angle in degrees of each joystick state, see JOY_STATE_LIST */
+const int state_angle[JOY_STATE_COUNT] = {
+    135, 180, 225,  /* NW, W, SW */
+    90,  -1,  270,  /* N, NEUTRAL, S */
+    45,  0,   315   /* NE, E, SE */
+};
+
+/* Every sequence enabled */
+const uint32_t all_seq_mask = (1ul << SEQ_COUNT) - 1;
+
+/* -------------------------------------------------------------------------- */
+int parse_seq_name(const std::string& name)
+{
+    if (name == "none")
+        return SEQ_NONE;
+    for (int i = 0; i != SEQ_COUNT; ++i)
+        if (name == seq_names[i])
+            return i;
+    return -1;
+}
+
+/* -------------------------------------------------------------------------- */
+bool load_trace(const std::string& filename, Trace* trace)
+{
+    std::ifstream f(filename);
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open trace file '%s'\n", filename.c_str());
+        return false;
+    }
+
+    std::string line;
+    for (int lineno = 1; std::getline(f, line); ++lineno)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ss(line);
+        std::string word;
+        if (!(ss >> word))
+            continue;
+
+        Event e = {};
+        if (word == "press")
+        {
+            std::string name;
+            int seq;
+            if (!(ss >> name) || (seq = parse_seq_name(name)) < 0)
+            {
+                fprintf(stderr, "%s:%d: Expected a sequence name or \"none\"\n", filename.c_str(), lineno);
+                return false;
+            }
+            e.type = Event::PRESS;
+            e.expected = (uint8_t)seq;
+        }
+        else if (word == "release")
+        {
+            e.type = Event::RELEASE;
+        }
+        else
+        {
+            int x, y;
+            std::istringstream xy(line);
+            if (!(xy >> x >> y) || x < 0 || x > 255 || y < 0 || y > 255)
+            {
+                fprintf(stderr, "%s:%d: Expected \"<x> <y>\" in range 0-255\n", filename.c_str(), lineno);
+                return false;
+            }
+            e.type = Event::SAMPLE;
+            e.xy[0] = (uint8_t)x;
+            e.xy[1] = (uint8_t)y;
+        }
+
+        trace->push_back(e);
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/*!
+ * Generates a trace of motions that walk the stick through the states of
+ * randomly chosen sequences (and through motions that shouldn't match
+ * anything), each followed by a button press labeled with the intent.
+ */
+void synthesize_trace(int gestures, unsigned seed, Trace* trace)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pick_seq(-4, SEQ_COUNT - 1);
+    std::uniform_int_distribution<int> pick_state(0, JOY_STATE_COUNT - 1);
+    std::uniform_int_distribution<int> pick_steps(1, 6);
+    std::uniform_real_distribution<double> pick_radius(105.0, 127.0);
+
+    double pos[2] = {128.0, 128.0};
+    auto move_to = [&](enum joy_state state) {
+        double target[2] = {128.0, 128.0};
+        if (state != JOY_NEUTRAL)
+        {
+            double a = state_angle[state] * M_PI / 180.0;
+            double r = pick_radius(rng);
+            /* Stick gates are round, diagonals don't reach the corners */
+            target[0] = 128.0 + r * std::cos(a);
+            target[1] = 128.0 - r * std::sin(a);
+        }
+
+        int steps = pick_steps(rng);
+        for (int i = 1; i <= steps; ++i)
+        {
+            Event e = {};
+            e.type = Event::SAMPLE;
+            for (int axis = 0; axis != 2; ++axis)
+            {
+                double v = pos[axis] + (target[axis] - pos[axis]) * i / steps;
+                e.xy[axis] = (uint8_t)std::min(255.0, std::max(0.0, std::round(v)));
+            }
+            trace->push_back(e);
+        }
+        pos[0] = target[0];
+        pos[1] = target[1];
+
+        /* Dwell for a bit */
+        for (int i = pick_steps(rng); i; --i)
+            trace->push_back(trace->back());
+    };
+
+    for (int g = 0; g != gestures; ++g)
+    {
+        int seq = pick_seq(rng);
+
+        move_to(JOY_NEUTRAL);
+        if (seq >= 0)
+        {
+            for (uint8_t i = 0; i != 3; ++i)
+                if (seq_state((enum seq)seq, i) != JOY_NEUTRAL)
+                    move_to(seq_state((enum seq)seq, i));
+        }
+        else
+        {
+            /* Flick into a single direction and return, nothing should match */
+            enum joy_state s;
+            do s = (enum joy_state)pick_state(rng); while (s == JOY_NEUTRAL);
+            move_to(s);
+            move_to(JOY_NEUTRAL);
+        }
+
+        Event e = {};
+        e.type = Event::PRESS;
+        e.expected = seq >= 0 ? (uint8_t)seq : (uint8_t)SEQ_NONE;
+        trace->push_back(e);
+        e.type = Event::RELEASE;
+        trace->push_back(e);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+Trace add_noise(const Trace& trace, double sigma, unsigned seed)
+{
+    Trace noisy = trace;
+    if (sigma <= 0.0)
+        return noisy;
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, sigma);
+    for (Event& e : noisy)
+    {
+        if (e.type != Event::SAMPLE)
+            continue;
+        for (int axis = 0; axis != 2; ++axis)
+        {
+            double v = e.xy[axis] + noise(rng);
+            e.xy[axis] = (uint8_t)std::min(255.0, std::max(0.0, std::round(v)));
+        }
+    }
+
+    return noisy;
+}
+
+/* -------------------------------------------------------------------------- */
+bool seq_enabled(uint32_t mask, uint8_t seq)
+{
+    return seq == SEQ_NONE || (mask & (1ul << seq));
+}
+
+/* -------------------------------------------------------------------------- */
+/*!
+ * Runs all traces through the firmware with the given settings. Must be
+ * called from a thread that owns its firmware state (see HOST_LOCAL).
+ */
+Result evaluate(const std::vector<Trace>& traces, uint8_t threshold,
+                uint8_t hysteresis, uint32_t mask, int false_weight)
+{
+    struct config* c = config_get();
+    c->joy.xythreshold = threshold;
+    c->joy.hysteresis = hysteresis;
+    c->enable.bytes[0] = (uint8_t)(mask >> 0);
+    c->enable.bytes[1] = (uint8_t)(mask >> 8);
+    c->enable.bytes[2] = (uint8_t)(mask >> 16);
+
+    Result r = {threshold, hysteresis, mask, 0, 0, 0, 0};
+    for (const Trace& trace : traces)
+    {
+        bool pressed = false;
+        joy_init();
+
+        for (const Event& e : trace)
+        {
+            switch (e.type)
+            {
+            case Event::SAMPLE:
+                if (!pressed)
+                    joy_push_state(e.xy);
+                break;
+
+            case Event::PRESS: {
+                enum seq got = seq_find(joy_state_history());
+                pressed = true;
+
+                /* Labels for disabled sequences can't be detected, skip them */
+                if (!seq_enabled(mask, e.expected))
+                    break;
+
+                r.presses++;
+                if (got == e.expected)
+                    break;
+                if (got == SEQ_NONE)
+                    r.missed++;
+                else
+                    r.false_detections++;
+            } break;
+
+            case Event::RELEASE:
+                pressed = false;
+                break;
+            }
+        }
+    }
+
+    r.score = r.missed + r.false_detections * (uint32_t)false_weight;
+    return r;
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_range(const char* s, Range* r)
+{
+    int n = sscanf(s, "%d:%d:%d", &r->first, &r->last, &r->step);
+    if (n == 1)
+        r->last = r->first;
+    if (n < 3)
+        r->step = 1;
+    return n >= 1 && r->step > 0 && r->first <= r->last &&
+           r->first >= 0 && r->last <= 255;
+}
+
+/* -------------------------------------------------------------------------- */
+void print_usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] [trace files...]\n"
+        "  --synth <n>            Add a synthesized trace with <n> gestures\n"
+        "  --threshold <a[:b[:s]]> Range of joy.xythreshold values (default 20:100:1)\n"
+        "  --hysteresis <a[:b[:s]]> Range of joy.hysteresis values (default 0:40:1)\n"
+        "  --mask <hex>           Enable mask to test, bits 0-%d are the sequences\n"
+        "                         in SEQ_LIST order. Can be repeated (default %06x,\n"
+        "                         all of them)\n"
+        "  --noise <sigma>        Standard deviation of gaussian ADC noise (default 0)\n"
+        "  --repeat <n>           Number of noise realizations per trace (default 1)\n"
+        "  --false-weight <n>     Cost of a false detection relative to a miss (default 2)\n"
+        "  --top <n>              Number of results to print (default 10)\n"
+        "  --threads <n>          Number of worker threads (default: all cores)\n"
+        "  --seed <n>             Seed for noise and synthesized traces (default 1)\n",
+        prog, SEQ_COUNT - 1, (unsigned)all_seq_mask);
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_args(int argc, char** argv, Options* o)
+{
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = true;
+
+        if (arg.rfind("--", 0) != 0)
+        {
+            o->trace_files.push_back(arg);
+            continue;
+        }
+        if (arg == "--help")
+            return false;
+        if (value == nullptr)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        ++i;
+
+        if (arg == "--synth")
+            ok = (o->synth = atoi(value)) > 0;
+        else if (arg == "--threshold")
+            ok = parse_range(value, &o->threshold);
+        else if (arg == "--hysteresis")
+            ok = parse_range(value, &o->hysteresis);
+        else if (arg == "--mask")
+            o->masks.push_back((uint32_t)strtoul(value, nullptr, 16) & all_seq_mask);
+        else if (arg == "--noise")
+            ok = (o->noise = atof(value)) >= 0.0;
+        else if (arg == "--repeat")
+            ok = (o->repeat = atoi(value)) > 0;
+        else if (arg == "--false-weight")
+            ok = (o->false_weight = atoi(value)) >= 0;
+        else if (arg == "--top")
+            ok = (o->top = atoi(value)) > 0;
+        else if (arg == "--threads")
+            ok = (o->threads = (unsigned)atoi(value)) > 0;
+        else if (arg == "--seed")
+            o->seed = (unsigned)strtoul(value, nullptr, 0);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), value);
+            return false;
+        }
+    }
+
+    if (o->trace_files.empty() && o->synth == 0)
+    {
+        fprintf(stderr, "No traces given. Pass trace files and/or --synth <n>\n");
+        return false;
+    }
+    if (o->masks.empty())
+        o->masks.push_back(all_seq_mask);
+    if (o->threads == 0)
+        o->threads = std::max(1u, std::thread::hardware_concurrency());
+
+    return true;
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, &o))
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    Trace clean_trace;
+    for (const std::string& filename : o.trace_files)
+        if (!load_trace(filename, &clean_trace))
+            return -1;
+    if (o.synth)
+        synthesize_trace(o.synth, o.seed, &clean_trace);
+
+    /* Every configuration sees the same noise so the results are comparable */
+    std::vector<Trace> traces;
+    for (int i = 0; i != o.repeat; ++i)
+        traces.push_back(add_noise(clean_trace, o.noise, o.seed + (unsigned)i));
+
+    struct Job { uint8_t threshold, hysteresis; uint32_t mask; };
+    std::vector<Job> jobs;
+    for (uint32_t mask : o.masks)
+        for (int t = o.threshold.first; t <= o.threshold.last; t += o.threshold.step)
+            for (int h = o.hysteresis.first; h <= o.hysteresis.last; h += o.hysteresis.step)
+            {
+                /* The maximum allowable threshold is 128 minus half of the hysteresis */
+                if (t + h / 2 >= 128)
+                    continue;
+                jobs.push_back({(uint8_t)t, (uint8_t)h, mask});
+            }
+
+    fprintf(stderr, "Evaluating %zu configurations with %u threads...\n",
+        jobs.size(), o.threads);
+
+    std::vector<Result> results(jobs.size());
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i != o.threads; ++i)
+        workers.emplace_back([&]() {
+            config_set_defaults();
+            for (size_t j; (j = next_job++) < jobs.size(); )
+                results[j] = evaluate(traces, jobs[j].threshold,
+                    jobs[j].hysteresis, jobs[j].mask, o.false_weight);
+        });
+    for (std::thread& t : workers)
+        t.join();
+
+    /* Prefer wider hysteresis on ties, it is more robust against noise */
+    std::sort(results.begin(), results.end(), [](const Result& a, const Result& b) {
+        if (a.score != b.score)
+            return a.score < b.score;
+        if (a.hysteresis != b.hysteresis)
+            return a.hysteresis > b.hysteresis;
+        if (a.threshold != b.threshold)
+            return a.threshold < b.threshold;
+        return a.mask < b.mask;
+    });
+
+    printf("threshold  hysteresis  mask    presses  missed  false  score\n");
+    for (int i = 0; i != o.top && i != (int)results.size(); ++i)
+    {
+        const Result& r = results[i];
+        printf("%9u  %10u  %06x  %7u  %6u  %5u  %5u\n",
+            r.threshold, r.hysteresis, r.mask, r.presses,
+            r.missed, r.false_detections, r.score);
+    }
+
+    if (!results.empty())
+        printf("\nBest configuration: joy %u %u (mask %06x)\n",
+            results[0].threshold, results[0].hysteresis, results[0].mask);
+
+    return 0;
+}
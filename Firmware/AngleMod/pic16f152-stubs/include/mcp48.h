@@ -0,0 +1,49 @@
+/*!
+ * @file mcp48.h
+ * @brief Model of the MCP48FVB12 dual 10-bit DAC as wired on the board: nCS
+ * on RB4, nLAT on RA2, SDI on the MSSP1 output.
+ *
+ * A command is 3 bytes while nCS is low: <address:5 command:2 x:1> followed
+ * by 16 data bits. Writes to the volatile DAC registers (address 0 and 1)
+ * are copied to the outputs on a falling edge of nLAT, or right away while
+ * nLAT is held low. Raising nCS part-way through a command discards it.
+ */
+#ifndef MCP48_H
+#define MCP48_H
+
+#include <sim.h>
+
+class mcp48 : public sim_device
+{
+public:
+	/* Attaches itself for as long as it exists */
+	explicit mcp48(double vref = 3.3);
+	~mcp48() override;
+
+	uint16_t dac_register(int channel) const { return registers_[channel]; }
+	uint16_t output_code(int channel) const { return outputs_[channel]; }
+	double output_volts(int channel) const;
+
+	unsigned commands() const { return commands_; }    /* Complete commands */
+	unsigned aborted() const { return aborted_; }      /* Cut short by nCS */
+	unsigned unsupported() const { return unsupported_; }  /* Other addresses or commands */
+
+	void sfr_written(enum sfr_id reg, uint8_t old, uint8_t value) override;
+
+private:
+	void execute(void);
+	void latch(void);
+
+	double vref_;
+	bool selected_;
+	bool latch_low_;
+	uint8_t frame_[3];
+	uint8_t received_;
+	uint16_t registers_[2];
+	uint16_t outputs_[2];
+	unsigned commands_;
+	unsigned aborted_;
+	unsigned unsupported_;
+};
+
+#endif
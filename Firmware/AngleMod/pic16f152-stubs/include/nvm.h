@@ -0,0 +1,67 @@
+/*!
+ * @file nvm.h
+ * @brief Model of the program flash memory (PFM) as seen through NVMADR,
+ * NVMDATL, NVMCON1 and NVMCON2, including the SAF rows at 0x1F80-0x1FFF.
+ *
+ * Setting NVMCON1bits.RD loads NVMDATL with the low byte of the addressed
+ * word. Setting WR only does something right after NVMCON2 was written 0x55
+ * then 0xAA with nothing in between, and while WREN is set. With FREE set it
+ * erases the row containing NVMADR, otherwise NVMDATL goes into the write
+ * latch of that word. If LWLO is clear the latches are then programmed into
+ * the row, which can only clear bits, and reset. Erases and row writes stall
+ * the CPU, so they advance sim_time_ns.
+ */
+#ifndef NVM_H
+#define NVM_H
+
+#include <sim.h>
+
+#define NVM_WORDS     8192
+#define NVM_ROW_WORDS 32
+#define NVM_ROWS      (NVM_WORDS / NVM_ROW_WORDS)
+#define NVM_ERASED    0x3FFF
+
+#define SIM_NVM_ERASE_NS 2500000u  /* Self-timed row erase (TPEW) */
+#define SIM_NVM_WRITE_NS 2500000u  /* Self-timed row write (TPEW) */
+
+class nvm : public sim_device
+{
+public:
+	/* Starts out erased and attaches itself for as long as it exists */
+	nvm();
+	~nvm() override;
+
+	uint16_t word(uint16_t addr) const { return words_[addr % NVM_WORDS]; }
+	void set_word(uint16_t addr, uint16_t value) { words_[addr % NVM_WORDS] = value & NVM_ERASED; }
+
+	/* Endurance counters, per row of 32 words */
+	unsigned erases(uint16_t row) const { return erases_[row]; }
+	unsigned writes(uint16_t row) const { return writes_[row]; }
+	unsigned max_erases(void) const;
+
+	unsigned unlock_errors() const { return unlock_errors_; }  /* WR without unlock or WREN */
+	unsigned unerased_writes() const { return unerased_writes_; }  /* Rows with loaded words programmed over old data */
+	uint64_t busy_ns() const { return busy_ns_; }  /* Time stalled erasing and writing */
+
+	/* Longest time GIE was clear so far, for checking interrupt latency */
+	uint64_t max_gie_off_ns() const { return max_gie_off_ns_; }
+
+	void sfr_written(enum sfr_id reg, uint8_t old, uint8_t value) override;
+
+private:
+	void execute(uint8_t con1);
+	void stall(uint64_t ns);
+
+	uint16_t words_[NVM_WORDS];
+	uint16_t latches_[NVM_ROW_WORDS];
+	unsigned erases_[NVM_ROWS];
+	unsigned writes_[NVM_ROWS];
+	uint8_t unlock_;  /* Steps of the unlock sequence seen */
+	unsigned unlock_errors_;
+	unsigned unerased_writes_;
+	uint64_t busy_ns_;
+	uint64_t gie_off_since_;
+	uint64_t max_gie_off_ns_;
+};
+
+#endif
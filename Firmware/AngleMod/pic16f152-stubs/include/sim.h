@@ -0,0 +1,111 @@
+/*!
+ * @file sim.h
+ * @brief Virtual time and a trace of pin and bus activity for host
+ * simulations. The trace can be written as a VCD file and opened in GTKWave.
+ * Each thread simulates a chip of its own, with its own registers, time,
+ * trace and devices.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <xc.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Virtual time in ns. The simulation advances it with sim_time_advance_to().
+ * Every write to an sfr8 takes one instruction cycle, and a write to SSP1BUF
+ * takes as long as the SPI transfer, which dac_buf_transfer() waits for.
+ * The transfer completes immediately and sets SSP1STATbits.BF, like MSSP1
+ * would once the last bit is out. Reading SSP1BUF clears BF again, and reading
+ * RC1REG clears PIR1bits.RC1IF.
+ *
+ * __delay_us() takes as many instruction cycles as it would on the chip.
+ *
+ * All of these scale with sim_fosc_hz, the _32MHZ times below are what they
+ * take at 32 MHz. Writing OSCFRQ sets sim_fosc_hz and takes
+ * sim_clk_switch_ns for HFINTOSC to settle. The UART keeps its baud rate in
+ * every mode, see clk.h.
+ */
+#define SIM_INSTRUCTION_NS_32MHZ 125u   /* Fosc/4 */
+#define SIM_SPI_BYTE_NS_32MHZ    1000u  /* 8 bits at Fosc/4 */
+#define SIM_UART_BYTE_NS         260417u  /* 10 bits at 38400 baud */
+
+extern thread_local uint64_t sim_time_ns;
+extern thread_local uint32_t sim_fosc_hz;
+extern thread_local uint32_t sim_clk_switch_ns;
+
+/*
+ * Sending over the UART is instant unless a simulation models it, in which
+ * case it sets the time at which the shift register is empty again. Until
+ * then TX1STAbits.TRMT reads 0, and each read takes an instruction cycle so
+ * loops waiting for it finish.
+ */
+extern thread_local uint64_t sim_tx_done_ns;
+
+/*
+ * Likewise, a simulation that models receiving sets the time from which the
+ * receiver is idle again, which is the middle of the stop bit. Until then
+ * BAUD1CONbits.RCIDL reads 0.
+ */
+extern thread_local uint64_t sim_rx_idle_ns;
+
+/* Never goes backwards, register writes may already have moved past t */
+void sim_time_advance_to(uint64_t t);
+
+/*
+ * Accesses to each register since the last sim_counts_reset(), for keeping
+ * an eye on the cost of a code path. Reads by device models aren't counted.
+ */
+extern thread_local unsigned sim_sfr_reads[SFR_COUNT];
+extern thread_local unsigned sim_sfr_writes[SFR_COUNT];
+
+void sim_counts_reset(void);
+const char* sim_sfr_name(enum sfr_id reg);
+
+struct sim_event
+{
+	uint64_t time;
+	uint8_t reg;    /* enum sfr_id */
+	uint8_t value;
+};
+
+/*!
+ * @brief A model of a chip on the board. Attached devices see every write to
+ * an sfr8 after it has been stored, in the order they were attached. They
+ * also see reads after the value was sampled, e.g. to change a pin right
+ * after the firmware looked at it.
+ */
+class sim_device
+{
+public:
+	virtual ~sim_device() {}
+	virtual void sfr_written(enum sfr_id reg, uint8_t old, uint8_t value) = 0;
+	virtual void sfr_read(enum sfr_id reg) { (void)reg; }
+};
+
+void sim_attach(sim_device* device);
+void sim_detach(sim_device* device);
+
+/*!
+ * @brief Clears the trace and starts recording, beginning with the current
+ * state of the ports. Port writes are only recorded if they change the
+ * value, SSP1BUF and TX1REG writes always are. The trace holds at most
+ * SIM_TRACE_MAX_EVENTS, later events are counted by sim_trace_dropped().
+ */
+#define SIM_TRACE_MAX_EVENTS (1u << 22)
+
+void sim_trace_start(void);
+void sim_trace_stop(void);
+const struct sim_event* sim_trace_events(size_t* count);
+size_t sim_trace_dropped(void);
+
+/*!
+ * @brief Writes the trace as a VCD file with the signals nLAT, BTN, nCS,
+ * SWX, SWY and the bytes sent on SSP1BUF and UART TX. Returns 0 on failure.
+ */
+int sim_trace_write_vcd(const char* path);
+int sim_trace_write_vcd_to(FILE* fp);
+
+#endif
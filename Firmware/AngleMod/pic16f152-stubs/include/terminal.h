@@ -0,0 +1,28 @@
+/*!
+ * @file terminal.h
+ * @brief What is on the other end of the UART. Collects every byte written
+ * to TX1REG, so output longer than the TX buffer can be checked as a whole.
+ */
+#ifndef TERMINAL_H
+#define TERMINAL_H
+
+#include <sim.h>
+#include <string>
+
+class terminal : public sim_device
+{
+public:
+	/* Attaches itself for as long as it exists */
+	terminal();
+	~terminal() override;
+
+	/* Everything received since the last call */
+	std::string take();
+
+	void sfr_written(enum sfr_id reg, uint8_t old, uint8_t value) override;
+
+private:
+	std::string received_;
+};
+
+#endif
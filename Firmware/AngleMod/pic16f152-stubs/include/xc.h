@@ -7,76 +7,178 @@
 #define NOP()
 #define __interrupt()
 
+/* Busy waits like XC8's, they advance the time of a simulation (see sim.h) */
+void _delay(unsigned long cycles);
+#define __delay_us(x) _delay((unsigned long)((x) * (_XTAL_FREQ / 4000000.0)))
+
+/*
+ * Registers a simulation needs to observe are objects instead of plain
+ * variables. Reading and writing them works like before, but every access is
+ * counted and every write goes through sfr8::write(), which records it in the
+ * trace (see sim.h).
+ */
+#define SFR_LIST \
+	X(PORTA) X(PORTB) X(PORTC) X(LATA) X(LATB) X(LATC) X(IOCAF) \
+	X(PIR1) X(PIE1) X(INTCON) X(TMR1) X(ADRESH) X(ADRESL) X(ADCON0) \
+	X(SSP1BUF) X(SSP1STAT) X(TX1REG) X(TX1STA) X(RC1REG) X(RC1STA) \
+	X(NVMADRL) X(NVMADRH) X(NVMCON1) X(NVMCON2) X(NVMDATL) X(OSCFRQ) \
+	X(BAUD1CON)
+
+enum sfr_id
+{
+#define X(name) SFR_##name,
+	SFR_LIST
+#undef X
+
+	SFR_COUNT
+};
+
+/* Each thread has a register file of its own, so threads can simulate
+ * separate chips side by side (see HOST_LOCAL in host.h) */
+extern thread_local uint8_t sfr_values[SFR_COUNT];
+
+class sfr8
+{
+public:
+	constexpr explicit sfr8(enum sfr_id id) : id_(id) {}
+	sfr8(const sfr8&) = delete;
+	sfr8& operator=(const sfr8&) = delete;
+
+	operator uint8_t() const { return read(); }
+	sfr8& operator=(uint8_t value) { write(value); return *this; }
+	sfr8& operator|=(uint8_t value) { write((uint8_t)(sfr_values[id_] | value)); return *this; }
+	sfr8& operator&=(uint8_t value) { write((uint8_t)(sfr_values[id_] & value)); return *this; }
+	sfr8& operator^=(uint8_t value) { write((uint8_t)(sfr_values[id_] ^ value)); return *this; }
+
+	enum sfr_id id() const { return id_; }
+
+	/* For device models looking at or changing a register on their own, e.g.
+	 * hardware clearing a bit. Isn't counted, traced or seen by devices */
+	uint8_t value() const { return sfr_values[id_]; }
+	void set(uint8_t value) { sfr_values[id_] = value; }
+
+private:
+	uint8_t read() const;
+	void write(uint8_t value);
+
+	enum sfr_id id_;
+};
+
+/* TMR1 is read and written as a pair, which counts as two accesses */
+class sfr16
+{
+public:
+	constexpr explicit sfr16(enum sfr_id id) : id_(id) {}
+	sfr16(const sfr16&) = delete;
+	sfr16& operator=(const sfr16&) = delete;
+
+	operator uint16_t() const { return read(); }
+	sfr16& operator=(uint16_t value) { write(value); return *this; }
+
+	/* Like sfr8::value() and sfr8::set(), e.g. for a model of the timer */
+	uint16_t value() const;
+	void set(uint16_t value);
+
+private:
+	uint16_t read() const;
+	void write(uint16_t value);
+
+	enum sfr_id id_;
+};
+
+/* A single bit of an sfr8, so PORTAbits.RA2 and PORTA are the same register
+ * like on the chip */
+template <sfr8& R, unsigned B>
+struct sfr_bit
+{
+	sfr_bit& operator=(unsigned value)
+	{
+		if (value)
+			R |= (uint8_t)(1u << B);
+		else
+			R &= (uint8_t)~(1u << B);
+		return *this;
+	}
+	operator unsigned() const { return ((uint8_t)R >> B) & 1u; }
+};
+
 struct PIR0bits {
 	uint8_t INTF;
 	uint8_t TMR0IF;
 };
 extern volatile struct PIR0bits PIR0bits;
 
+extern sfr8 PIR1;
+
 struct PIR1bits {
-	uint8_t ADIF;
-	uint8_t RC1IF;
-	uint8_t TX1IF;
+	sfr_bit<PIR1, 5> RC1IF;
+	sfr_bit<PIR1, 4> TX1IF;
+	sfr_bit<PIR1, 0> ADIF;
 };
-extern volatile struct PIR1bits PIR1bits;
+extern struct PIR1bits PIR1bits;
 
 struct PIE0bits {
 	unsigned TMR0IE : 1;
+	unsigned IOCIE : 1;
 };
 extern volatile struct PIE0bits PIE0bits;
 
+extern sfr8 PIE1;
+
 struct PIE1bits {
-	unsigned TX1IE : 1;
-	unsigned RC1IE : 1;
-	unsigned ADIE : 1;
+	sfr_bit<PIE1, 5> RC1IE;
+	sfr_bit<PIE1, 4> TX1IE;
+	sfr_bit<PIE1, 0> ADIE;
 };
-extern volatile struct PIE1bits PIE1bits;
+extern struct PIE1bits PIE1bits;
+
+extern sfr8 PORTA;
+extern sfr8 PORTB;
+extern sfr8 PORTC;
+
+extern sfr8 LATA;
+extern sfr8 LATB;
+extern sfr8 LATC;
 
 struct PORTAbits {
-	unsigned RA0 : 1;
-	unsigned RA1 : 1;
-	unsigned RA2 : 1;
-	unsigned RA3 : 1;
-	unsigned RA4 : 1;
-	unsigned RA5 : 1;
-	unsigned RA6 : 1;
-	unsigned RA7 : 1;
+	sfr_bit<PORTA, 0> RA0;
+	sfr_bit<PORTA, 1> RA1;
+	sfr_bit<PORTA, 2> RA2;
+	sfr_bit<PORTA, 3> RA3;
+	sfr_bit<PORTA, 4> RA4;
+	sfr_bit<PORTA, 5> RA5;
+	sfr_bit<PORTA, 6> RA6;
+	sfr_bit<PORTA, 7> RA7;
 };
-extern volatile struct PORTAbits PORTAbits;
+extern struct PORTAbits PORTAbits;
 
 struct PORTBbits {
-	unsigned RB0 : 1;
-	unsigned RB1 : 1;
-	unsigned RB2 : 1;
-	unsigned RB3 : 1;
-	unsigned RB4 : 1;
-	unsigned RB5 : 1;
-	unsigned RB6 : 1;
-	unsigned RB7 : 1;
+	sfr_bit<PORTB, 0> RB0;
+	sfr_bit<PORTB, 1> RB1;
+	sfr_bit<PORTB, 2> RB2;
+	sfr_bit<PORTB, 3> RB3;
+	sfr_bit<PORTB, 4> RB4;
+	sfr_bit<PORTB, 5> RB5;
+	sfr_bit<PORTB, 6> RB6;
+	sfr_bit<PORTB, 7> RB7;
 };
-extern volatile struct PORTBbits PORTBbits;
+extern struct PORTBbits PORTBbits;
 
 struct PORTCbits {
-	unsigned RC0 : 1;
-	unsigned RC1 : 1;
-	unsigned RC2 : 1;
-	unsigned RC3 : 1;
-	unsigned RC4 : 1;
-	unsigned RC5 : 1;
-	unsigned RC6 : 1;
-	unsigned RC7 : 1;
+	sfr_bit<PORTC, 0> RC0;
+	sfr_bit<PORTC, 1> RC1;
+	sfr_bit<PORTC, 2> RC2;
+	sfr_bit<PORTC, 3> RC3;
+	sfr_bit<PORTC, 4> RC4;
+	sfr_bit<PORTC, 5> RC5;
+	sfr_bit<PORTC, 6> RC6;
+	sfr_bit<PORTC, 7> RC7;
 };
-extern volatile struct PORTCbits PORTCbits;
+extern struct PORTCbits PORTCbits;
 
-extern volatile uint8_t IOCAF;
-
-extern volatile uint8_t PORTA;
-extern volatile uint8_t PORTB;
-extern volatile uint8_t PORTC;
-
-extern volatile uint8_t LATA;
-extern volatile uint8_t LATB;
-extern volatile uint8_t LATC;
+extern sfr8 IOCAF;
+extern volatile uint8_t IOCAP;
+extern volatile uint8_t IOCAN;
 
 extern volatile uint8_t TRISA;
 extern volatile uint8_t TRISB;
@@ -86,12 +188,15 @@ extern volatile uint8_t ANSELA;
 extern volatile uint8_t ANSELB;
 extern volatile uint8_t ANSELC;
 
+extern volatile uint8_t WPUC;
+
 extern volatile uint8_t RC1PPS;
 extern volatile uint8_t RC2PPS;
 extern volatile uint8_t RC6PPS;
 
 extern volatile uint8_t INTPPS;
 extern volatile uint8_t SSP1DATPPS;
+extern volatile uint8_t SSP1SSPPS;
 extern volatile uint8_t RX1PPS;
 
 struct T0CON0bits {
@@ -108,46 +213,76 @@ extern volatile uint8_t T0CON1;
 
 extern volatile uint8_t TMR0H;
 
+extern volatile uint8_t T1CON;
+extern volatile uint8_t T1CLK;
+extern sfr16 TMR1;
+
+extern volatile uint8_t T2CON;
+extern volatile uint8_t T2CLKCON;
+extern volatile uint8_t T2PR;
+
+extern sfr8 INTCON;
+
 struct INTCONbits {
-	uint8_t GIE;
+	sfr_bit<INTCON, 7> GIE;
 };
-extern volatile struct INTCONbits INTCONbits;
-extern volatile uint8_t INTCON;
+extern struct INTCONbits INTCONbits;
+
+extern volatile uint16_t NVMADR;
+extern sfr8 NVMADRL;
+extern sfr8 NVMADRH;
+extern sfr8 NVMCON1;
+extern sfr8 NVMCON2;
+extern sfr8 NVMDATL;
 
 struct NVMCON1bits {
-	unsigned NVMREGS : 1;
-	unsigned FREE : 1;
-	unsigned WREN : 1;
-	unsigned LWLO : 1;
-	unsigned WR : 1;
-	unsigned RD : 1;
-	unsigned WRERR : 1;
+	sfr_bit<NVMCON1, 6> NVMREGS;
+	sfr_bit<NVMCON1, 5> LWLO;
+	sfr_bit<NVMCON1, 4> FREE;
+	sfr_bit<NVMCON1, 3> WRERR;
+	sfr_bit<NVMCON1, 2> WREN;
+	sfr_bit<NVMCON1, 1> WR;
+	sfr_bit<NVMCON1, 0> RD;
 };
-extern volatile struct NVMCON1bits NVMCON1bits;
-
-extern volatile uint16_t NVMADR;
-extern volatile uint8_t NVMADRL;
-extern volatile uint8_t NVMADRH;
-extern volatile uint8_t NVMCON1;
-extern volatile uint8_t NVMCON2;
-extern volatile uint8_t NVMDATL;
+extern struct NVMCON1bits NVMCON1bits;
 
 extern volatile uint8_t SP1BRG;
-extern volatile uint8_t TX1STA;
-extern volatile uint8_t RC1STA;
-extern volatile uint8_t TX1REG;
-extern volatile uint8_t RC1REG;
+extern sfr8 BAUD1CON;
+
+struct BAUD1CONbits {
+	sfr_bit<BAUD1CON, 6> RCIDL;
+};
+extern struct BAUD1CONbits BAUD1CONbits;
+extern sfr8 TX1STA;
+
+struct TX1STAbits {
+	sfr_bit<TX1STA, 1> TRMT;
+};
+extern struct TX1STAbits TX1STAbits;
+extern sfr8 RC1STA;
+extern sfr8 TX1REG;
+extern sfr8 RC1REG;
+
+extern sfr8 SSP1STAT;
 
 struct SSP1STATbits {
-	unsigned BF : 1;
+	sfr_bit<SSP1STAT, 0> BF;
 };
-extern volatile struct SSP1STATbits SSP1STATbits;
-extern volatile uint8_t SSP1BUF;
+extern struct SSP1STATbits SSP1STATbits;
+extern sfr8 SSP1BUF;
 extern volatile uint8_t SSP1CON1;
 
-extern volatile uint8_t ADRESH;
-extern volatile uint8_t ADCON0;
+extern sfr8 ADRESH;
+extern sfr8 ADRESL;
+extern sfr8 ADCON0;
 extern volatile uint8_t ADCON1;
+
+extern sfr8 OSCFRQ;
+
+struct OSCSTATbits {
+	uint8_t HFOR;
+};
+extern volatile struct OSCSTATbits OSCSTATbits;
 extern volatile uint8_t ADACT;
 
 #endif
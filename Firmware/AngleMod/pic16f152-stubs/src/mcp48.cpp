@@ -0,0 +1,91 @@
+#include <mcp48.h>
+
+#define NCS_BIT  0x10  /* RB4 */
+#define NLAT_BIT 0x04  /* RA2 */
+
+/* -------------------------------------------------------------------------- */
+mcp48::mcp48(double vref) :
+	vref_(vref),
+	selected_((PORTB.value() & NCS_BIT) == 0),
+	latch_low_((PORTA.value() & NLAT_BIT) == 0),
+	frame_{0, 0, 0},
+	received_(0),
+	registers_{0, 0},
+	outputs_{0, 0},
+	commands_(0),
+	aborted_(0),
+	unsupported_(0)
+{
+	sim_attach(this);
+}
+
+mcp48::~mcp48()
+{
+	sim_detach(this);
+}
+
+/* -------------------------------------------------------------------------- */
+double mcp48::output_volts(int channel) const
+{
+	return vref_ * outputs_[channel] / 1024.0;
+}
+
+/* -------------------------------------------------------------------------- */
+void mcp48::sfr_written(enum sfr_id reg, uint8_t old, uint8_t value)
+{
+	(void)old;
+
+	/* PORTx writes go to the output latch on the chip, so both drive the pin */
+	if (reg == SFR_PORTB || reg == SFR_LATB)
+	{
+		bool selected = (value & NCS_BIT) == 0;
+		if (selected != selected_)
+		{
+			if (!selected && received_ != 0)
+				aborted_++;
+			received_ = 0;
+			selected_ = selected;
+		}
+	}
+	else if (reg == SFR_PORTA || reg == SFR_LATA)
+	{
+		bool low = (value & NLAT_BIT) == 0;
+		if (low && !latch_low_)
+			latch();
+		latch_low_ = low;
+	}
+	else if (reg == SFR_SSP1BUF && selected_)
+	{
+		frame_[received_++] = value;
+		if (received_ == 3)
+		{
+			execute();
+			received_ = 0;
+		}
+	}
+}
+
+/* -------------------------------------------------------------------------- */
+void mcp48::execute(void)
+{
+	uint8_t address = frame_[0] >> 3;
+	uint8_t command = (frame_[0] >> 1) & 0x03;
+
+	commands_++;
+	if (command != 0 || address > 1)
+	{
+		unsupported_++;
+		return;
+	}
+
+	registers_[address] = (uint16_t)(((frame_[1] << 8) | frame_[2]) & 0x3FF);
+	if (latch_low_)
+		outputs_[address] = registers_[address];
+}
+
+/* -------------------------------------------------------------------------- */
+void mcp48::latch(void)
+{
+	outputs_[0] = registers_[0];
+	outputs_[1] = registers_[1];
+}
@@ -0,0 +1,130 @@
+#include <nvm.h>
+
+#define RD      0x01
+#define WR      0x02
+#define WREN    0x04
+#define FREE    0x10
+#define LWLO    0x20
+#define NVMREGS 0x40
+#define GIE     0x80
+
+/* -------------------------------------------------------------------------- */
+nvm::nvm() :
+	latches_{},
+	erases_{},
+	writes_{},
+	unlock_(0),
+	unlock_errors_(0),
+	unerased_writes_(0),
+	busy_ns_(0),
+	gie_off_since_(sim_time_ns),
+	max_gie_off_ns_(0)
+{
+	for (uint16_t& w : words_)
+		w = NVM_ERASED;
+	for (uint16_t& l : latches_)
+		l = NVM_ERASED;
+	sim_attach(this);
+}
+
+nvm::~nvm()
+{
+	sim_detach(this);
+}
+
+/* -------------------------------------------------------------------------- */
+unsigned nvm::max_erases(void) const
+{
+	unsigned max = 0;
+	for (unsigned e : erases_)
+		if (max < e)
+			max = e;
+	return max;
+}
+
+/* -------------------------------------------------------------------------- */
+void nvm::sfr_written(enum sfr_id reg, uint8_t old, uint8_t value)
+{
+	if (reg == SFR_INTCON)
+	{
+		if ((old & GIE) && !(value & GIE))
+			gie_off_since_ = sim_time_ns;
+		else if (!(old & GIE) && (value & GIE) && max_gie_off_ns_ < sim_time_ns - gie_off_since_)
+			max_gie_off_ns_ = sim_time_ns - gie_off_since_;
+	}
+
+	/* The unlock sequence has to be written without anything in between */
+	if (reg == SFR_NVMCON2)
+	{
+		if (value == 0x55)
+			unlock_ = 1;
+		else if (value == 0xAA && unlock_ == 1)
+			unlock_ = 2;
+		else
+			unlock_ = 0;
+		return;
+	}
+
+	if (reg == SFR_NVMCON1)
+	{
+		if ((value & RD) && !(old & RD))
+		{
+			if (!(value & NVMREGS))
+				NVMDATL.set((uint8_t)word((uint16_t)(NVMADRH.value() << 8 | NVMADRL.value())));
+			value &= (uint8_t)~RD;
+		}
+		if ((value & WR) && !(old & WR))
+		{
+			if (unlock_ == 2 && (value & WREN) && !(value & NVMREGS))
+				execute(value);
+			else
+				unlock_errors_++;
+			value &= (uint8_t)~WR;
+		}
+		NVMCON1.set(value);  /* RD and WR clear once done */
+	}
+
+	unlock_ = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+void nvm::execute(uint8_t con1)
+{
+	uint16_t addr = (uint16_t)((NVMADRH.value() << 8 | NVMADRL.value()) % NVM_WORDS);
+	uint16_t row = addr / NVM_ROW_WORDS;
+	uint16_t* words = &words_[row * NVM_ROW_WORDS];
+
+	if (con1 & FREE)
+	{
+		for (int i = 0; i != NVM_ROW_WORDS; ++i)
+			words[i] = NVM_ERASED;
+		erases_[row]++;
+		stall(SIM_NVM_ERASE_NS);
+		return;
+	}
+
+	/* Only NVMDATL is modeled, the upper 6 bits of the word program as 0 */
+	latches_[addr % NVM_ROW_WORDS] = NVMDATL.value();
+	if (con1 & LWLO)
+		return;
+
+	bool unerased = false;
+	for (int i = 0; i != NVM_ROW_WORDS; ++i)
+	{
+		if (latches_[i] != NVM_ERASED && words[i] != NVM_ERASED)
+			unerased = true;
+		words[i] &= latches_[i];
+		latches_[i] = NVM_ERASED;
+	}
+	if (unerased)
+		unerased_writes_++;
+	writes_[row]++;
+	stall(SIM_NVM_WRITE_NS);
+}
+
+/* -------------------------------------------------------------------------- */
+void nvm::stall(uint64_t ns)
+{
+	sim_time_ns += ns;
+	busy_ns_ += ns;
+}
@@ -1,22 +1,26 @@
 #include <xc.h>
 
 volatile struct PIR0bits PIR0bits;
-volatile struct PIR1bits PIR1bits;
+sfr8 PIR1(SFR_PIR1);
+struct PIR1bits PIR1bits;
 volatile struct PIE0bits PIE0bits;
-volatile struct PIE1bits PIE1bits;
-volatile struct PORTAbits PORTAbits;
-volatile struct PORTBbits PORTBbits;
-volatile struct PORTCbits PORTCbits;
+sfr8 PIE1(SFR_PIE1);
+struct PIE1bits PIE1bits;
+struct PORTAbits PORTAbits;
+struct PORTBbits PORTBbits;
+struct PORTCbits PORTCbits;
 
-volatile uint8_t IOCAF;
+sfr8 IOCAF(SFR_IOCAF);
+volatile uint8_t IOCAP;
+volatile uint8_t IOCAN;
 
-volatile uint8_t PORTA;
-volatile uint8_t PORTB;
-volatile uint8_t PORTC;
+sfr8 PORTA(SFR_PORTA);
+sfr8 PORTB(SFR_PORTB);
+sfr8 PORTC(SFR_PORTC);
 
-volatile uint8_t LATA;
-volatile uint8_t LATB;
-volatile uint8_t LATC;
+sfr8 LATA(SFR_LATA);
+sfr8 LATB(SFR_LATB);
+sfr8 LATC(SFR_LATC);
 
 volatile uint8_t TRISA;
 volatile uint8_t TRISB;
@@ -26,42 +30,61 @@ volatile uint8_t ANSELA;
 volatile uint8_t ANSELB;
 volatile uint8_t ANSELC;
 
+volatile uint8_t WPUC;
+
 volatile uint8_t RC1PPS;
 volatile uint8_t RC2PPS;
 volatile uint8_t RC6PPS;
 
 volatile uint8_t INTPPS;
 volatile uint8_t SSP1DATPPS;
+volatile uint8_t SSP1SSPPS;
 volatile uint8_t RX1PPS;
 
 volatile struct T0CON0bits T0CON0bits;
 volatile struct T0CON1bits T0CON1bits;
 
 volatile uint8_t TMR0H;
+
+volatile uint8_t T1CON;
+volatile uint8_t T1CLK;
+sfr16 TMR1(SFR_TMR1);
 volatile uint8_t T0CON1;
 
-volatile struct INTCONbits INTCONbits;
-volatile struct NVMCON1bits NVMCON1bits;
-volatile uint8_t INTCON;
+volatile uint8_t T2CON;
+volatile uint8_t T2CLKCON;
+volatile uint8_t T2PR;
 
-volatile uint16_t NVMADR; 
-volatile uint8_t NVMADRL;
-volatile uint8_t NVMADRH;
-volatile uint8_t NVMCON1;
-volatile uint8_t NVMCON2;
-volatile uint8_t NVMDATL;
+sfr8 INTCON(SFR_INTCON);
+struct INTCONbits INTCONbits;
+
+volatile uint16_t NVMADR;
+sfr8 NVMADRL(SFR_NVMADRL);
+sfr8 NVMADRH(SFR_NVMADRH);
+sfr8 NVMCON1(SFR_NVMCON1);
+sfr8 NVMCON2(SFR_NVMCON2);
+sfr8 NVMDATL(SFR_NVMDATL);
+struct NVMCON1bits NVMCON1bits;
 
 volatile uint8_t SP1BRG;
-volatile uint8_t TX1STA;
-volatile uint8_t RC1STA;
-volatile uint8_t TX1REG;
-volatile uint8_t RC1REG;
+sfr8 BAUD1CON(SFR_BAUD1CON);
+struct BAUD1CONbits BAUD1CONbits;
+sfr8 TX1STA(SFR_TX1STA);
+struct TX1STAbits TX1STAbits;
+sfr8 RC1STA(SFR_RC1STA);
+sfr8 TX1REG(SFR_TX1REG);
+sfr8 RC1REG(SFR_RC1REG);
 
-volatile struct SSP1STATbits SSP1STATbits;
-volatile uint8_t SSP1BUF;
+sfr8 SSP1STAT(SFR_SSP1STAT);
+struct SSP1STATbits SSP1STATbits;
+sfr8 SSP1BUF(SFR_SSP1BUF);
 volatile uint8_t SSP1CON1;
 
-volatile uint8_t ADRESH;
-volatile uint8_t ADCON0;
+sfr8 ADRESH(SFR_ADRESH);
+sfr8 ADRESL(SFR_ADRESL);
+sfr8 ADCON0(SFR_ADCON0);
 volatile uint8_t ADCON1;
 volatile uint8_t ADACT;
+
+sfr8 OSCFRQ(SFR_OSCFRQ);
+volatile struct OSCSTATbits OSCSTATbits = {1};  /* Settling is part of the OSCFRQ write */
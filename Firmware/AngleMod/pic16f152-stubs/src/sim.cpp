@@ -0,0 +1,323 @@
+#include <sim.h>
+#include <stdio.h>
+#include <vector>
+
+/* Like the registers, all of the simulation state is per thread */
+thread_local uint8_t sfr_values[SFR_COUNT];
+thread_local uint64_t sim_time_ns;
+thread_local uint32_t sim_fosc_hz = 32000000u;
+thread_local uint32_t sim_clk_switch_ns = 10000u;
+thread_local uint64_t sim_tx_done_ns;
+thread_local uint64_t sim_rx_idle_ns;
+thread_local unsigned sim_sfr_reads[SFR_COUNT];
+thread_local unsigned sim_sfr_writes[SFR_COUNT];
+
+static thread_local uint16_t sfr16_values[SFR_COUNT];
+static thread_local bool recording;
+static thread_local std::vector<sim_event> events;
+static thread_local size_t dropped;
+static thread_local std::vector<sim_device*> devices;
+
+/* -------------------------------------------------------------------------- */
+void sim_time_advance_to(uint64_t t)
+{
+	if (t > sim_time_ns)
+		sim_time_ns = t;
+}
+
+/* -------------------------------------------------------------------------- */
+void sim_counts_reset(void)
+{
+	for (int i = 0; i != SFR_COUNT; ++i)
+	{
+		sim_sfr_reads[i] = 0;
+		sim_sfr_writes[i] = 0;
+	}
+}
+
+const char* sim_sfr_name(enum sfr_id reg)
+{
+	static const char* names[] = {
+#define X(name) #name,
+		SFR_LIST
+#undef X
+	};
+	return names[reg];
+}
+
+/* Scaled from the time at 32 MHz */
+static uint64_t at_fosc(uint64_t ns)
+{
+	return ns * 32000000u / sim_fosc_hz;
+}
+
+/* -------------------------------------------------------------------------- */
+void _delay(unsigned long cycles)
+{
+	sim_time_ns += cycles * at_fosc(SIM_INSTRUCTION_NS_32MHZ);
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t sfr8::read() const
+{
+	uint8_t value = sfr_values[id_];
+	sim_sfr_reads[id_]++;
+	if (id_ == SFR_SSP1BUF)
+		SSP1STAT.set(SSP1STAT.value() & ~0x01);  /* BF */
+	else if (id_ == SFR_RC1REG)
+		PIR1.set(PIR1.value() & ~0x20);  /* RC1IF */
+	else if (id_ == SFR_TX1STA)
+	{
+		if (sim_time_ns >= sim_tx_done_ns)
+			value |= 0x02;  /* TRMT */
+		else
+		{
+			sim_time_ns += at_fosc(SIM_INSTRUCTION_NS_32MHZ);
+			value &= ~0x02;
+		}
+	}
+	else if (id_ == SFR_BAUD1CON)
+	{
+		if (sim_time_ns >= sim_rx_idle_ns)
+			value |= 0x40;  /* RCIDL */
+		else
+		{
+			sim_time_ns += at_fosc(SIM_INSTRUCTION_NS_32MHZ);
+			value &= ~0x40;
+		}
+	}
+
+	for (sim_device* device : devices)
+		device->sfr_read(id_);
+	return value;
+}
+
+/* -------------------------------------------------------------------------- */
+void sfr8::write(uint8_t value)
+{
+	uint8_t old = sfr_values[id_];
+	sfr_values[id_] = value;
+	sim_sfr_writes[id_]++;
+
+	if (recording && (old != value || id_ == SFR_SSP1BUF || id_ == SFR_TX1REG))
+	{
+		if (events.size() < SIM_TRACE_MAX_EVENTS)
+			events.push_back({sim_time_ns, (uint8_t)id_, value});
+		else
+			dropped++;
+	}
+
+	if (id_ == SFR_SSP1BUF)
+	{
+		sim_time_ns += at_fosc(SIM_SPI_BYTE_NS_32MHZ);
+		SSP1STAT.set(SSP1STAT.value() | 0x01);  /* BF */
+	}
+	else if (id_ == SFR_OSCFRQ)
+	{
+		/* HFFRQ=000 is 1 MHz, each step doubles up to 101 at 32 MHz */
+		uint8_t hffrq = value & 0x07;
+		sim_fosc_hz = 1000000u << (hffrq > 5 ? 5 : hffrq);
+		sim_time_ns += sim_clk_switch_ns;
+	}
+	else
+		sim_time_ns += at_fosc(SIM_INSTRUCTION_NS_32MHZ);
+
+	for (sim_device* device : devices)
+		device->sfr_written(id_, old, value);
+}
+
+/* -------------------------------------------------------------------------- */
+uint16_t sfr16::read() const
+{
+	sim_sfr_reads[id_] += 2;
+	return sfr16_values[id_];
+}
+
+void sfr16::write(uint16_t value)
+{
+	sfr16_values[id_] = value;
+	sim_sfr_writes[id_] += 2;
+	sim_time_ns += at_fosc(2 * SIM_INSTRUCTION_NS_32MHZ);
+}
+
+uint16_t sfr16::value() const
+{
+	return sfr16_values[id_];
+}
+
+void sfr16::set(uint16_t value)
+{
+	sfr16_values[id_] = value;
+}
+
+/* -------------------------------------------------------------------------- */
+void sim_attach(sim_device* device)
+{
+	devices.push_back(device);
+}
+
+void sim_detach(sim_device* device)
+{
+	for (size_t i = 0; i != devices.size(); ++i)
+		if (devices[i] == device)
+		{
+			devices.erase(devices.begin() + i);
+			return;
+		}
+}
+
+/* -------------------------------------------------------------------------- */
+void sim_trace_start(void)
+{
+	events.clear();
+	dropped = 0;
+	events.push_back({sim_time_ns, SFR_PORTA, PORTA.value()});
+	events.push_back({sim_time_ns, SFR_PORTB, PORTB.value()});
+	events.push_back({sim_time_ns, SFR_PORTC, PORTC.value()});
+	recording = true;
+}
+
+void sim_trace_stop(void)
+{
+	recording = false;
+}
+
+const struct sim_event* sim_trace_events(size_t* count)
+{
+	*count = events.size();
+	return events.data();
+}
+
+size_t sim_trace_dropped(void)
+{
+	return dropped;
+}
+
+/* -------------------------------------------------------------------------- */
+struct signal
+{
+	const char* name;
+	uint8_t reg;
+	int8_t bit;        /* -1 for the whole byte */
+	uint32_t hold_ns;  /* How long a byte is shown for */
+};
+
+static const signal signals[] = {
+	{"nLAT",    SFR_PORTA,   2,  0},
+	{"BTN",     SFR_PORTA,   4,  0},
+	{"nCS",     SFR_PORTB,   4,  0},
+	{"SWX",     SFR_PORTC,   5,  0},
+	{"SWY",     SFR_PORTC,   4,  0},
+	{"SSP1BUF", SFR_SSP1BUF, -1, SIM_SPI_BYTE_NS_32MHZ},
+	{"UART_TX", SFR_TX1REG,  -1, SIM_UART_BYTE_NS}
+};
+#define SIGNAL_COUNT (sizeof(signals) / sizeof(*signals))
+#define NO_RELEASE UINT64_MAX
+
+struct vcd_writer
+{
+	FILE* fp;
+	uint64_t now;
+	int state[SIGNAL_COUNT];
+	uint64_t release[SIGNAL_COUNT];  /* When a byte goes back to x */
+
+	void at(uint64_t t)
+	{
+		if (t != now)
+			fprintf(fp, "#%llu\n", (unsigned long long)t);
+		now = t;
+	}
+
+	void byte(size_t i, int value)
+	{
+		char bits[9] = "xxxxxxxx";
+		for (int b = 0; value >= 0 && b != 8; ++b)
+			bits[b] = (char)('0' + ((value >> (7 - b)) & 1));
+		fprintf(fp, "b%s %c\n", bits, (char)('!' + i));
+	}
+
+	/* Puts bytes whose time on the wire ended before t back to x, in order. A
+	 * byte that follows right away replaces the previous one without a gap */
+	void release_until(uint64_t t)
+	{
+		for (;;)
+		{
+			size_t first = SIGNAL_COUNT;
+			for (size_t i = 0; i != SIGNAL_COUNT; ++i)
+				if (release[i] < t && (first == SIGNAL_COUNT || release[i] < release[first]))
+					first = i;
+			if (first == SIGNAL_COUNT)
+				return;
+			at(release[first]);
+			byte(first, -1);
+			release[first] = NO_RELEASE;
+		}
+	}
+
+	void event(const sim_event& e)
+	{
+		release_until(e.time);
+		for (size_t i = 0; i != SIGNAL_COUNT; ++i)
+		{
+			const signal& s = signals[i];
+			if (s.reg != e.reg)
+				continue;
+
+			if (s.bit >= 0)
+			{
+				int value = (e.value >> s.bit) & 1;
+				if (value == state[i])
+					continue;
+				at(e.time);
+				fprintf(fp, "%d%c\n", value, (char)('!' + i));
+				state[i] = value;
+			}
+			else
+			{
+				at(e.time);
+				byte(i, e.value);
+				release[i] = e.time + s.hold_ns;
+			}
+		}
+	}
+};
+
+int sim_trace_write_vcd(const char* path)
+{
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL)
+		return 0;
+	int ok = sim_trace_write_vcd_to(fp);
+	return fclose(fp) == 0 && ok;
+}
+
+int sim_trace_write_vcd_to(FILE* fp)
+{
+	vcd_writer w;
+	w.fp = fp;
+
+	fprintf(w.fp, "$timescale 1ns $end\n$scope module anglemod $end\n");
+	for (size_t i = 0; i != SIGNAL_COUNT; ++i)
+		fprintf(w.fp, "$var wire %d %c %s $end\n",
+			signals[i].bit >= 0 ? 1 : 8, (char)('!' + i), signals[i].name);
+	fprintf(w.fp, "$upscope $end\n$enddefinitions $end\n");
+
+	w.now = events.empty() ? sim_time_ns : events.front().time;
+	fprintf(w.fp, "#%llu\n$dumpvars\n", (unsigned long long)w.now);
+	for (size_t i = 0; i != SIGNAL_COUNT; ++i)
+	{
+		w.state[i] = -1;
+		w.release[i] = NO_RELEASE;
+		if (signals[i].bit >= 0)
+			fprintf(w.fp, "x%c\n", (char)('!' + i));
+		else
+			w.byte(i, -1);
+	}
+	fprintf(w.fp, "$end\n");
+
+	for (const sim_event& e : events)
+		w.event(e);
+	w.release_until(NO_RELEASE - 1);
+
+	return !ferror(fp);
+}
@@ -0,0 +1,28 @@
+#include <terminal.h>
+
+/* -------------------------------------------------------------------------- */
+terminal::terminal()
+{
+	sim_attach(this);
+}
+
+terminal::~terminal()
+{
+	sim_detach(this);
+}
+
+/* -------------------------------------------------------------------------- */
+std::string terminal::take()
+{
+	std::string s;
+	s.swap(received_);
+	return s;
+}
+
+/* -------------------------------------------------------------------------- */
+void terminal::sfr_written(enum sfr_id reg, uint8_t old, uint8_t value)
+{
+	(void)old;
+	if (reg == SFR_TX1REG)
+		received_ += (char)value;
+}
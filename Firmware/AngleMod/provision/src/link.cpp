@@ -0,0 +1,277 @@
+#include "link.hpp"
+#include "anglemod/bin.h"
+#include "anglemod/seq.h"
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+/* Must match bin_crc8() in bin.c */
+uint8_t crc8(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (int i = 0; i != 8; ++i)
+        crc = (uint8_t)(crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+    return crc;
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+Link::~Link()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::fail(const char* fmt, ...)
+{
+    char buf[256];
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, va);
+    va_end(va);
+    error_ = buf;
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::open_port(const std::string& path)
+{
+    fd_ = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd_ < 0)
+        return fail("%s: %s", path.c_str(), strerror(errno));
+
+    /* Ptys used for testing don't support every attribute, ignore errors */
+    struct termios t;
+    if (tcgetattr(fd_, &t) == 0)
+    {
+        cfmakeraw(&t);
+        cfsetispeed(&t, B38400);
+        cfsetospeed(&t, B38400);
+        tcsetattr(fd_, TCSANOW, &t);
+    }
+
+    /* Abort whatever is on the CLI line and drop the prompt */
+    if (!write_all("\x03", 1))
+        return false;
+    drain(100);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::request(uint8_t op, uint8_t offset, const std::vector<uint8_t>& payload,
+                   uint8_t read_len, uint8_t* status, std::vector<uint8_t>* response)
+{
+    std::vector<uint8_t> frame = {BIN_STX, op, offset,
+        (uint8_t)(payload.empty() ? read_len : payload.size())};
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    uint8_t crc = 0;
+    for (size_t i = 1; i != frame.size(); ++i)
+        crc = crc8(crc, frame[i]);
+    frame.push_back(crc);
+
+    for (int attempt = 0; attempt != 3; ++attempt)
+    {
+        if (!write_all(frame.data(), frame.size()))
+            return false;
+        if (read_response(status, response) && *status != BIN_BAD_CRC)
+            return true;
+        drain(50);
+    }
+
+    return fail("No valid response to op %d at offset %d", op & 0x0F, offset);
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::get_info(Info* info)
+{
+    uint8_t status;
+    std::vector<uint8_t> resp;
+    if (!request(BIN_OP_INFO, 0, {}, 0, &status, &resp))
+        return false;
+    if (status != BIN_OK || resp.size() < 4)
+        return fail("Unexpected INFO response (status %d)", status);
+    *info = {resp[0], resp[1], resp[2], resp[3]};
+    max_len_ = info->max_len;
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::read_op(uint8_t op, uint8_t offset, uint8_t len, std::vector<uint8_t>* out)
+{
+    out->clear();
+    while (len)
+    {
+        uint8_t chunk = len < max_len_ ? len : max_len_;
+        uint8_t status;
+        std::vector<uint8_t> resp;
+        if (!request(op, offset, {}, chunk, &status, &resp))
+            return false;
+        if (status != BIN_OK || resp.size() != chunk)
+            return fail("Read of %d bytes at offset %d failed (status %d)", chunk, offset, status);
+        out->insert(out->end(), resp.begin(), resp.end());
+        offset = (uint8_t)(offset + chunk);
+        len = (uint8_t)(len - chunk);
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::write_op(uint8_t op, uint8_t offset, const std::vector<uint8_t>& data)
+{
+    for (size_t i = 0; i < data.size(); i += max_len_)
+    {
+        size_t end = i + max_len_ < data.size() ? i + max_len_ : data.size();
+        std::vector<uint8_t> chunk(data.begin() + (long)i, data.begin() + (long)end);
+        uint8_t status;
+        std::vector<uint8_t> resp;
+        if (!request(op, (uint8_t)(offset + i), chunk, 0, &status, &resp))
+            return false;
+        if (status != BIN_OK)
+            return fail("Write at offset %d failed (status %d)", (int)(offset + i), status);
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::read_range(uint8_t profile, uint8_t offset, uint8_t len, std::vector<uint8_t>* out)
+{
+    return read_op((uint8_t)(BIN_OP_READ | (profile << 4)), offset, len, out);
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::write_range(uint8_t profile, uint8_t offset, const std::vector<uint8_t>& data)
+{
+    if (!write_op((uint8_t)(BIN_OP_WRITE | (profile << 4)), offset, data))
+        return false;
+
+    /* Read back what we wrote */
+    std::vector<uint8_t> check;
+    if (!read_range(profile, offset, (uint8_t)data.size(), &check))
+        return false;
+    if (check != data)
+        return fail("Verification failed at offset %d", offset);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::read_patterns(uint8_t len, std::vector<uint8_t>* out)
+{
+    return read_op(BIN_OP_PATTERN_READ, 0, len, out);
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::write_patterns(const std::vector<uint8_t>& area)
+{
+    /* Chunks of max_len_ start on the multiples of BIN_MAX_LEN the unit wants */
+    if (!write_op(BIN_OP_PATTERN_WRITE, 0, area))
+        return false;
+
+    /* The unit leaves the magic erased until the commit */
+    std::vector<uint8_t> expected = area, check;
+    expected[0] = 0xFF;
+    if (!read_patterns((uint8_t)area.size(), &check))
+        return false;
+    if (check != expected)
+        return fail("Verification of the patterns failed");
+
+    uint8_t status;
+    std::vector<uint8_t> resp;
+    uint8_t states = area[0] == SEQ_DFA_MAGIC ? area[1] : 0;
+    if (!request(BIN_OP_PATTERN_COMMIT, 0, {}, 0, &status, &resp))
+        return false;
+    if (status != BIN_OK || resp.size() != 1)
+        return fail("Committing the patterns failed (status %d)", status);
+    if (resp[0] != states)
+        return fail("Unit uses %d pattern states instead of %d", resp[0], states);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::save()
+{
+    uint8_t status;
+    std::vector<uint8_t> resp;
+    if (!request(BIN_OP_SAVE, 0, {}, 0, &status, &resp))
+        return false;
+    if (status != BIN_OK)
+        return fail("Saving to NVM failed (status %d)", status);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::write_all(const void* data, size_t len)
+{
+    const char* p = (const char*)data;
+    while (len)
+    {
+        ssize_t n = write(fd_, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return fail("write: %s", strerror(errno));
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+int Link::read_byte(int timeout_ms)
+{
+    struct pollfd p = {fd_, POLLIN, 0};
+    uint8_t b;
+    if (poll(&p, 1, timeout_ms) <= 0 || read(fd_, &b, 1) != 1)
+        return -1;
+    return b;
+}
+
+/* -------------------------------------------------------------------------- */
+void Link::drain(int timeout_ms)
+{
+    while (read_byte(timeout_ms) >= 0) {}
+}
+
+/* -------------------------------------------------------------------------- */
+bool Link::read_response(uint8_t* status, std::vector<uint8_t>* data)
+{
+    int b;
+
+    /* Anything before STX is CLI output, e.g. log messages */
+    do {
+        if ((b = read_byte(500)) < 0)
+            return false;
+    } while (b != BIN_STX);
+
+    int s = read_byte(100);
+    int len = read_byte(100);
+    if (s < 0 || len < 0 || len > BIN_MAX_LEN)
+        return false;
+
+    uint8_t crc = crc8(crc8(0, (uint8_t)s), (uint8_t)len);
+    data->clear();
+    for (int i = 0; i != len; ++i)
+    {
+        if ((b = read_byte(100)) < 0)
+            return false;
+        data->push_back((uint8_t)b);
+        crc = crc8(crc, (uint8_t)b);
+    }
+    if ((b = read_byte(100)) < 0 || b != crc)
+        return false;
+
+    *status = (uint8_t)s;
+    return true;
+}
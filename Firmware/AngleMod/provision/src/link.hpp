@@ -0,0 +1,60 @@
+/*
+ * Host side of the binary protocol described in bin.h
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Info
+{
+    uint8_t config_size;
+    uint8_t profile_count;
+    uint8_t max_len;
+    uint8_t active_profile;
+};
+
+class Link
+{
+public:
+    Link() = default;
+    Link(const Link&) = delete;
+    Link& operator=(const Link&) = delete;
+    ~Link();
+
+    /* Opens the port and drops whatever is on the CLI line */
+    bool open_port(const std::string& path);
+
+    /* Sends a request and waits for the response, retrying on errors */
+    bool request(uint8_t op, uint8_t offset, const std::vector<uint8_t>& payload,
+                 uint8_t read_len, uint8_t* status, std::vector<uint8_t>* response);
+
+    bool get_info(Info* info);
+    bool read_range(uint8_t profile, uint8_t offset, uint8_t len, std::vector<uint8_t>* out);
+
+    /* Writes in chunks, then reads the range back and compares */
+    bool write_range(uint8_t profile, uint8_t offset, const std::vector<uint8_t>& data);
+    bool save();
+
+    /* The pattern area, see seq.h. Writes start at offset 0 and are read back
+     * like write_range(), then committed so the unit starts using them */
+    bool read_patterns(uint8_t len, std::vector<uint8_t>* out);
+    bool write_patterns(const std::vector<uint8_t>& area);
+
+    /* Description of the last failure */
+    const std::string& error() const { return error_; }
+
+private:
+    bool fail(const char* fmt, ...);
+    bool write_all(const void* data, size_t len);
+    int read_byte(int timeout_ms);
+    void drain(int timeout_ms);
+    bool read_response(uint8_t* status, std::vector<uint8_t>* data);
+    bool read_op(uint8_t op, uint8_t offset, uint8_t len, std::vector<uint8_t>* out);
+    bool write_op(uint8_t op, uint8_t offset, const std::vector<uint8_t>& data);
+
+    int fd_ = -1;
+    uint8_t max_len_ = 1;
+    std::string error_;
+};
@@ -0,0 +1,262 @@
+/*
+ * Reads and writes config images over the binary protocol described in
+ * bin.h, instead of typing CLI commands, e.g.
+ *
+ *   provision /dev/ttyUSB0 --read unit.bin
+ *   provision /dev/ttyUSB0 --write unit.bin --profile 1 --save
+ *
+ * An image is the raw struct config of one profile as the PIC lays it out.
+ * Writes are read back and compared before --save commits them to NVM.
+ * Changed bytes only can be written with --poke <offset>:<hex bytes>, e.g.
+ * "--poke 10:2a2a" sets the first angle to (42, 42).
+ *
+ * --patterns compiles a file of user patterns (see patterns.hpp) and writes
+ * them to the pattern area, where they replace the built-in sequences.
+ * --clear-patterns goes back to the built-in ones. Both take effect at once
+ * and don't need --save.
+ *
+ * Any number of ports can be given to provision a batch of units. They are
+ * handled by a pool of --jobs worker threads (default: one per port) and a
+ * summary is printed at the end. The exit code is non-zero if any unit
+ * failed. provision-sim creates simulated units on ptys for testing, e.g.
+ *
+ *   provision-sim --units 32 > ports.txt &
+ *   provision $(cat ports.txt) --write unit.bin --save
+ */
+#include "link.hpp"
+#include "patterns.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    std::vector<std::string> ports;
+    std::string read_file;
+    std::vector<uint8_t> image;  /* Empty if nothing is to be written */
+    std::vector<std::pair<uint8_t, std::vector<uint8_t>>> pokes;
+    std::vector<uint8_t> pattern_area;  /* Empty if the patterns stay */
+    int profile = 0;
+    int jobs = 0;
+    bool save = false;
+};
+
+struct Result
+{
+    bool ok = false;
+    std::string error;
+    long ms = 0;
+};
+
+/* -------------------------------------------------------------------------- */
+bool provision_unit(const Options& o, const std::string& port, std::string* error)
+{
+    Link link;
+    Info info;
+    auto failed = [&]() { *error = link.error(); return false; };
+
+    if (!link.open_port(port) || !link.get_info(&info))
+        return failed();
+    if (o.profile >= info.profile_count)
+    {
+        *error = "Profile " + std::to_string(o.profile) + " out of range, the unit has "
+               + std::to_string(info.profile_count);
+        return false;
+    }
+    if (!o.image.empty() && o.image.size() != info.config_size)
+    {
+        *error = "Image is " + std::to_string(o.image.size()) + " bytes, the unit expects "
+               + std::to_string(info.config_size);
+        return false;
+    }
+
+    uint8_t profile = (uint8_t)o.profile;
+    if (!o.image.empty() && !link.write_range(profile, 0, o.image))
+        return failed();
+    for (const auto& poke : o.pokes)
+        if (!link.write_range(profile, poke.first, poke.second))
+            return failed();
+
+    if (!o.pattern_area.empty() && !link.write_patterns(o.pattern_area))
+        return failed();
+
+    if (!o.read_file.empty())
+    {
+        std::vector<uint8_t> image;
+        if (!link.read_range(profile, 0, info.config_size, &image))
+            return failed();
+        std::ofstream f(o.read_file, std::ios::binary);
+        f.write((const char*)image.data(), (std::streamsize)image.size());
+    }
+
+    if (o.save && !link.save())
+        return failed();
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+std::vector<Result> provision_all(const Options& o)
+{
+    std::vector<Result> results(o.ports.size());
+    std::atomic<size_t> next(0);
+    std::mutex print_mutex;
+
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < o.ports.size(); )
+        {
+            auto start = std::chrono::steady_clock::now();
+            Result& r = results[i];
+            r.ok = provision_unit(o, o.ports[i], &r.error);
+            r.ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(print_mutex);
+            printf("%-20s %s %5ld ms  %s\n", o.ports[i].c_str(),
+                r.ok ? "OK  " : "FAIL", r.ms, r.error.c_str());
+            fflush(stdout);
+        }
+    };
+
+    int jobs = o.jobs > 0 ? o.jobs : (int)o.ports.size();
+    std::vector<std::thread> threads;
+    for (int i = 0; i != jobs; ++i)
+        threads.emplace_back(worker);
+    for (std::thread& t : threads)
+        t.join();
+
+    return results;
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_poke(const std::string& arg, uint8_t* offset, std::vector<uint8_t>* data)
+{
+    size_t colon = arg.find(':');
+    if (colon == std::string::npos || (arg.size() - colon - 1) % 2 != 0)
+        return false;
+    *offset = (uint8_t)atoi(arg.substr(0, colon).c_str());
+    for (size_t i = colon + 1; i < arg.size(); i += 2)
+        data->push_back((uint8_t)strtoul(arg.substr(i, 2).c_str(), nullptr, 16));
+    return !data->empty();
+}
+
+/* -------------------------------------------------------------------------- */
+void print_usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s <serial port> [serial port...] [options]\n"
+        "  --read <file>             Save the config image to a file (one port only)\n"
+        "  --write <file>            Write a config image and verify it\n"
+        "  --poke <offset>:<hex>     Write and verify individual bytes\n"
+        "  --profile <n>             Profile to access (default 0)\n"
+        "  --patterns <file>         Compile and write user patterns\n"
+        "  --clear-patterns          Use the built-in sequences again\n"
+        "  --save                    Commit all profiles to NVM afterwards\n"
+        "  --jobs <n>                Units to provision at once (default all)\n",
+        prog);
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+    Options o;
+    std::string write_file;
+    std::string patterns_file;
+
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--save")
+            o.save = true;
+        else if (arg == "--clear-patterns")
+            o.pattern_area = {0xFF};  /* Erases the first row along with the header */
+        else if ((arg == "--read" || arg == "--write" || arg == "--poke" ||
+                  arg == "--profile" || arg == "--jobs" || arg == "--patterns") && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (arg == "--read")
+                o.read_file = value;
+            else if (arg == "--patterns")
+                patterns_file = value;
+            else if (arg == "--write")
+                write_file = value;
+            else if (arg == "--profile")
+                o.profile = atoi(value.c_str());
+            else if (arg == "--jobs")
+                o.jobs = atoi(value.c_str());
+            else
+            {
+                o.pokes.emplace_back();
+                if (!parse_poke(value, &o.pokes.back().first, &o.pokes.back().second))
+                {
+                    fprintf(stderr, "Invalid --poke '%s'\n", value.c_str());
+                    return -1;
+                }
+            }
+        }
+        else if (arg.rfind("--", 0) != 0)
+            o.ports.push_back(arg);
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (o.ports.empty() || o.profile < 0 || (!o.read_file.empty() && o.ports.size() > 1))
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (!write_file.empty())
+    {
+        std::ifstream f(write_file, std::ios::binary);
+        if (!f)
+        {
+            fprintf(stderr, "Failed to open '%s'\n", write_file.c_str());
+            return -1;
+        }
+        o.image.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+
+    if (!patterns_file.empty())
+    {
+        std::ifstream f(patterns_file);
+        std::vector<Pattern> patterns;
+        std::string error;
+        if (!f)
+        {
+            fprintf(stderr, "Failed to open '%s'\n", patterns_file.c_str());
+            return -1;
+        }
+        if (!parse_patterns(f, &patterns, &error) ||
+            !compile_patterns(patterns, &o.pattern_area, &error))
+        {
+            fprintf(stderr, "%s: %s\n", patterns_file.c_str(), error.c_str());
+            return -1;
+        }
+        printf("%d patterns, %d states\n", (int)patterns.size(), o.pattern_area[1]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Result> results = provision_all(o);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    long ok = std::count_if(results.begin(), results.end(), [](const Result& r) { return r.ok; });
+    printf("%ld/%d units OK in %ld ms\n", ok, (int)results.size(), (long)ms);
+    return ok == (long)results.size() ? 0 : 1;
+}
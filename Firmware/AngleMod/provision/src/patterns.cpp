@@ -0,0 +1,195 @@
+#include "patterns.hpp"
+#include "anglemod/seq.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <sstream>
+
+namespace {
+
+const char* seq_names[] = {
+#define X(name, mirrx, mirry, str, x, y) #name,
+    SEQ_LIST
+#undef X
+};
+
+const char* state_names[] = {
+#define X(name, str) str,
+    JOY_STATE_LIST
+#undef X
+};
+
+/* Must match bin_crc8() in bin.c */
+uint8_t crc8(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (int i = 0; i != 8; ++i)
+        crc = (uint8_t)(crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+    return crc;
+}
+
+/* How far each pattern got, as pattern << 8 | states matched, sorted. A
+ * pattern that matched all of its states stays in the set and matches */
+typedef std::vector<uint16_t> Positions;
+
+/* -------------------------------------------------------------------------- */
+Positions step(const std::vector<Pattern>& patterns, const Positions& from, int state)
+{
+    Positions to;
+    auto advance = [&](size_t p, size_t matched) {
+        const std::vector<int>& s = patterns[p].states;
+        if (matched < s.size() && (s[matched] == PATTERN_ANY || s[matched] == state))
+            to.push_back((uint16_t)(p << 8 | (matched + 1)));
+    };
+
+    for (size_t p = 0; p != patterns.size(); ++p)
+        advance(p, 0);
+    for (uint16_t pos : from)
+        advance(pos >> 8, pos & 0xFF);
+
+    std::sort(to.begin(), to.end());
+    to.erase(std::unique(to.begin(), to.end()), to.end());
+    return to;
+}
+
+/* -------------------------------------------------------------------------- */
+uint32_t matches(const std::vector<Pattern>& patterns, const Positions& positions)
+{
+    uint32_t mask = 0;
+    for (uint16_t pos : positions)
+        if ((pos & 0xFF) == patterns[pos >> 8].states.size())
+            mask |= 1ul << patterns[pos >> 8].seq;
+    return mask;
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+bool parse_patterns(std::istream& in, std::vector<Pattern>* patterns, std::string* error)
+{
+    std::string line;
+    for (int line_nr = 1; std::getline(in, line); ++line_nr)
+    {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string word;
+        if (!(words >> word))
+            continue;
+
+        Pattern p;
+        char* end;
+        long idx = strtol(word.c_str(), &end, 10);
+        if (*end != '\0' || word.empty())
+            idx = std::find(std::begin(seq_names), std::end(seq_names), word) - std::begin(seq_names);
+        if (idx < 0 || idx >= SEQ_COUNT)
+        {
+            *error = "Line " + std::to_string(line_nr) + ": Unknown sequence '" + word + "'";
+            return false;
+        }
+        p.seq = (uint8_t)idx;
+
+        while (words >> word)
+        {
+            if (word == "*")
+            {
+                p.states.push_back(PATTERN_ANY);
+                continue;
+            }
+            auto it = std::find_if(std::begin(state_names), std::end(state_names),
+                [&](const char* name) { return word == name; });
+            if (it == std::end(state_names))
+            {
+                *error = "Line " + std::to_string(line_nr) + ": Unknown state '" + word + "'";
+                return false;
+            }
+            p.states.push_back((int)(it - std::begin(state_names)));
+        }
+        if (p.states.empty())
+        {
+            *error = "Line " + std::to_string(line_nr) + ": Pattern has no states";
+            return false;
+        }
+        patterns->push_back(p);
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+bool compile_patterns(const std::vector<Pattern>& patterns, std::vector<uint8_t>* area,
+                      std::string* error)
+{
+    /*
+     * Subset construction over the positions of all patterns. The stick
+     * never reports the same state twice in a row, so a state that can only
+     * be entered with some joy_state never sees it next. Leaving those
+     * transitions out keeps states that can't happen out of the table.
+     */
+    std::vector<Positions> sets;
+    std::vector<uint16_t> entered_by;
+    std::vector<std::vector<int>> next;
+    std::map<Positions, int> index;
+    std::deque<int> work;
+
+    auto add = [&](const Positions& positions, int state) {
+        auto it = index.find(positions);
+        int i;
+        if (it != index.end())
+            i = it->second;
+        else
+        {
+            i = (int)sets.size();
+            index[positions] = i;
+            sets.push_back(positions);
+            entered_by.push_back(0);
+            next.push_back(std::vector<int>(JOY_STATE_COUNT, -1));
+        }
+        if (!(entered_by[i] & (1u << state)))
+        {
+            entered_by[i] |= (uint16_t)(1u << state);
+            work.push_back(i);  /* Transitions it skipped may be needed now */
+        }
+        return i;
+    };
+
+    add(step(patterns, {}, JOY_NEUTRAL), JOY_NEUTRAL);
+    while (!work.empty())
+    {
+        int i = work.front();
+        work.pop_front();
+        for (int state = 0; state != JOY_STATE_COUNT; ++state)
+        {
+            if (next[i][state] >= 0 || entered_by[i] == (1u << state))
+                continue;
+            next[i][state] = add(step(patterns, sets[i], state), state);
+            if (sets.size() > SEQ_DFA_MAX_STATES)
+            {
+                *error = "Patterns need more than " + std::to_string(SEQ_DFA_MAX_STATES) + " states";
+                return false;
+            }
+        }
+    }
+
+    /* Transitions that can't happen go to the first state */
+    for (std::vector<int>& row : next)
+        for (int& n : row)
+            if (n < 0)
+                n = 0;
+
+    area->assign({SEQ_DFA_MAGIC, (uint8_t)sets.size(), 0});
+    for (size_t i = 0; i != sets.size(); ++i)
+    {
+        for (int state = 0; state < JOY_STATE_COUNT; state += 2)
+        {
+            int high = state + 1 < JOY_STATE_COUNT ? next[i][state + 1] : 0;
+            area->push_back((uint8_t)(next[i][state] | high << 4));
+        }
+        uint32_t mask = matches(patterns, sets[i]);
+        for (int b = 0; b != 3; ++b)
+            area->push_back((uint8_t)(mask >> (b * 8)));
+    }
+    for (size_t i = SEQ_DFA_HEADER; i != area->size(); ++i)
+        (*area)[2] = crc8((*area)[2], (*area)[i]);
+
+    return true;
+}
@@ -0,0 +1,33 @@
+/*
+ * Compiles user patterns into the table the firmware matches them with, see
+ * seq.h. A pattern file has one pattern per line:
+ *
+ *   <sequence> <state> [state...]
+ *
+ * The sequence is a name from SEQ_LIST, e.g. SPEC_S_SE_E, or its index. It
+ * decides which angle is output and which enable bit applies. States are NW,
+ * W, SW, N, neutral, S, NE, E and SE, or * for any state. A pattern matches
+ * when the stick went through its states last. Of all patterns that match,
+ * the highest enabled sequence wins. # starts a comment.
+ */
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+const int PATTERN_ANY = -1;
+
+struct Pattern
+{
+    uint8_t seq;
+    std::vector<int> states;  /* enum joy_state or PATTERN_ANY */
+};
+
+bool parse_patterns(std::istream& in, std::vector<Pattern>* patterns, std::string* error);
+
+/* Builds the contents of the pattern area. Fails if the patterns need more
+ * than SEQ_DFA_MAX_STATES states */
+bool compile_patterns(const std::vector<Pattern>& patterns, std::vector<uint8_t>* area,
+                      std::string* error);
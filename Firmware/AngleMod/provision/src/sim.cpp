@@ -0,0 +1,157 @@
+/*
+ * Runs simulated units for testing provision without hardware. Each unit is
+ * the firmware built against the host stubs, running in its own process
+ * behind a pty. The pty paths are printed one per line, e.g.
+ *
+ *   provision-sim --units 32 > ports.txt &
+ *   provision $(cat ports.txt) --write unit.bin --save
+ *
+ * --realtime limits each unit's output to what 38400 baud can carry, so
+ * transfer times are close to those of real units. The units exit together
+ * with provision-sim.
+ */
+#include "anglemod/btn.h"
+#include "anglemod/uart.h"
+#include <nvm.h>
+#include <xc.h>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+void pic16_init(void);
+void pic16_process_events(void);
+
+namespace {
+
+const int BYTE_TIME_US = 260;  /* 10 bits at 38400 baud */
+
+/* -------------------------------------------------------------------------- */
+void run_unit(int master, pid_t parent, bool realtime)
+{
+    /* Keep the slave open ourselves so the master doesn't see a hangup
+     * between clients, and make sure binary data passes through unchanged */
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios t;
+    if (slave >= 0 && tcgetattr(slave, &t) == 0)
+    {
+        cfmakeraw(&t);
+        tcsetattr(slave, TCSANOW, &t);
+    }
+
+    /* Each unit has its own flash, so --save goes through the NVM sequence */
+    nvm flash;
+
+    /* gpio_init() clears the port, release the button like an edge would */
+    pic16_init();
+    PORTA |= 0x10;
+    btn_ioc_isr();
+    while (getppid() == parent)
+    {
+        struct pollfd p = {master, POLLIN, 0};
+        if (poll(&p, 1, 10) > 0)
+        {
+            char buf[64];
+            ssize_t n = read(master, buf, sizeof(buf));
+            for (ssize_t i = 0; i < n; ++i)
+            {
+                RC1REG = (uint8_t)buf[i];
+                uart_rx_isr();
+                pic16_process_events();  /* The RX buffer only holds 8 bytes */
+            }
+        }
+        pic16_process_events();
+
+        /* Hand the queued output to the pty in place. uart_tx_isr() still
+         * runs last to send a pending XON/XOFF and to disable itself */
+        size_t sent = 0;
+        while (PIE1bits.TX1IE)
+        {
+            const char* data;
+            TX_RWTYPE n;
+            while ((n = rb_tx_peek_contiguous(&data)) != 0)
+            {
+                if (write(master, data, n) < 0) {}
+                rb_tx_commit_take(n);
+                sent += n;
+            }
+            uart_tx_isr();
+            if (PIE1bits.TX1IE)
+            {
+                char c = (char)TX1REG;
+                if (write(master, &c, 1) < 0) {}
+                sent++;
+            }
+        }
+        if (realtime && sent)
+            usleep((useconds_t)(sent * BYTE_TIME_US));
+    }
+    _exit(0);
+}
+
+/* -------------------------------------------------------------------------- */
+void print_usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --units <n>     Number of units to simulate (default 1)\n"
+        "  --realtime      Limit output to 38400 baud\n",
+        prog);
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+    int units = 1;
+    bool realtime = false;
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--units" && i + 1 < argc)
+            units = atoi(argv[++i]);
+        else if (arg == "--realtime")
+            realtime = true;
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    pid_t self = getpid();
+    for (int i = 0; i != units; ++i)
+    {
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        {
+            perror("posix_openpt");
+            return -1;
+        }
+        printf("%s\n", ptsname(master));
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            return -1;
+        }
+        if (pid == 0)
+            run_unit(master, self, realtime);
+        close(master);
+    }
+
+    /* Units notice when we're gone */
+    while (wait(nullptr) > 0) {}
+    return 0;
+}
@@ -0,0 +1,693 @@
+/*
+ * Benchmarks of the firmware running against simulated hardware in virtual
+ * time. Timer periods and baud rates are derived from the registers the
+ * firmware writes, so changing them in the firmware changes the result here.
+ *
+ *   sim-bench [--bench clamp|clock] [--duration <ms>] [--clamp <n>]
+ *             [--conversion-us <n>] [--step-us <n>] [options of the bench]
+ *
+ * clamp: How closely the clamp output follows the stick while the button
+ * is held. The firmware's own ADC code (adc_init(), the sampling mode
+ * functions and adc_isr()) runs against a simulated stick.
+ *
+ *             [--stick circle|flick] [--latency-us <n>] [--vcd <prefix>]
+ *
+ * The error is measured in 8-bit DAC steps between what the console would
+ * see (DAC output while overriding, the stick itself otherwise) and the
+ * ideal clamp of the stick's current position. Only time during which the
+ * clamp matters is counted.
+ *
+ * With --vcd, every DAC update also runs through dac_override_clamp() and the
+ * pin and SPI activity of each mode is written to <prefix>-<mode>.vcd.
+ *
+ * clock: What switching between the idle and boosted clock (see clk.h) saves
+ * and costs. The whole firmware runs, from pic16_init() through the main
+ * loop and the ISR, while the button is pressed periodically and a command
+ * is typed into the CLI. Once with clock switching, and once held at 32 MHz
+ * for comparison.
+ *
+ *             [--press-period-ms <n>] [--hold-ms <n>] [--cli-period-ms <n>]
+ *             [--command <text>] [--loop-instructions <n>] [--switch-us <n>]
+ *             [--idle-ma <n>] [--boost-ma <n>]
+ *
+ * The current is the run current at each frequency times the time spent at
+ * it. The defaults are rough typical figures, pass the ones from the
+ * datasheet for your supply voltage. Press latency is from the button's edge
+ * to the first byte sent to the DACs. The command's bytes are received back
+ * to back, bit by bit, and a switch counts as mid-byte if HFINTOSC is still
+ * settling while a byte is shifting in or out.
+ */
+#include "anglemod/adc.h"
+#include "anglemod/calib.h"
+#include "anglemod/clk.h"
+#include "anglemod/config.h"
+#include "anglemod/dac.h"
+#include "anglemod/gpio.h"
+#include <sim.h>
+#include <xc.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
+
+void pic16_init(void);
+void pic16_process_events(void);
+void isr(void);
+
+namespace {
+
+struct Options
+{
+    std::string bench = "clamp";
+    std::string stick = "circle";
+    double duration = 0;            /* s, 0 for the default of the bench */
+    int clamp = 41;
+    double conversion = 20e-6;      /* Acquisition + conversion time, s */
+    double latency = 30e-6;         /* Main loop, clamp and SPI transfer, s */
+    double step = 2e-6;             /* Resolution of virtual time, s */
+    std::string vcd;                /* Prefix of the VCD files, empty to disable */
+
+    double press_period = 1.0;      /* s */
+    double hold = 0.2;              /* s */
+    double cli_period = 0.5;        /* s */
+    std::string command = "debounce";
+    int loop_instructions = 60;     /* Main loop iteration with nothing to do */
+    double switch_time = 10e-6;     /* HFINTOSC settling after an OSCFRQ change, s */
+    double idle_ma = 0.5;           /* Run current at 4 MHz */
+    double boost_ma = 2.5;          /* Run current at 32 MHz */
+};
+
+struct Mode
+{
+    const char* name;
+    const char* file;
+    void (*enter)(void);
+};
+
+struct Result
+{
+    double trigger_hz;
+    double pair_hz;
+    double pair_latency;  /* Mean age of the older sample when the DACs update, s */
+    double pair_skew;     /* Mean time between the X and Y samples of a pair, s */
+    double mean_err;
+    double p99_err;
+    double max_err;
+};
+
+const double PI = 3.14159265358979323846;
+
+/* -------------------------------------------------------------------------- */
+/* Full range circle at 4 revolutions per second */
+double stick_circle(int axis, double t)
+{
+    double a = 2 * PI * 4 * t;
+    return 127.5 + 127.5 * (axis == 0 ? std::cos(a) : std::sin(a));
+}
+
+/* Flicks between the 8 directions every 50 ms with a 2 ms transition */
+double stick_flick(int axis, double t)
+{
+    static const double dirs[8][2] = {
+        {1, 0}, {-1, 1}, {0, -1}, {1, 1}, {-1, 0}, {1, -1}, {0, 1}, {-1, -1}
+    };
+    int i = (int)(t / 0.05);
+    double f = std::min(1.0, (t - i * 0.05) / 0.002);
+    double from = dirs[(i + 7) % 8][axis];
+    double to = dirs[i % 8][axis];
+    return 127.5 + 127.5 * (from + (to - from) * f);
+}
+
+/* -------------------------------------------------------------------------- */
+double tmr0_clock(uint8_t cs)
+{
+    switch (cs)
+    {
+    case 0x02: return 8e6;   /* Fosc/4 */
+    case 0x03: return 32e6;  /* HFINTOSC */
+    case 0x04: return 31e3;  /* LFINTOSC */
+    case 0x05: return 500e3; /* MFINTOSC */
+    }
+    return 0;
+}
+
+double tmr2_clock(uint8_t cs)
+{
+    switch (cs)
+    {
+    case 0x01: return 8e6;   /* Fosc/4 */
+    case 0x02: return 32e6;  /* Fosc */
+    case 0x03: return 32e6;  /* HFINTOSC */
+    case 0x04: return 31e3;  /* LFINTOSC */
+    case 0x05: return 500e3; /* MFINTOSC */
+    }
+    return 0;
+}
+
+/* Period of the ADC auto-conversion trigger as configured by the firmware */
+double trigger_period(void)
+{
+    switch (ADACT)
+    {
+    case 0x02: {  /* TMR0 overflow, 8-bit mode with TMR0H as period */
+        double clk = tmr0_clock(T0CON1 >> 5);
+        double prescale = (double)(1u << (T0CON1 & 0x0F));
+        return (TMR0H + 1) * prescale / clk;
+    }
+    case 0x04: {  /* TMR2 postscaled */
+        double clk = tmr2_clock(T2CLKCON & 0x0F);
+        double prescale = (double)(1u << ((T2CON >> 4) & 0x07));
+        double postscale = (T2CON & 0x0F) + 1;
+        return (T2PR + 1) * prescale * postscale / clk;
+    }
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Mirrors dac_override_clamp(): Returns 1 and the bound if the value is clamped */
+int clamp(double value, int bound, double* out)
+{
+    double lower = 128 - bound;
+    double upper = 128 + bound;
+    if (value < lower) { *out = lower; return 1; }
+    if (value > upper) { *out = upper; return 1; }
+    *out = value;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+Result run(const Mode& mode, double (*stick)(int, double), const Options& o)
+{
+    struct Update { double time; uint8_t xy[2]; };
+    std::deque<Update> pending;
+    std::vector<double> errors;
+
+    adc_init();
+    calib_build_lut();
+    config_get()->dac_clamp.xy[0] = (uint8_t)o.clamp;
+    config_get()->dac_clamp.xy[1] = (uint8_t)o.clamp;
+    mode.enter();
+
+    Result r = {};
+    double period = trigger_period();
+    if (period <= 0)
+    {
+        fprintf(stderr, "%s: Unsupported trigger configuration (ADACT=%02x)\n", mode.name, ADACT);
+        return r;
+    }
+
+    double next_trigger = period;
+    double conversion_done = -1;  /* < 0 while the ADC is idle */
+    double conversion_start = 0;
+    int conversion_axis = 0;
+    double sample_time[2] = {0, 0};
+    int overriding[2] = {0, 0};
+    double output[2] = {0, 0};
+    long pairs = 0;
+    double latency_sum = 0;
+    double skew_sum = 0;
+
+    if (!o.vcd.empty())
+    {
+        gpio_init();  /* Button is held */
+        sim_time_ns = 0;
+        sim_trace_start();
+    }
+
+    auto start_conversion = [&](double t) {
+        conversion_start = t;
+        conversion_done = t + o.conversion;
+        conversion_axis = ((ADCON0 >> 2) & 0x3F) == 0x0E;  /* CHS: RB5=X, RB6=Y */
+    };
+
+    if (ADCON0 & 0x02)  /* adc_init() starts the first conversion itself */
+    {
+        ADCON0 &= ~0x02;
+        start_conversion(0);
+    }
+
+    for (double t = 0; t < o.duration; t += o.step)
+    {
+        sim_time_advance_to((uint64_t)(t * 1e9));
+
+        if (t >= next_trigger)
+        {
+            next_trigger += period;
+            if (conversion_done < 0)  /* Triggers while busy are lost */
+                start_conversion(t);
+        }
+
+        if (conversion_done >= 0 && t >= conversion_done)
+        {
+            /* Sampled at the end of acquisition, i.e. the start of conversion */
+            double v = stick(conversion_axis, conversion_start);
+            ADRESH = (uint8_t)std::lround(std::min(255.0, std::max(0.0, v)));
+            sample_time[conversion_axis] = conversion_start;
+            conversion_done = -1;
+
+            PIR1bits.ADIF = 1;
+            adc_isr();
+            if (ADCON0 & 0x02)  /* ISR started the next conversion itself */
+            {
+                ADCON0 &= ~0x02;
+                start_conversion(t);
+            }
+
+            if (adc_has_new_data_get_and_clear())
+            {
+                Update u = {t + o.latency, {adc_joy_xy()[0], adc_joy_xy()[1]}};
+                pending.push_back(u);
+                latency_sum += u.time - std::min(sample_time[0], sample_time[1]);
+                skew_sum += std::fabs(sample_time[0] - sample_time[1]);
+                pairs++;
+            }
+        }
+
+        while (!pending.empty() && pending.front().time <= t)
+        {
+            for (int i = 0; i != 2; ++i)
+                overriding[i] = clamp(pending.front().xy[i], o.clamp, &output[i]);
+            if (!o.vcd.empty())
+            {
+                adc_t xy[2] = {pending.front().xy[0], pending.front().xy[1]};
+                dac_override_clamp(xy);
+            }
+            pending.pop_front();
+        }
+
+        for (int i = 0; i != 2; ++i)
+        {
+            double s = stick(i, t);
+            double ideal;
+            int should_clamp = clamp(s, o.clamp, &ideal);
+            double seen = overriding[i] ? output[i] : s;
+            if (should_clamp || overriding[i])
+                errors.push_back(std::fabs(seen - ideal));
+        }
+    }
+
+    adc_set_slow_sampling_mode();
+
+    if (!o.vcd.empty())
+    {
+        std::string path = o.vcd + "-" + mode.file + ".vcd";
+        sim_trace_stop();
+        if (!sim_trace_write_vcd(path.c_str()))
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+        else if (sim_trace_dropped())
+            fprintf(stderr, "%s ends early, %zu events didn't fit\n",
+                    path.c_str(), sim_trace_dropped());
+    }
+
+    r.trigger_hz = 1.0 / period;
+    r.pair_hz = pairs / o.duration;
+    r.pair_latency = pairs ? latency_sum / pairs : 0;
+    r.pair_skew = pairs ? skew_sum / pairs : 0;
+    if (!errors.empty())
+    {
+        double sum = 0;
+        for (double e : errors)
+            sum += e;
+        std::sort(errors.begin(), errors.end());
+        r.mean_err = sum / errors.size();
+        r.p99_err = errors[(size_t)(errors.size() * 0.99)];
+        r.max_err = errors.back();
+    }
+    return r;
+}
+
+/* -------------------------------------------------------------------------- */
+/*
+ * Models what the firmware can't see on the host: TMR1 counting in us, how
+ * long each byte takes to shift out at the baud rate the firmware set, when
+ * received bytes are on the wire, and the time spent at each clock frequency.
+ */
+class ClockBoard : public sim_device
+{
+public:
+    uint64_t tx_reg_free = 0;       /* TX1REG takes the next byte */
+    uint64_t boosted_ns = 0;
+    uint64_t mode_since = 0;
+    long switches = 0;
+    long switches_while_sending = 0;
+    long switches_while_receiving = 0;
+    uint64_t first_spi = 0;         /* Since the last press, 0 if none yet */
+    uint64_t rx_start = 0;          /* Start bit of the last byte received */
+    uint64_t rx_next = UINT64_MAX;  /* Start bit of the byte after it */
+
+    ClockBoard() { sim_attach(this); }
+    ~ClockBoard() { sim_detach(this); }
+
+    void sfr_written(enum sfr_id reg, uint8_t old, uint8_t value) override
+    {
+        (void)old;
+        if (reg == SFR_TX1REG)
+        {
+            /* The byte moves to the shift register once it's empty */
+            double baud = sim_fosc_hz / (4.0 * (SP1BRG + 1));
+            uint64_t start = std::max(sim_time_ns, sim_tx_done_ns);
+            sim_tx_done_ns = start + (uint64_t)(10e9 / baud);
+            tx_reg_free = start;
+        }
+        else if (reg == SFR_OSCFRQ)
+        {
+            /* The write already waited for the settling time */
+            uint64_t written = sim_time_ns - sim_clk_switch_ns;
+            if (written < sim_tx_done_ns)
+                switches_while_sending++;
+            if ((written < sim_rx_idle_ns && sim_time_ns > rx_start) || sim_time_ns > rx_next)
+                switches_while_receiving++;
+            if ((value & 0x07) != 0x05 && boosted)
+                boosted_ns += written - mode_since;
+            boosted = (value & 0x07) == 0x05;
+            mode_since = written;
+            switches++;
+        }
+        else if (reg == SFR_SSP1BUF && first_spi == 0)
+            first_spi = sim_time_ns;
+    }
+
+    double boosted_time(uint64_t end) const
+    {
+        return (boosted_ns + (boosted ? end - mode_since : 0)) * 1e-9;
+    }
+
+private:
+    bool boosted = true;  /* RSTOSC */
+};
+
+struct ClockResult
+{
+    double boosted;       /* Fraction of the time */
+    long switches;
+    long switches_while_sending;
+    long switches_while_receiving;
+    double current_ma;
+    double press_mean;    /* Press to first DAC byte, s */
+    double press_max;
+    long presses;
+    long bytes_sent;
+};
+
+ClockResult run_clock(bool scaling, double (*stick)(int, double), const Options& o)
+{
+    ClockResult r = {};
+    sim_time_ns = 0;
+    sim_tx_done_ns = 0;
+    sim_rx_idle_ns = 0;
+    sim_fosc_hz = 32000000u;
+    sim_clk_switch_ns = (uint32_t)(o.switch_time * 1e9);
+
+    ClockBoard board;
+    pic16_init();
+    config_get()->dac_clamp.xy[0] = (uint8_t)o.clamp;
+    config_get()->dac_clamp.xy[1] = (uint8_t)o.clamp;
+    if (!scaling)
+        clk_boost(0x80);  /* A reason of our own that is never released */
+
+    double next_trigger = trigger_period();
+    double conversion_done = -1;
+    double conversion_start = 0;
+    int conversion_axis = 0;
+    auto start_conversion = [&](double t) {
+        conversion_start = t;
+        conversion_done = t + o.conversion;
+        conversion_axis = ((ADCON0 >> 2) & 0x3F) == 0x0E;
+    };
+    if (ADCON0 & 0x02)
+    {
+        ADCON0 &= ~0x02;
+        start_conversion(0);
+    }
+
+    std::string typed;
+    size_t typed_pos = 0;
+    int receiving = -1;  /* Byte on the wire */
+    double next_command = o.cli_period;
+    double press_time = -1;
+    double latency_sum = 0;
+    bool held = false;
+
+    auto edge = [&](bool press) {
+        uint8_t level = PORTx(BTN_PORT).value();
+        PORTx(BTN_PORT).set(press ? level & ~BTN_BIT : level | BTN_BIT);
+        IOCxF(BTN_PORT).set(IOCxF(BTN_PORT).value() | BTN_BIT);
+        isr();
+    };
+
+    /* gpio_init() cleared the port, release the button like an edge would */
+    edge(false);
+
+    for (double t = 0; t < o.duration; t += o.step)
+    {
+        sim_time_advance_to((uint64_t)(t * 1e9));
+        TMR1.set((uint16_t)(sim_time_ns / 1000));  /* 1 us ticks in either mode */
+
+        /* Button */
+        double phase = std::fmod(t, o.press_period);
+        bool should_hold = t >= o.press_period && phase < o.hold;
+        if (should_hold != held)
+        {
+            held = should_hold;
+            edge(held);
+            if (held)
+            {
+                press_time = t;
+                board.first_spi = 0;
+            }
+        }
+        if (press_time >= 0 && board.first_spi)
+        {
+            double latency = board.first_spi * 1e-9 - press_time;
+            latency_sum += latency;
+            r.press_max = std::max(r.press_max, latency);
+            r.presses++;
+            press_time = -1;
+        }
+
+        /* ADC, triggered by TMR0 or TMR2 like in the clamp bench */
+        double period = trigger_period();
+        if (t >= next_trigger)
+        {
+            next_trigger = t + period;
+            if (conversion_done < 0)
+                start_conversion(t);
+        }
+        if (conversion_done >= 0 && t >= conversion_done)
+        {
+            double v = stick(conversion_axis, conversion_start);
+            ADRESH = (uint8_t)std::lround(std::min(255.0, std::max(0.0, v)));
+            conversion_done = -1;
+            PIR1.set(PIR1.value() | 0x01);  /* ADIF */
+            isr();
+            if (ADCON0 & 0x02)
+            {
+                ADCON0 &= ~0x02;
+                start_conversion(t);
+            }
+        }
+
+        /* Typing a command, the bytes follow each other without a gap. RC1IF
+         * is set in the middle of the stop bit, when the receiver goes idle */
+        if (t >= next_command)
+        {
+            typed = o.command + "\r";
+            typed_pos = 0;
+            next_command += o.cli_period;
+            board.rx_next = (uint64_t)(t * 1e9);
+        }
+        if (receiving < 0 && typed_pos < typed.size() && t * 1e9 >= board.rx_next)
+        {
+            receiving = (uint8_t)typed[typed_pos++];
+            board.rx_start = board.rx_next;
+            board.rx_next = typed_pos < typed.size() ? board.rx_start + SIM_UART_BYTE_NS : UINT64_MAX;
+            sim_rx_idle_ns = board.rx_start + SIM_UART_BYTE_NS * 19 / 20;
+        }
+        if (receiving >= 0 && sim_time_ns >= sim_rx_idle_ns)
+        {
+            RC1REG.set((uint8_t)receiving);
+            PIR1.set(PIR1.value() | 0x20);  /* RC1IF */
+            isr();
+            receiving = -1;
+        }
+
+        /* TX1IF is set while TX1REG can take a byte */
+        if (PIE1bits.TX1IE && sim_time_ns >= board.tx_reg_free)
+        {
+            uint64_t before = sim_tx_done_ns;
+            PIR1.set(PIR1.value() | 0x10);
+            isr();
+            PIR1.set(PIR1.value() & ~0x10);
+            if (sim_tx_done_ns != before)
+                r.bytes_sent++;
+        }
+
+        /* The main loop runs whenever the ISR leaves it time to */
+        if (sim_time_ns <= (uint64_t)(t * 1e9))
+        {
+            pic16_process_events();
+            sim_time_ns += (uint64_t)o.loop_instructions * 4000000000ull / sim_fosc_hz;
+        }
+    }
+
+    uint64_t end = (uint64_t)(o.duration * 1e9);
+    double boosted = board.boosted_time(end);
+    r.boosted = boosted / o.duration;
+    r.switches = board.switches;
+    r.switches_while_sending = board.switches_while_sending;
+    r.switches_while_receiving = board.switches_while_receiving;
+    r.current_ma = (boosted * o.boost_ma + (o.duration - boosted) * o.idle_ma) / o.duration;
+    r.press_mean = r.presses ? latency_sum / r.presses : 0;
+    return r;
+}
+
+/* -------------------------------------------------------------------------- */
+void legacy_mode(void)
+{
+    /* What the fast sampling mode used to do: TMR0 on LFINTOSC, ~500 Hz */
+    adc_set_slow_sampling_mode();
+    TMR0H = 1;
+}
+
+void print_usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --bench <clamp|clock>   What to benchmark (default clamp)\n"
+        "  --stick <circle|flick>  Simulated stick movement (default circle)\n"
+        "  --duration <ms>         Simulated time per run (default 1000, 5000 for clock)\n"
+        "  --clamp <n>             Clamp threshold (default 41)\n"
+        "  --conversion-us <n>     ADC acquisition + conversion time (default 20)\n"
+        "  --step-us <n>           Virtual time resolution (default 2)\n"
+        "clamp:\n"
+        "  --latency-us <n>        Time from new data to DAC update (default 30)\n"
+        "  --vcd <prefix>          Write pin and SPI activity to <prefix>-<mode>.vcd\n"
+        "clock:\n"
+        "  --press-period-ms <n>   Time between button presses (default 1000)\n"
+        "  --hold-ms <n>           How long each press lasts (default 200)\n"
+        "  --cli-period-ms <n>     Time between typed commands (default 500)\n"
+        "  --command <text>        Command to type (default debounce)\n"
+        "  --loop-instructions <n> Cost of an idle main loop iteration (default 60)\n"
+        "  --switch-us <n>         HFINTOSC settling time (default 10)\n"
+        "  --idle-ma <n>           Run current at 4 MHz (default 0.5)\n"
+        "  --boost-ma <n>          Run current at 32 MHz (default 2.5)\n",
+        prog);
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+    Options o;
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+        const char* value = argv[++i];
+        if (arg == "--bench")
+            o.bench = value;
+        else if (arg == "--stick")
+            o.stick = value;
+        else if (arg == "--duration")
+            o.duration = atof(value) * 1e-3;
+        else if (arg == "--clamp")
+            o.clamp = atoi(value);
+        else if (arg == "--conversion-us")
+            o.conversion = atof(value) * 1e-6;
+        else if (arg == "--latency-us")
+            o.latency = atof(value) * 1e-6;
+        else if (arg == "--step-us")
+            o.step = atof(value) * 1e-6;
+        else if (arg == "--vcd")
+            o.vcd = value;
+        else if (arg == "--press-period-ms")
+            o.press_period = atof(value) * 1e-3;
+        else if (arg == "--hold-ms")
+            o.hold = atof(value) * 1e-3;
+        else if (arg == "--cli-period-ms")
+            o.cli_period = atof(value) * 1e-3;
+        else if (arg == "--command")
+            o.command = value;
+        else if (arg == "--loop-instructions")
+            o.loop_instructions = atoi(value);
+        else if (arg == "--switch-us")
+            o.switch_time = atof(value) * 1e-6;
+        else if (arg == "--idle-ma")
+            o.idle_ma = atof(value);
+        else if (arg == "--boost-ma")
+            o.boost_ma = atof(value);
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    double (*stick)(int, double);
+    if (o.stick == "circle")
+        stick = stick_circle;
+    else if (o.stick == "flick")
+        stick = stick_flick;
+    else
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (o.bench == "clock")
+    {
+        if (o.duration <= 0)
+            o.duration = 5.0;
+
+        printf("Stick: %s, press: %.0f ms every %.0f ms, command: \"%s\" every %.0f ms\n",
+            o.stick.c_str(), o.hold * 1e3, o.press_period * 1e3, o.command.c_str(), o.cli_period * 1e3);
+        printf("Assumed: %.1f mA at 4 MHz, %.1f mA at 32 MHz, %.0f us to settle\n\n",
+            o.idle_ma, o.boost_ma, o.switch_time * 1e6);
+        printf("Clock           Boosted  Switches  Current   Press mean  Press max  Bytes  Mid-byte TX  Mid-byte RX\n");
+        for (int scaling = 1; scaling >= 0; --scaling)
+        {
+            ClockResult r = run_clock(scaling != 0, stick, o);
+            printf("%-14s %7.1f%% %9ld %6.2f mA %8.0f us %8.0f us %6ld %12ld %12ld\n",
+                scaling ? "switching" : "fixed 32 MHz", r.boosted * 100, r.switches,
+                r.current_ma, r.press_mean * 1e6, r.press_max * 1e6, r.bytes_sent,
+                r.switches_while_sending, r.switches_while_receiving);
+        }
+        return 0;
+    }
+    else if (o.bench != "clamp")
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (o.duration <= 0)
+        o.duration = 1.0;
+
+    static const Mode modes[] = {
+        {"tmr0 (legacy)", "legacy", legacy_mode},
+        {"high-rate", "high-rate", adc_set_high_rate_mode}
+    };
+
+    printf("Stick: %s, clamp: %d, conversion: %.0f us, latency: %.0f us\n\n",
+        o.stick.c_str(), o.clamp, o.conversion * 1e6, o.latency * 1e6);
+    printf("Mode            Trigger    Pairs   Pair age   X/Y skew   Mean err  P99 err  Max err\n");
+    for (const Mode& m : modes)
+    {
+        Result r = run(m, stick, o);
+        printf("%-14s %6.0f Hz %6.0f/s %7.0f us %7.0f us %9.2f %8.2f %8.2f\n",
+            m.name, r.trigger_hz, r.pair_hz, r.pair_latency * 1e6, r.pair_skew * 1e6,
+            r.mean_err, r.p99_err, r.max_err);
+    }
+
+    return 0;
+}
@@ -0,0 +1,636 @@
+/*
+ * Checks joy_push_state(), seq_find() and dac_override_clamp() against the
+ * reference model in reference.hpp:
+ *
+ *   joy   Every stick position for a grid of threshold and hysteresis
+ *         settings, entering each from a known state
+ *   seq   All 729 histories of 3 states for many enable masks
+ *   dac   Every stick position for every clamp setting, with and without
+ *         calibration, checking what the DAC model receives over SPI
+ *   walk  Long random input sequences through the whole pipeline, with
+ *         random settings, presses and releases
+ *   patterns
+ *         Random sets of user patterns, compiled like provision does and
+ *         written to the flash model, against long random stick movements
+ *
+ * Each worker thread simulates a chip of its own (see HOST_LOCAL and sim.h),
+ * so the work is spread over all cores. Only settings the firmware supports
+ * are checked: threshold + hysteresis / 2 and the clamp must stay below 128,
+ * or the 8-bit limits wrap. Exits with 1 if anything differs.
+ */
+#include "reference.hpp"
+
+#include "anglemod/bin.h"
+#include "anglemod/calib.h"
+#include "anglemod/config.h"
+#include "anglemod/dac.h"
+#include "anglemod/gpio.h"
+#include "anglemod/joy.h"
+#include "anglemod/seq.h"
+#include <mcp48.h>
+#include <nvm.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Range
+{
+    int first, last, step;
+};
+
+struct Options
+{
+    std::string checks = "joy,seq,dac,walk,patterns";
+    Range threshold = {0, 127, 1};
+    Range hysteresis = {0, 255, 1};
+    int masks = 65536;
+    int walks = 1000;
+    int walk_length = 10000;
+    int pattern_sets = 2000;
+    int max_report = 10;
+    unsigned threads = 0;
+    unsigned seed = 1;
+};
+
+const char* seq_names[] = {
+#define X(name, mirrx, mirry, str, x, y) #name,
+    SEQ_LIST
+#undef X
+};
+
+const char* state_names[] = {
+#define X(name, str) #name,
+    JOY_STATE_LIST
+#undef X
+};
+
+/* Calibrations the DAC is checked with. The first one is unusable, so values
+ * pass through */
+const ref::Calib calibrations[] = {
+    {0, 0, 0},
+    {128, 0, 255},
+    {120, 20, 230},
+    {140, 60, 200},
+    {100, 99, 101}
+};
+const int CALIBRATION_COUNT = sizeof(calibrations) / sizeof(*calibrations);
+
+/* -------------------------------------------------------------------------- */
+/* Counts mismatches and prints the first few */
+class Report
+{
+public:
+    explicit Report(int max_printed) : max_printed_(max_printed), count_(0) {}
+
+    void mismatch(const char* fmt, ...)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (count_++ >= (uint64_t)max_printed_)
+            return;
+        va_list va;
+        va_start(va, fmt);
+        vprintf(fmt, va);
+        va_end(va);
+        printf("\n");
+    }
+
+    uint64_t count() const { return count_; }
+
+private:
+    std::mutex mutex_;
+    int max_printed_;
+    uint64_t count_;
+};
+
+/* -------------------------------------------------------------------------- */
+const char* seq_name(enum seq s)
+{
+    return s == SEQ_NONE ? "none" : seq_names[s];
+}
+
+std::string history_str(const enum joy_state* h)
+{
+    return std::string(state_names[h[0]]) + " " + state_names[h[1]] + " " + state_names[h[2]];
+}
+
+std::string dac_str(const ref::DacOutputs& d)
+{
+    char buf[48];
+    snprintf(buf, sizeof(buf), "X %s %u, Y %s %u",
+        d.on[0] ? "on" : "off", d.code[0], d.on[1] ? "on" : "off", d.code[1]);
+    return buf;
+}
+
+/* -------------------------------------------------------------------------- */
+void apply(const ref::Settings& s)
+{
+    struct config* c = config_get();
+    c->joy.xythreshold = s.threshold;
+    c->joy.hysteresis = s.hysteresis;
+    c->enable.bytes[0] = (uint8_t)(s.mask >> 0);
+    c->enable.bytes[1] = (uint8_t)(s.mask >> 8);
+    c->enable.bytes[2] = (uint8_t)(s.mask >> 16);
+    for (int axis = 0; axis != 2; ++axis)
+    {
+        c->dac_clamp.xy[axis] = s.clamp[axis];
+        c->calib.center[axis] = s.calib[axis].center;
+        c->calib.min[axis] = s.calib[axis].min;
+        c->calib.max[axis] = s.calib[axis].max;
+    }
+    for (int i = 0; i != SEQ_COUNT; ++i)
+    {
+        c->angles[i].xy[0] = s.angles[i][0];
+        c->angles[i].xy[1] = s.angles[i][1];
+    }
+    calib_build_lut();
+}
+
+/* The analog switches and what the DAC outputs */
+ref::DacOutputs firmware_dac(const mcp48& dac)
+{
+    uint8_t sw = PORTx(SW_PORT).value();
+    ref::DacOutputs out;
+    out.on[0] = (sw & SWX_BIT) != 0;
+    out.on[1] = (sw & SWY_BIT) != 0;
+    out.code[0] = dac.output_code(0);
+    out.code[1] = dac.output_code(1);
+    return out;
+}
+
+/* The DAC code of an axis doesn't matter while its switch is off */
+bool same_dac(const ref::DacOutputs& a, const ref::DacOutputs& b)
+{
+    for (int axis = 0; axis != 2; ++axis)
+        if (a.on[axis] != b.on[axis] || (a.on[axis] && a.code[axis] != b.code[axis]))
+            return false;
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Runs jobs 0 to count-1 on all workers, each with a freshly set up chip */
+void run_jobs(size_t count, unsigned threads, const std::function<void(size_t, mcp48&)>& job)
+{
+    std::atomic<size_t> next_job(0);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i != threads; ++i)
+        workers.emplace_back([&]() {
+            config_set_defaults();
+            gpio_init();
+            dac_init();
+            mcp48 dac;
+            nvm flash;
+            for (size_t j; (j = next_job++) < count; )
+                job(j, dac);
+        });
+    for (std::thread& t : workers)
+        t.join();
+}
+
+/* -------------------------------------------------------------------------- */
+void check_joy(const Options& o, Report* report)
+{
+    struct Setting { uint8_t threshold, hysteresis; };
+    std::vector<Setting> settings;
+    for (int t = o.threshold.first; t <= o.threshold.last; t += o.threshold.step)
+        for (int h = o.hysteresis.first; h <= o.hysteresis.last; h += o.hysteresis.step)
+            if (t + h / 2 < 128)
+                settings.push_back({(uint8_t)t, (uint8_t)h});
+
+    printf("joy: %zu settings x 65536 positions\n", settings.size());
+    fflush(stdout);
+
+    run_jobs(settings.size(), o.threads, [&](size_t j, mcp48&) {
+        const Setting& s = settings[j];
+        config_get()->joy.xythreshold = s.threshold;
+        config_get()->joy.hysteresis = s.hysteresis;
+
+        /* Coming from NW, a position in the hysteresis band stays there */
+        const adc_t corner[2] = {0, 0};
+        ref::History from;
+        from.push(ref::joy_state(JOY_NEUTRAL, corner, s.threshold, s.hysteresis));
+
+        for (int x = 0; x != 256; ++x)
+            for (int y = 0; y != 256; ++y)
+            {
+                const adc_t xy[2] = {(adc_t)x, (adc_t)y};
+                joy_init();
+                joy_push_state(corner);
+                joy_push_state(xy);
+
+                ref::History expected = from;
+                expected.push(ref::joy_state(from.states[2], xy, s.threshold, s.hysteresis));
+                if (memcmp(joy_state_history(), expected.states, sizeof(expected.states)) != 0)
+                    report->mismatch("joy: threshold %u hysteresis %u at (%d, %d): firmware %s, reference %s",
+                        s.threshold, s.hysteresis, x, y,
+                        history_str(joy_state_history()).c_str(),
+                        history_str(expected.states).c_str());
+            }
+    });
+}
+
+/* -------------------------------------------------------------------------- */
+void check_seq(const Options& o, Report* report)
+{
+    /* None, all, every single sequence on its own, every one left out, and
+     * random masks */
+    std::vector<uint32_t> masks = {0, 0xFFFFFF};
+    for (int s = 0; s != SEQ_COUNT; ++s)
+    {
+        masks.push_back(1ul << s);
+        masks.push_back(0xFFFFFF & ~(1ul << s));
+    }
+    std::mt19937 rng(o.seed);
+    for (int i = 0; i != o.masks; ++i)
+        masks.push_back(rng() & 0xFFFFFF);
+
+    printf("seq: %zu masks x 729 histories\n", masks.size());
+    fflush(stdout);
+
+    const size_t PER_JOB = 256;
+    run_jobs((masks.size() + PER_JOB - 1) / PER_JOB, o.threads, [&](size_t j, mcp48&) {
+        struct config* c = config_get();
+        size_t end = std::min(masks.size(), (j + 1) * PER_JOB);
+        for (size_t m = j * PER_JOB; m != end; ++m)
+        {
+            c->enable.bytes[0] = (uint8_t)(masks[m] >> 0);
+            c->enable.bytes[1] = (uint8_t)(masks[m] >> 8);
+            c->enable.bytes[2] = (uint8_t)(masks[m] >> 16);
+
+            for (int h = 0; h != 729; ++h)
+            {
+                const enum joy_state history[3] = {
+                    (enum joy_state)(h / 81), (enum joy_state)(h / 9 % 9), (enum joy_state)(h % 9)
+                };
+                enum seq got = seq_find(history);
+                enum seq expected = ref::seq_match(history, masks[m]);
+                if (got != expected)
+                    report->mismatch("seq: mask %06x history %s: firmware %s, reference %s",
+                        masks[m], history_str(history).c_str(), seq_name(got), seq_name(expected));
+            }
+        }
+    });
+}
+
+/* -------------------------------------------------------------------------- */
+void check_dac(const Options& o, Report* report)
+{
+    printf("dac: %d calibrations x 128 clamps x 65536 positions\n", CALIBRATION_COUNT);
+    fflush(stdout);
+
+    run_jobs(CALIBRATION_COUNT * 128, o.threads, [&](size_t j, mcp48& dac) {
+        /* The axes get different settings so mixing them up shows */
+        ref::Settings s = {};
+        s.clamp[0] = (uint8_t)(j % 128);
+        s.clamp[1] = (uint8_t)(127 - j % 128);
+        s.calib[0] = calibrations[j / 128];
+        s.calib[1] = calibrations[(j / 128 + 1) % CALIBRATION_COUNT];
+        apply(s);
+
+        for (int x = 0; x != 256; ++x)
+            for (int y = 0; y != 256; ++y)
+            {
+                const adc_t xy[2] = {(adc_t)x, (adc_t)y};
+                dac_override_clamp(xy);
+
+                ref::DacOutputs got = firmware_dac(dac);
+                ref::DacOutputs expected = ref::dac_clamp(xy, s.clamp, s.calib);
+                if (!same_dac(got, expected))
+                    report->mismatch("dac: clamp %u %u calibration %zu at (%d, %d): firmware %s, reference %s",
+                        s.clamp[0], s.clamp[1], j / 128, x, y,
+                        dac_str(got).c_str(), dac_str(expected).c_str());
+            }
+    });
+}
+
+/* -------------------------------------------------------------------------- */
+ref::Settings random_settings(std::mt19937& rng)
+{
+    ref::Settings s;
+    s.threshold = (uint8_t)(rng() % 128);
+    s.hysteresis = (uint8_t)(rng() % (2 * (128 - s.threshold)));
+    s.mask = rng() & 0xFFFFFF;
+    for (int axis = 0; axis != 2; ++axis)
+    {
+        s.clamp[axis] = (uint8_t)(rng() % 128);
+        if (rng() % 2)
+            s.calib[axis] = {0, 0, 0};
+        else
+        {
+            uint8_t center = (uint8_t)(1 + rng() % 254);
+            s.calib[axis].center = center;
+            s.calib[axis].min = (uint8_t)(rng() % center);
+            s.calib[axis].max = (uint8_t)(center + 1 + rng() % (255 - center));
+        }
+    }
+    for (int i = 0; i != SEQ_COUNT; ++i)
+    {
+        s.angles[i][0] = (uint8_t)rng();
+        s.angles[i][1] = (uint8_t)rng();
+    }
+    return s;
+}
+
+/* Same order as process_events() in main.c */
+void check_walk(const Options& o, Report* report)
+{
+    printf("walk: %d walks x %d events\n", o.walks, o.walk_length);
+    fflush(stdout);
+
+    run_jobs((size_t)o.walks, o.threads, [&](size_t j, mcp48& dac) {
+        std::mt19937 rng(o.seed + (unsigned)j);
+        ref::Settings s = random_settings(rng);
+        ref::Pipeline expected(s);
+        apply(s);
+        joy_init();
+        dac_override_disable();
+
+        adc_t xy[2] = {128, 128};
+        bool pressed = false;
+        enum seq active = SEQ_NONE;
+        for (int e = 0; e != o.walk_length; ++e)
+        {
+            const char* what;
+            unsigned r = rng() % 100;
+            if (r < 3 && !pressed)
+            {
+                what = "press";
+                pressed = true;
+                active = seq_find(joy_state_history());
+                if (active == SEQ_NONE)
+                    dac_override_clamp(xy);
+                else
+                    dac_override(config_get()->angles[active].xy);
+                expected.press();
+            }
+            else if (r < 6 && pressed)
+            {
+                what = "release";
+                pressed = false;
+                dac_override_disable();
+                expected.release();
+            }
+            else
+            {
+                /* Mostly small moves, sometimes a jump */
+                what = "sample";
+                for (int axis = 0; axis != 2; ++axis)
+                {
+                    int v = r < 10 ? (int)(rng() % 256) : xy[axis] + (int)(rng() % 41) - 20;
+                    xy[axis] = (adc_t)std::min(255, std::max(0, v));
+                }
+                if (!pressed)
+                    joy_push_state(xy);
+                else if (active == SEQ_NONE)
+                    dac_override_clamp(xy);
+                expected.sample(xy);
+            }
+
+            ref::DacOutputs got = firmware_dac(dac);
+            if (memcmp(joy_state_history(), expected.history().states, sizeof(expected.history().states)) != 0 ||
+                active != expected.active() || !same_dac(got, expected.dac()))
+            {
+                report->mismatch("walk %zu event %d (%s at %u, %u): firmware %s / %s / %s, reference %s / %s / %s",
+                    j, e, what, xy[0], xy[1],
+                    history_str(joy_state_history()).c_str(), seq_name(active), dac_str(got).c_str(),
+                    history_str(expected.history().states).c_str(), seq_name(expected.active()),
+                    dac_str(expected.dac()).c_str());
+                return;  /* The rest of the walk would differ too */
+            }
+        }
+    });
+}
+
+/* -------------------------------------------------------------------------- */
+std::vector<Pattern> random_patterns(std::mt19937& rng)
+{
+    std::vector<Pattern> patterns(1 + rng() % 4);
+    for (Pattern& p : patterns)
+    {
+        p.seq = (uint8_t)(rng() % SEQ_COUNT);
+        p.states.resize(1 + rng() % 5);
+        for (int& s : p.states)
+            s = rng() % 6 == 0 ? PATTERN_ANY : (int)(rng() % JOY_STATE_COUNT);
+    }
+    return patterns;
+}
+
+std::string patterns_str(const std::vector<Pattern>& patterns)
+{
+    std::string s;
+    for (const Pattern& p : patterns)
+    {
+        s += s.empty() ? "" : ", ";
+        s += seq_names[p.seq];
+        for (int state : p.states)
+            s += std::string(" ") + (state == PATTERN_ANY ? "*" : state_names[state]);
+    }
+    return s;
+}
+
+/* Moves the stick into each state, so the table advances through
+ * joy_push_state() like it does on the unit */
+void check_patterns(const Options& o, Report* report)
+{
+    std::atomic<int> too_big(0);
+    printf("patterns: %d pattern sets x %d state changes\n", o.pattern_sets, o.walk_length);
+    fflush(stdout);
+
+    run_jobs((size_t)o.pattern_sets, o.threads, [&](size_t j, mcp48&) {
+        std::mt19937 rng(o.seed + (unsigned)j);
+        std::vector<Pattern> patterns;
+        std::vector<uint8_t> area;
+        std::string error;
+        while (patterns = random_patterns(rng), !compile_patterns(patterns, &area, &error))
+            too_big++;
+
+        for (size_t offset = 0; offset < area.size(); offset += BIN_MAX_LEN)
+            config_write_pattern_area((uint8_t)offset, &area[offset],
+                (uint8_t)std::min<size_t>(BIN_MAX_LEN, area.size() - offset));
+        seq_init();
+        if (seq_dfa_states() != area[1])
+        {
+            report->mismatch("patterns: %s: table with %u states not used", patterns_str(patterns).c_str(), area[1]);
+            return;
+        }
+
+        struct config* c = config_get();
+        uint32_t mask = rng() & 0xFFFFFF;
+        c->joy.xythreshold = 42;
+        c->joy.hysteresis = 14;
+        c->enable.bytes[0] = (uint8_t)(mask >> 0);
+        c->enable.bytes[1] = (uint8_t)(mask >> 8);
+        c->enable.bytes[2] = (uint8_t)(mask >> 16);
+        joy_init();
+
+        std::vector<enum joy_state> stream = {JOY_NEUTRAL};
+        for (int e = 0; e != o.walk_length; ++e)
+        {
+            enum joy_state state;
+            do state = (enum joy_state)(rng() % JOY_STATE_COUNT); while (state == stream.back());
+            const adc_t xy[2] = {(adc_t)(state / 3 * 255 / 2), (adc_t)(state % 3 * 255 / 2)};
+            joy_push_state(xy);
+            stream.push_back(state);
+
+            enum seq got = seq_find(joy_state_history());
+            enum seq expected = ref::pattern_match(patterns, stream, mask);
+            if (got != expected || joy_state_history()[2] != state)  /* Missed a move */
+            {
+                report->mismatch("patterns: %s, mask %06x, after %s: firmware %s, reference %s",
+                    patterns_str(patterns).c_str(), mask,
+                    history_str(joy_state_history()).c_str(), seq_name(got), seq_name(expected));
+                break;
+            }
+        }
+
+        area.assign(1, 0xFF);
+        config_write_pattern_area(0, area.data(), 1);
+        seq_init();
+    });
+
+    printf("patterns: skipped %d sets needing more than %d states\n", too_big.load(), SEQ_DFA_MAX_STATES);
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_range(const char* s, Range* r)
+{
+    int n = sscanf(s, "%d:%d:%d", &r->first, &r->last, &r->step);
+    if (n == 1)
+        r->last = r->first;
+    if (n < 3)
+        r->step = 1;
+    return n >= 1 && r->step > 0 && r->first <= r->last &&
+           r->first >= 0 && r->last <= 255;
+}
+
+/* -------------------------------------------------------------------------- */
+void print_usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --checks <list>        Comma separated checks to run (default joy,seq,dac,walk,patterns)\n"
+        "  --threshold <a[:b[:s]]> joy.xythreshold values for the joy check (default 0:127:1)\n"
+        "  --hysteresis <a[:b[:s]]> joy.hysteresis values for the joy check (default 0:255:1)\n"
+        "  --masks <n>            Random enable masks for the seq check (default 65536)\n"
+        "  --walks <n>            Number of random walks (default 1000)\n"
+        "  --walk-length <n>      Events per walk and pattern set (default 10000)\n"
+        "  --pattern-sets <n>     Number of random pattern sets (default 2000)\n"
+        "  --max-report <n>       Mismatches to print (default 10)\n"
+        "  --threads <n>          Number of worker threads (default: all cores)\n"
+        "  --seed <n>             Seed for masks and walks (default 1)\n",
+        prog);
+}
+
+/* -------------------------------------------------------------------------- */
+bool parse_args(int argc, char** argv, Options* o)
+{
+    for (int i = 1; i != argc; ++i)
+    {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = true;
+
+        if (arg == "--help")
+            return false;
+        if (value == nullptr)
+        {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        ++i;
+
+        if (arg == "--checks")
+            o->checks = value;
+        else if (arg == "--threshold")
+            ok = parse_range(value, &o->threshold);
+        else if (arg == "--hysteresis")
+            ok = parse_range(value, &o->hysteresis);
+        else if (arg == "--masks")
+            ok = (o->masks = atoi(value)) >= 0;
+        else if (arg == "--walks")
+            ok = (o->walks = atoi(value)) >= 0;
+        else if (arg == "--pattern-sets")
+            ok = (o->pattern_sets = atoi(value)) >= 0;
+        else if (arg == "--walk-length")
+            ok = (o->walk_length = atoi(value)) > 0;
+        else if (arg == "--max-report")
+            ok = (o->max_report = atoi(value)) >= 0;
+        else if (arg == "--threads")
+            ok = (o->threads = (unsigned)atoi(value)) > 0;
+        else if (arg == "--seed")
+            o->seed = (unsigned)strtoul(value, nullptr, 0);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "Invalid value for %s: %s\n", arg.c_str(), value);
+            return false;
+        }
+    }
+
+    if (o->threads == 0)
+        o->threads = std::max(1u, std::thread::hardware_concurrency());
+
+    return true;
+}
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+int main(int argc, char** argv)
+{
+    Options o;
+    if (!parse_args(argc, argv, &o))
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    static const struct {
+        const char* name;
+        void (*run)(const Options&, Report*);
+    } checks[] = {
+        {"joy", check_joy},
+        {"seq", check_seq},
+        {"dac", check_dac},
+        {"walk", check_walk},
+        {"patterns", check_patterns}
+    };
+
+    uint64_t total = 0;
+    for (const auto& check : checks)
+    {
+        if (("," + o.checks + ",").find(std::string(",") + check.name + ",") == std::string::npos)
+            continue;
+
+        Report report(o.max_report);
+        auto start = std::chrono::steady_clock::now();
+        check.run(o, &report);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (report.count())
+            printf("%s: %llu mismatches (%.1f s)\n", check.name, (unsigned long long)report.count(), seconds);
+        else
+            printf("%s: OK (%.1f s)\n", check.name, seconds);
+        total += report.count();
+    }
+
+    return total ? 1 : 0;
+}
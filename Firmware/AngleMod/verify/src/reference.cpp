@@ -0,0 +1,243 @@
+#include "reference.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ref {
+
+namespace {
+
+const int CENTER_VALUE = 128;
+
+/* Y grows towards the south */
+const enum joy_state grid[3][3] = {
+    /* x LOW */    {JOY_NW, JOY_W,       JOY_SW},
+    /* x CENTER */ {JOY_N,  JOY_NEUTRAL, JOY_S},
+    /* x HIGH */   {JOY_NE, JOY_E,       JOY_SE}
+};
+
+const char* const state_names[] = {
+#define X(name, str) #name,
+    JOY_STATE_LIST
+#undef X
+};
+
+/* -------------------------------------------------------------------------- */
+enum joy_state parse_state(const std::string& name)
+{
+    for (int i = 0; i != JOY_STATE_COUNT; ++i)
+        if (name == state_names[i])
+            return (enum joy_state)i;
+    abort();
+}
+
+/*
+ * The states of a sequence, straight from its name: CARD_N_NE is "any, N,
+ * NE", SPEC_E_NE_N is "E, NE, N". JOY_NEUTRAL stands for any state.
+ */
+struct BuiltIn
+{
+    enum joy_state states[3];
+
+    explicit BuiltIn(const char* name)
+    {
+        std::vector<std::string> parts;
+        std::string s = strchr(name, '_') + 1;
+        size_t start = 0, end;
+        while ((end = s.find('_', start)) != std::string::npos)
+        {
+            parts.push_back(s.substr(start, end - start));
+            start = end + 1;
+        }
+        parts.push_back(s.substr(start));
+
+        states[0] = JOY_NEUTRAL;
+        for (size_t i = 0; i != parts.size(); ++i)
+            states[3 - parts.size() + i] = parse_state(parts[i]);
+    }
+
+    bool matches(const enum joy_state history[3]) const
+    {
+        for (int i = 0; i != 3; ++i)
+            if (states[i] != JOY_NEUTRAL && states[i] != history[i])
+                return false;
+        return true;
+    }
+};
+
+} /* namespace */
+
+/* -------------------------------------------------------------------------- */
+Zone zone(uint8_t value, uint8_t threshold, uint8_t hysteresis)
+{
+    /* The band is centered on the threshold and is as wide as the hysteresis,
+     * rounded down to an even number */
+    int distance = value - CENTER_VALUE;
+    int half_band = hysteresis / 2;
+
+    if (distance < -(threshold + half_band))
+        return LOW;
+    if (distance > threshold + half_band)
+        return HIGH;
+    if (std::abs(distance) < threshold - half_band)
+        return CENTER;
+    return HYSTERESIS;
+}
+
+/* -------------------------------------------------------------------------- */
+enum joy_state joy_state(enum joy_state current, const uint8_t xy[2],
+                         uint8_t threshold, uint8_t hysteresis)
+{
+    Zone x = zone(xy[0], threshold, hysteresis);
+    Zone y = zone(xy[1], threshold, hysteresis);
+    if (x == HYSTERESIS || y == HYSTERESIS)
+        return current;
+    return grid[x][y];
+}
+
+/* -------------------------------------------------------------------------- */
+History::History()
+{
+    for (enum joy_state& s : states)
+        s = JOY_NEUTRAL;
+}
+
+void History::push(enum joy_state state)
+{
+    if (states[2] == state)
+        return;
+    states[0] = states[1];
+    states[1] = states[2];
+    states[2] = state;
+}
+
+bool History::operator==(const History& other) const
+{
+    return memcmp(states, other.states, sizeof(states)) == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+enum seq seq_match(const enum joy_state history[3], uint32_t mask)
+{
+    static const std::vector<BuiltIn> patterns = {
+#define X(name, mirrx, mirry, str, x, y) BuiltIn(#name),
+        SEQ_LIST
+#undef X
+    };
+
+    /* A special angle contains a diagonal one, e.g. SPEC_E_NE_N ends with
+     * DIAG_NE_N. Later entries of SEQ_LIST take precedence */
+    enum seq found = SEQ_NONE;
+    for (int s = 0; s != SEQ_COUNT; ++s)
+        if ((mask & (1ul << s)) && patterns[s].matches(history))
+            found = (enum seq)s;
+    return found;
+}
+
+/* -------------------------------------------------------------------------- */
+enum seq pattern_match(const std::vector<Pattern>& patterns,
+                       const std::vector<enum joy_state>& stream, uint32_t mask)
+{
+    int best = -1;
+    for (const Pattern& p : patterns)
+    {
+        if (!(mask & (1ul << p.seq)) || p.seq <= best || p.states.size() > stream.size())
+            continue;
+
+        size_t start = stream.size() - p.states.size();
+        bool matches = true;
+        for (size_t i = 0; i != p.states.size(); ++i)
+            if (p.states[i] != PATTERN_ANY && p.states[i] != stream[start + i])
+                matches = false;
+        if (matches)
+            best = p.seq;
+    }
+    return best < 0 ? SEQ_NONE : (enum seq)best;
+}
+
+/* -------------------------------------------------------------------------- */
+uint8_t uncalibrate(const Calib& c, uint8_t value)
+{
+    /* Without a usable calibration, values pass through */
+    if (!(c.min < c.center && c.center < c.max))
+        return value;
+
+    /* Scale each half of the range back onto the stick's own half, rounding
+     * towards the center */
+    if (value <= CENTER_VALUE)
+        return (uint8_t)(c.center - (CENTER_VALUE - value) * (c.center - c.min) / CENTER_VALUE);
+    return (uint8_t)(c.center + (value - CENTER_VALUE) * (c.max - c.center) / (255 - CENTER_VALUE));
+}
+
+/* -------------------------------------------------------------------------- */
+DacOutputs dac_clamp(const uint8_t xy[2], const uint8_t clamp[2], const Calib calib[2])
+{
+    DacOutputs out = {};
+    for (int axis = 0; axis != 2; ++axis)
+    {
+        int lower = CENTER_VALUE - clamp[axis];
+        int upper = CENTER_VALUE + clamp[axis];
+        int limited = xy[axis] < lower ? lower : xy[axis] > upper ? upper : xy[axis];
+        if (limited == xy[axis])
+            continue;
+
+        out.on[axis] = true;
+        out.code[axis] = (uint16_t)(uncalibrate(calib[axis], (uint8_t)limited) << 2);
+    }
+    return out;
+}
+
+/* -------------------------------------------------------------------------- */
+DacOutputs dac_angle(const uint8_t xy[2], const Calib calib[2])
+{
+    DacOutputs out = {};
+    for (int axis = 0; axis != 2; ++axis)
+    {
+        out.on[axis] = true;
+        out.code[axis] = (uint16_t)(uncalibrate(calib[axis], xy[axis]) << 2);
+    }
+    return out;
+}
+
+/* -------------------------------------------------------------------------- */
+Pipeline::Pipeline(const Settings& settings) :
+    settings_(settings),
+    pressed_(false),
+    active_(SEQ_NONE),
+    xy_{128, 128},
+    dac_()
+{
+}
+
+void Pipeline::sample(const uint8_t xy[2])
+{
+    xy_[0] = xy[0];
+    xy_[1] = xy[1];
+
+    if (!pressed_)
+        history_.push(joy_state(history_.states[2], xy,
+            settings_.threshold, settings_.hysteresis));
+    else if (active_ == SEQ_NONE)
+        dac_ = dac_clamp(xy_, settings_.clamp, settings_.calib);
+}
+
+void Pipeline::press()
+{
+    pressed_ = true;
+    active_ = seq_match(history_.states, settings_.mask);
+    if (active_ == SEQ_NONE)
+        dac_ = dac_clamp(xy_, settings_.clamp, settings_.calib);
+    else
+        dac_ = dac_angle(settings_.angles[active_], settings_.calib);
+}
+
+void Pipeline::release()
+{
+    pressed_ = false;
+    dac_.on[0] = false;
+    dac_.on[1] = false;
+}
+
+} /* namespace ref */
@@ -0,0 +1,106 @@
+/*
+ * A reference model of the path from calibrated ADC samples through the
+ * joystick states and sequences to the DAC outputs. It is written to be easy
+ * to check against the documentation in config.h, not to be fast, and shares
+ * no code with the firmware apart from the enums.
+ *
+ * Everything is in 8-bit ADC units, like the default firmware build.
+ */
+#pragma once
+
+#include "anglemod/joy.h"
+#include "anglemod/seq.h"
+#include "patterns.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace ref {
+
+struct Calib
+{
+    uint8_t center, min, max;
+};
+
+struct Settings
+{
+    uint8_t threshold;
+    uint8_t hysteresis;
+    uint32_t mask;       /* Bit n enables sequence n of SEQ_LIST */
+    uint8_t clamp[2];
+    Calib calib[2];
+    uint8_t angles[SEQ_COUNT][2];
+};
+
+/* Where the stick is on one axis */
+enum Zone { LOW, CENTER, HIGH, HYSTERESIS };
+
+Zone zone(uint8_t value, uint8_t threshold, uint8_t hysteresis);
+
+/* The state the stick is in, or `current` if either axis is in the
+ * hysteresis band */
+enum joy_state joy_state(enum joy_state current, const uint8_t xy[2],
+                         uint8_t threshold, uint8_t hysteresis);
+
+/* The last three distinct states, oldest first */
+struct History
+{
+    enum joy_state states[3];
+
+    History();
+    void push(enum joy_state state);
+    bool operator==(const History& other) const;
+};
+
+/* The sequence the history ends with, SEQ_NONE if there is none */
+enum seq seq_match(const enum joy_state history[3], uint32_t mask);
+
+/* The highest enabled sequence of the user patterns the stream of states
+ * ends with. The stream starts with the NEUTRAL the stick starts in */
+enum seq pattern_match(const std::vector<Pattern>& patterns,
+                       const std::vector<enum joy_state>& stream, uint32_t mask);
+
+/* What the console sees from the stick position `value` after calibration */
+uint8_t uncalibrate(const Calib& calib, uint8_t value);
+
+struct DacOutputs
+{
+    bool on[2];         /* Analog switch of each axis */
+    uint16_t code[2];   /* 10-bit DAC code, only meaningful while on */
+};
+
+/* Holds each axis within clamp[axis] of the center, switching the DAC in
+ * only for axes that go past it */
+DacOutputs dac_clamp(const uint8_t xy[2], const uint8_t clamp[2], const Calib calib[2]);
+
+/* Outputs the angle of a sequence on both axes */
+DacOutputs dac_angle(const uint8_t xy[2], const Calib calib[2]);
+
+/*
+ * The main loop: samples move the stick through the states until the button
+ * is pressed. A press either outputs the angle of the sequence that was just
+ * input, or clamps the stick from then on. Releasing hands the stick back.
+ */
+class Pipeline
+{
+public:
+    explicit Pipeline(const Settings& settings);
+
+    void sample(const uint8_t xy[2]);
+    void press();
+    void release();
+
+    const History& history() const { return history_; }
+    enum seq active() const { return active_; }
+    const DacOutputs& dac() const { return dac_; }
+
+private:
+    const Settings& settings_;
+    History history_;
+    bool pressed_;
+    enum seq active_;
+    uint8_t xy_[2];
+    DacOutputs dac_;
+};
+
+} /* namespace ref */